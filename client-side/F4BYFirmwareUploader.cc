@@ -1,62 +1,41 @@
 #include "F4BYFirmwareUploader.h"
 #include "qserialportinfo.h"
-#ifdef Q_OS_LINUX
-#include <openssl/rsa.h>
-#include <openssl/x509.h>
-#endif //Q_OS_LINUX
-#include <QProcess>
-#include <QApplication>
-#include <memory>
+#include "hotplugmonitor.h"
+#include "crc32.h"
+#include "px4image.h"
+#include "sessiontracer.h"
 
-#include <QCryptographicHash>
-#include <QDateTime>
-#include <QMessageBox>
+#include <string.h>
 
 
+#define PROTO_INSYNC 0x12
 #define PROTO_OK 0x10
-#define PROTO_GET_DEVICE 0x22
 #define PROTO_EOC 0x20
+#define PROTO_GET_SYNC 0x21
+#define PROTO_GET_DEVICE 0x22
+#define PROTO_CHIP_ERASE 0x23
+#define PROTO_PROG_MULTI 0x27
+#define PROTO_GET_CRC 0x29
+#define PROTO_GET_OTP 0x2A
+#define PROTO_GET_SN 0x2B
+#define PROTO_BOOT 0x30
 #define PROTO_DEVICE_BL_REV 0x01
 #define PROTO_DEVICE_BOARD_ID 0x02
 #define PROTO_DEVICE_BOARD_REV 0x03
 #define PROTO_DEVICE_FW_SIZE 0x04
 #define PROTO_DEVICE_VEC_AREA 0x05
-
-static const quint32 crctab[] =
-{
-    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
-    0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
-    0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
-    0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
-    0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
-    0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
-    0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
-    0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
-    0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
-    0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
-    0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
-    0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
-    0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
-    0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
-    0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
-    0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
-    0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
-    0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
-    0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
-    0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
-    0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
-    0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
+#define PROG_MULTI_MAX 60
+#define PROG_WINDOW_DEFAULT 4
+#define PX4_USB_VID 0x26AC
+//Time for udev to settle permissions after the bootloader port appeared
+#define PORT_SETTLE_TIME 100
+//Without a removal event in this time the port did not re-enumerate
+#define REENUMERATION_START_TIMEOUT 1000
+#define REENUMERATION_TIMEOUT 10000
+//Fast handshake: line silence that counts as settled and sync timeouts
+#define FAST_QUIET_TIME 20
+#define FAST_SYNC_TIMEOUT 50
+#define FAST_SYNC_TRIES 8
 
 const char *NSH_INIT            = "\x0d\x0d\x0d";
 const char *NSH_REBOOT_BL       = "reboot -b\n";
@@ -64,816 +43,787 @@ const char *NSH_REBOOT          = "reboot\n";
 const char MAVLINK_REBOOT_ID1[]  = {"\xfe\x21\x72\xff\x00\x4c\x00\x00\x80\x3f\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xf6\x00\x01\x00\x00\x48\xf0"};
 const char MAVLINK_REBOOT_ID0[]  = {"\xfe\x21\x45\xff\x00\x4c\x00\x00\x80\x3f\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xf6\x00\x00\x00\x00\xd7\xac"};
 
-static quint32 crc32(const QByteArray src)
+F4BYFirmwareUploader::F4BYFirmwareUploader(QObject *parent) : QObject(parent)
+{
+    m_stop = false;
+    m_running = false;
+    m_waitingForImage = false;
+    m_progWindow = PROG_WINDOW_DEFAULT;
+    m_handshake = ConservativeHandshake;
+    m_delayStep = 0;
+    m_writtenStep = 0;
+    m_quietStep = 0;
+    m_replyHandler = 0;
+    m_replyBytes = 0;
+    m_waitMode = WaitNone;
+    m_tracer = 0;
+
+    m_link = new SerialLink(this);
+    connect(m_link, SIGNAL(ready()), this, SLOT(linkReady()));
+    connect(m_link, SIGNAL(timeout()), this, SLOT(linkTimeout()));
+    connect(m_link, SIGNAL(allWritten()), this, SLOT(linkWritten()));
+    connect(m_link, SIGNAL(quiet()), this, SLOT(linkQuiet()));
+
+    m_delayTimer = new QTimer(this);
+    m_delayTimer->setSingleShot(true);
+    connect(m_delayTimer, SIGNAL(timeout()), this, SLOT(delayElapsed()));
+
+    HotplugMonitor *monitor = HotplugMonitor::instance();
+    connect(monitor, SIGNAL(portAdded(QSerialPortInfo)), this, SLOT(portAdded(QSerialPortInfo)));
+    connect(monitor, SIGNAL(portRemoved(QSerialPortInfo)), this, SLOT(portRemoved(QSerialPortInfo)));
+}
+
+F4BYFirmwareUploader::~F4BYFirmwareUploader()
+{
+}
+
+void F4BYFirmwareUploader::setPortName(const QString &portName)
+{
+    m_portName = portName;
+}
+
+void F4BYFirmwareUploader::setProgWindow(int window)
+{
+    m_progWindow = qMax(1, window);
+}
+
+void F4BYFirmwareUploader::setHandshakeProfile(HandshakeProfile profile)
 {
-    quint32 state = 0;
-    for (unsigned i = 0; i < src.size(); i++)
+    m_handshake = profile;
+}
+
+void F4BYFirmwareUploader::setTracer(SessionTracer *tracer)
+{
+    m_tracer = tracer;
+}
+
+bool F4BYFirmwareUploader::isRunning() const
+{
+    return m_running;
+}
+
+void F4BYFirmwareUploader::stop()
+{
+    m_stop = true;
+    if (m_running)
+        finish();
+}
+
+void F4BYFirmwareUploader::finish()
+{
+    m_running = false;
+    m_waitingForImage = false;
+    m_waitMode = WaitNone;
+    m_delayTimer->stop();
+    m_delayStep = 0;
+    m_writtenStep = 0;
+    m_quietStep = 0;
+    m_replyHandler = 0;
+    m_link->close();
+    if (m_tracer)
+        m_tracer->end(SessionTracer::DeviceLane);
+    emit finished();
+}
+
+void F4BYFirmwareUploader::trace(const QString &phase)
+{
+    if (m_tracer)
+        m_tracer->begin(SessionTracer::DeviceLane, phase);
+}
+
+void F4BYFirmwareUploader::traceCount(const QString &key)
+{
+    if (m_tracer)
+        m_tracer->addArg(SessionTracer::DeviceLane, key);
+}
+
+void F4BYFirmwareUploader::fail(const QString &message)
+{
+    if (m_tracer)
+        m_tracer->setArg(SessionTracer::DeviceLane, "error", message);
+    emit statusUpdate(message);
+    emit error(message);
+    finish();
+}
+
+void F4BYFirmwareUploader::delay(int ms, Step step)
+{
+    //A new step replaces whatever was still waiting for the write
+    m_writtenStep = 0;
+    m_delayStep = step;
+    m_delayTimer->start(ms);
+}
+
+void F4BYFirmwareUploader::delayElapsed()
+{
+    Step step = m_delayStep;
+    m_delayStep = 0;
+    //Write timed out, allWritten() must not run the step a second time
+    m_writtenStep = 0;
+    if (step)
+        (this->*step)();
+}
+
+void F4BYFirmwareUploader::whenWritten(int timeout, Step step)
+{
+    if (m_link->bytesToWrite() == 0)
     {
-        state = crctab[(state ^ static_cast<unsigned char>(src[i])) & 0xff] ^ (state >> 8);
+        delay(0, step);
+        return;
     }
-    return state;
+    delay(timeout, step);
+    m_writtenStep = step;
 }
 
+void F4BYFirmwareUploader::linkWritten()
+{
+    if (!m_writtenStep)
+        return;
+    m_delayTimer->stop();
+    m_delayStep = 0;
+    Step step = m_writtenStep;
+    m_writtenStep = 0;
+    (this->*step)();
+}
 
-F4BYFirmwareUploader::F4BYFirmwareUploader(QObject *parent) : QThread(parent)
+void F4BYFirmwareUploader::settle(int ms, Step step)
 {
-    m_stop = false;
+    //Conservative: sleep ms. Fast: continue as soon as the board stopped
+    //talking, ms is only the upper bound then
+    if (m_handshake == ConservativeHandshake)
+    {
+        delay(ms, step);
+        return;
+    }
+    if (!m_link->isOpen())
+    {
+        delay(0, step);
+        return;
+    }
+    m_quietStep = step;
+    m_link->waitQuiet(FAST_QUIET_TIME, ms);
+}
+
+void F4BYFirmwareUploader::linkQuiet()
+{
+    Step step = m_quietStep;
+    m_quietStep = 0;
+    if (step)
+        (this->*step)();
+}
+
+void F4BYFirmwareUploader::transact(const QByteArray &command, int replyBytes, int timeout, ReplyHandler handler)
+{
+    //Every reply ends with INSYNC OK
+    m_replyHandler = handler;
+    m_replyBytes = replyBytes + 2;
+    m_link->send(command);
+    m_link->expect(m_replyBytes, timeout);
+}
+
+void F4BYFirmwareUploader::linkReady()
+{
+    ReplyHandler handler = m_replyHandler;
+    m_replyHandler = 0;
+    if (!handler)
+        return;
+
+    QByteArray reply = m_link->buffer().read(m_replyBytes);
+    bool ok = (reply.size() == m_replyBytes
+               && reply[m_replyBytes - 2] == (char)PROTO_INSYNC
+               && reply[m_replyBytes - 1] == (char)PROTO_OK);
+    reply.chop(2);
+    (this->*handler)(ok, reply);
+}
+
+void F4BYFirmwareUploader::linkTimeout()
+{
+    ReplyHandler handler = m_replyHandler;
+    m_replyHandler = 0;
+    if (handler)
+        (this->*handler)(false, QByteArray());
 }
 
-bool F4BYFirmwareUploader::reqInfo(unsigned char infobyte,unsigned int *reply)
+void F4BYFirmwareUploader::stepDiscover()
 {
-    m_port->clear();
-    m_port->write(QByteArray().append(PROTO_GET_DEVICE).append(infobyte).append(PROTO_EOC));
-    m_port->waitForBytesWritten(-1);
-    m_port->flush();
-    QByteArray infobuf;
-    int read = readBytes(4,5000,infobuf);
-    if (read != 4)
+    trace("discover");
+    int devicesCount = 0;
+    QSerialPortInfo device;
+    foreach (QSerialPortInfo info, HotplugMonitor::instance()->ports())
     {
-        //QLOG_ERROR() << "Tried to read 4, only read:" << read;
+        if (!m_portName.isEmpty() && info.portName() == m_portName)
+        {
+            device = info;
+        }
+        if(m_portName.isEmpty() && info.hasVendorIdentifier() && info.vendorIdentifier() == PX4_USB_VID && info.hasProductIdentifier() && info.productIdentifier() == 0x0010)
+        {
+            ++devicesCount;
+            device = info;
+        }
+    }
+
+    if (!m_portName.isEmpty())
+    {
+        //Fixed port, used when several boards are flashed at once
+        m_portToUse = m_portName;
+        m_portSerial = device.serialNumber();
+        emit statusUpdate("Trying to reboot board on " + m_portName);
+        settle(500, &F4BYFirmwareUploader::stepReboot);
+        return;
+    }
+    if(devicesCount == 1)
+    {
+        m_portToUse = device.portName();
+        m_portSerial = device.serialNumber();
+        emit statusUpdate("Board found. Trying to reboot");
+        settle(500, &F4BYFirmwareUploader::stepReboot);
+        return;
+    }
+    waitForDevice();
+}
+
+void F4BYFirmwareUploader::waitForDevice()
+{
+    trace("wait for plug");
+    m_waitMode = WaitPlug;
+    emit requestDevicePlug();
+}
+
+void F4BYFirmwareUploader::portAdded(QSerialPortInfo info)
+{
+    if (m_waitMode == WaitPlug)
+    {
+        m_portToUse = info.portName();
+    }
+    else if (m_waitMode == WaitReenumeration)
+    {
+        //Match the bootloader to the board we just rebooted
+        bool sameBoard = (!m_portSerial.isEmpty() && info.serialNumber() == m_portSerial)
+                || info.portName() == m_portToUse
+                || (m_portName.isEmpty() && info.hasVendorIdentifier() && info.vendorIdentifier() == PX4_USB_VID);
+        if (!sameBoard)
+            return;
+        m_portToUse = info.portName();
     }
     else
     {
-        *reply = ((unsigned char)infobuf[0]) + ((unsigned char)infobuf[1] << 8) + ((unsigned char)infobuf[2] << 16) + ((unsigned char)infobuf[3] << 24);
+        return;
     }
-    int sync = get_sync(2000);
-    if (sync != 0)
+    m_waitMode = WaitNone;
+    emit devicePlugDetected();
+    delay(PORT_SETTLE_TIME, &F4BYFirmwareUploader::stepOpen);
+}
+
+void F4BYFirmwareUploader::portRemoved(QSerialPortInfo info)
+{
+    if (m_waitMode == WaitReenumeration && info.portName() == m_portToUse)
     {
-        return false;
+        //The board is on its way into the bootloader, wait for it to come back
+        delay(REENUMERATION_TIMEOUT, &F4BYFirmwareUploader::stepOpen);
     }
-    return true;
 }
 
-int F4BYFirmwareUploader::readBytes(int num,int timeout,QByteArray &buf)
+void F4BYFirmwareUploader::stepReboot()
+{
+    trace("reboot");
+    if (!m_link->open(m_portToUse))
+    {
+        emit error("Cannot open port.");
+        if (!m_portName.isEmpty())
+        {
+            finish();
+            return;
+        }
+        waitForDevice();
+        return;
+    }
+    m_link->send(QByteArray(NSH_INIT, strlen(NSH_INIT) - 1));
+    m_link->send(QByteArray(NSH_REBOOT_BL, strlen(NSH_REBOOT_BL) - 1));
+    m_link->send(QByteArray(NSH_INIT, strlen(NSH_INIT) - 1));
+    m_link->send(QByteArray(NSH_REBOOT, strlen(NSH_REBOOT) - 1));
+    m_link->send(QByteArray(MAVLINK_REBOOT_ID1, sizeof(MAVLINK_REBOOT_ID1) - 1));
+    m_link->send(QByteArray(MAVLINK_REBOOT_ID0, sizeof(MAVLINK_REBOOT_ID0) - 1));
+    whenWritten(1000, &F4BYFirmwareUploader::stepRebootSent);
+}
+
+void F4BYFirmwareUploader::stepRebootSent()
+{
+    trace("re-enumerate");
+    m_link->close();
+    //portRemoved()/portAdded() take over if the board re-enumerates,
+    //otherwise the bootloader is expected on the same port
+    m_waitMode = WaitReenumeration;
+    delay(REENUMERATION_START_TIMEOUT, &F4BYFirmwareUploader::stepOpen);
+}
+
+void F4BYFirmwareUploader::stepOpen()
 {
-    if (m_serialBuffer.size() >= num)
+    if (m_waitMode == WaitReenumeration)
     {
-        buf.append(m_serialBuffer.mid(0,num));
-        m_serialBuffer.remove(0,num);
-        return num;
+        m_waitMode = WaitNone;
+        emit devicePlugDetected();
     }
-    while (m_port->waitForReadyRead(timeout))
+    trace("open");
+    if (!m_link->open(m_portToUse))
     {
-        m_serialBuffer.append(m_port->readAll());
-        if (m_serialBuffer.size() >= num)
+        //QLOG_ERROR() << "Unable to open port" << m_link->errorString() << m_portToUse;
+#ifdef Q_OS_LINUX
+        if(m_link->errorString().contains("busy"))
         {
-            buf.append(m_serialBuffer.mid(0,num));
-            m_serialBuffer.remove(0,num);
-            return num;
+            emit statusUpdate("ERROR: Port " + m_portToUse + " is locked by an external process. Try uninstalling \"modemmanager\" or run: \"sudo lsof /dev/" + m_portToUse + "\" to determine the interfering application.");
         }
+#endif
+        finish();
+        return;
     }
-    //QLOG_DEBUG() << "timeout expired:" << m_serialBuffer.size() << num;
-    return -1;
+    if (m_handshake == FastHandshake)
+        m_link->setLowLatency(true);
+
+    //Clear out the port if anything was in it
+    m_link->send(QByteArray(128, (char)0x0));
+    m_syncTries = 0;
+    settle(1000, &F4BYFirmwareUploader::stepSync);
 }
 
-bool F4BYFirmwareUploader::rebootBoard(const QString &portName)
+void F4BYFirmwareUploader::stepSync()
 {
-    std::auto_ptr<QSerialPort> serialPort(new QSerialPort());
-    msleep(500);
-    serialPort->setPortName(portName);
-    if(!serialPort->open(QIODevice::ReadWrite))
+    //5 retries, the fast handshake starts with a short timeout and doubles it
+    int tries = (m_handshake == FastHandshake) ? FAST_SYNC_TRIES : 5;
+    if (m_syncTries >= tries)
     {
-        emit error("Cannot open port.");
-        serialPort->close();
-        return false;
+        //QLOG_DEBUG() << "Retry timeout";
+        fail("Unable to flash board, " + QString::number(tries) + " retries attempted. Please check hardware and try again");
+        return;
     }
-    serialPort->setBaudRate(QSerialPort::Baud115200);
-    serialPort->setDataBits(QSerialPort::Data8);
-    serialPort->setStopBits(QSerialPort::OneStop);
-    serialPort->setParity(QSerialPort::NoParity);
-    serialPort->setFlowControl(QSerialPort::NoFlowControl);
-    serialPort->setTextModeEnabled(false);
-    serialPort->write(NSH_INIT, strlen(NSH_INIT) - 1);
-    serialPort->write(NSH_REBOOT_BL, strlen(NSH_REBOOT_BL) - 1);
-    serialPort->write(NSH_INIT, strlen(NSH_INIT) - 1);
-    serialPort->write(NSH_REBOOT, strlen(NSH_REBOOT) - 1);
-    serialPort->write(MAVLINK_REBOOT_ID1, sizeof(MAVLINK_REBOOT_ID1) - 1);
-    serialPort->write(MAVLINK_REBOOT_ID0, sizeof(MAVLINK_REBOOT_ID0) - 1);
-    serialPort->waitForBytesWritten(1000);
-    serialPort->close();
-    return true;
+    int timeout = 1000;
+    if (m_handshake == FastHandshake)
+        timeout = qMin(FAST_SYNC_TIMEOUT << m_syncTries, 1000);
+    if (m_syncTries == 0)
+        trace("sync");
+    else
+        traceCount("retries");
+    m_syncTries++;
+    //QLOG_INFO() << "Sending SYNC command, loop" << m_syncTries << "of" << tries;
+    m_link->drain();
+    transact(QByteArray().append(PROTO_GET_SYNC).append(PROTO_EOC), 0, timeout, &F4BYFirmwareUploader::syncReply);
 }
 
-void F4BYFirmwareUploader::stop()
+void F4BYFirmwareUploader::syncReply(bool ok, const QByteArray &/*reply*/)
 {
-    m_stop = true;
+    if (!ok)
+    {
+        settle(500, &F4BYFirmwareUploader::stepSync);
+        return;
+    }
+    //QLOG_INFO() << "Initial Sync successful";
+    m_infoIndex = 0;
+    m_bootloaderRev = 0;
+    m_boardId = 0;
+    m_boardRev = 0;
+    m_flashSize = 0;
+    m_otpString = "";
+    m_snString = "";
+    stepInfo();
 }
 
-bool F4BYFirmwareUploader::loadFile(QString file)
+static const unsigned char infoRequests[] = { PROTO_DEVICE_BL_REV, PROTO_DEVICE_BOARD_ID, PROTO_DEVICE_BOARD_REV, PROTO_DEVICE_FW_SIZE };
+static const char *infoRequestNames[] = { "Requesting bootloader rev", "Requesting board ID", "Requesting board rev", "Requesting firmware size" };
+static const char *infoReplyNames[] = { "Bootloader Rev: ", "Board ID: ", "Board Rev: ", "Flash size: " };
+static const char *infoTraceNames[] = { "info bootloader rev", "info board id", "info board rev", "info flash size" };
+
+void F4BYFirmwareUploader::stepInfo()
 {
-    QFile json(file);
-    json.open(QIODevice::ReadOnly);
-    QByteArray jsonbytes = json.readAll();
-    QString jsonstring(jsonbytes);
-    json.close();
-
-    tempJsonFile = new QTemporaryFile();
-    tempJsonFile->open();
-    tempJsonFile->write(jsonbytes);
-    tempJsonFile->close();
-
-    //This chunk of code is from QUpgrade
-    //Available https://github.com/LorenzMeier/qupgrade
-    // BOARD ID
-    QStringList decode_list = jsonstring.split("\"board_id\":");
-    decode_list = decode_list.last().split(",");
-    if (decode_list.count() < 1)
-    {
-        //QLOG_ERROR() << "Error parsing BOARD ID from .px4 file";
-        return false;
+    trace(infoTraceNames[m_infoIndex]);
+    emit statusUpdate(infoRequestNames[m_infoIndex]);
+    m_link->drain();
+    transact(QByteArray().append(PROTO_GET_DEVICE).append(infoRequests[m_infoIndex]).append(PROTO_EOC), 4, 7000, &F4BYFirmwareUploader::infoReply);
+}
+
+void F4BYFirmwareUploader::infoReply(bool ok, const QByteArray &reply)
+{
+    if (!ok)
+    {
+        //QLOG_WARN() << "Bad sync";
+        emit statusUpdate("Bad sync, retrying from start");
+        stepSync();
+        return;
+    }
+    unsigned int read = ((unsigned char)reply[0]) + ((unsigned char)reply[1] << 8) + ((unsigned char)reply[2] << 16) + ((unsigned char)reply[3] << 24);
+    switch (infoRequests[m_infoIndex])
+    {
+    case PROTO_DEVICE_BL_REV:
+        m_bootloaderRev = read;
+        break;
+    case PROTO_DEVICE_BOARD_ID:
+        m_boardId = read;
+        break;
+    case PROTO_DEVICE_BOARD_REV:
+        m_boardRev = read;
+        break;
+    case PROTO_DEVICE_FW_SIZE:
+        m_flashSize = read;
+        break;
     }
-    QString board_id = QString(decode_list.first().toUtf8()).trimmed();
-    m_loadedBoardID = board_id.toInt();
+    emit statusUpdate(infoReplyNames[m_infoIndex] + QString::number(read));
 
-    // IMAGE SIZE
-    decode_list = jsonstring.split("\"image_size\":");
-    decode_list = decode_list.last().split(",");
-    if (decode_list.count() < 1)
+    if (++m_infoIndex < 4)
     {
-        //QLOG_ERROR() << "Error parsing IMAGE SIZE from .px4 file";
-        return false;
+        settle(500, &F4BYFirmwareUploader::stepInfo);
+        return;
     }
-    QString image_size = QString(decode_list.first().toUtf8()).trimmed();
-    m_loadedFwSize = image_size.toInt();
+    m_link->drain();
+    settle(250, &F4BYFirmwareUploader::stepOtpStart);
+}
 
-    // DESCRIPTION
-    decode_list = jsonstring.split("\"description\": \"");
-    decode_list = decode_list.last().split("\"");
-    if (decode_list.count() < 1)
+void F4BYFirmwareUploader::stepOtpStart()
+{
+    if (m_bootloaderRev < 4)
     {
-        //QLOG_ERROR() << "Error parsing DESCRIPTION from .px4 file";
-        return false;
+        stepBoardInfo();
+        return;
     }
-    m_loadedDescription = QString(decode_list.first().toUtf8()).trimmed();
-    QStringList list = jsonstring.split("\"image\": \"");
-    list = list.last().split("\"");
+    //QLOG_INFO() << "Requesting COA";
+    emit statusUpdate("Requesting COA");
+    trace("otp");
+    memset(m_otpBuf, 0, sizeof(m_otpBuf));
+    m_otpIndex = 0;
+    stepOtp();
+}
 
-    //Create the "image" to be written to the board
-    //from loaded data
+void F4BYFirmwareUploader::stepOtp()
+{
+    m_link->drain();
+    transact(QByteArray().append(PROTO_GET_OTP).append(m_otpIndex & 0xFF).append((m_otpIndex >> 8) & 0xFF).append((char)0).append((char)0), 4, 4000, &F4BYFirmwareUploader::otpReply);
+}
 
-    QByteArray fwimage;
+void F4BYFirmwareUploader::otpReply(bool ok, const QByteArray &reply)
+{
+    if (!ok)
+    {
+        //QLOG_ERROR() << "Bad OTP read, retrying" << m_otpIndex;
+        traceCount("retries");
+        delay(1000, &F4BYFirmwareUploader::stepOtp);
+        return;
+    }
+    memcpy(m_otpBuf + m_otpIndex, reply.constData(), 4);
+    m_otpIndex += 4;
+    if (m_otpIndex < (int)sizeof(m_otpBuf))
+    {
+        stepOtp();
+        return;
+    }
 
-    fwimage.append((unsigned char)((m_loadedFwSize >> 24) & 0xFF));
-    fwimage.append((unsigned char)((m_loadedFwSize >> 16) & 0xFF));
-    fwimage.append((unsigned char)((m_loadedFwSize >> 8) & 0xFF));
-    fwimage.append((unsigned char)((m_loadedFwSize >> 0) & 0xFF));
+    //QLOG_INFO() << "COA read";
+    if (m_otpBuf[0] != 80 && m_otpBuf[1] != 88 && m_otpBuf[2] != 52 && m_otpBuf[3] != 0)
+    {
+        //QLOG_ERROR() << "COA header failure";
+        stepSync();
+        return;
+    }
+    //Let's format this like MP does
+    QString otpoutput = "";
+    for (int i=0;i<512;i++)
+    {
+        otpoutput += (m_otpBuf[i] <= 0xF ? "0" : "") + QString::number(m_otpBuf[i],16).toUpper() + " ";
+        if (i % 16 == 15)
+        {
+            m_otpString += otpoutput + "\n";
+            otpoutput = "";
+        }
+    }
+
+    //Create an empty buffer for the serialnumber
+    emit statusUpdate("Requesting board SN");
+    trace("sn");
+    memset(m_snBuf, 0, sizeof(m_snBuf));
+    m_snIndex = 0;
+    stepSn();
+}
+
+void F4BYFirmwareUploader::stepSn()
+{
+    m_link->drain();
+    transact(QByteArray().append(PROTO_GET_SN).append(m_snIndex).append((char)0).append((char)0).append((char)0).append(PROTO_EOC), 4, 4000, &F4BYFirmwareUploader::snReply);
+}
+
+void F4BYFirmwareUploader::snReply(bool ok, const QByteArray &reply)
+{
+    if (reply.isEmpty())
+    {
+        //QLOG_ERROR() << "wrong bytes available";
+        traceCount("retries");
+        delay(1000, &F4BYFirmwareUploader::stepSn);
+        return;
+    }
+    if (!ok)
+    {
+        //QLOG_ERROR() << "Bad sync";
+        stepSync();
+        return;
+    }
+    m_snBuf[m_snIndex] = reply[3];
+    m_snBuf[m_snIndex+1] = reply[2];
+    m_snBuf[m_snIndex+2] = reply[1];
+    m_snBuf[m_snIndex+3] = reply[0];
+    m_snIndex += 4;
+    if (m_snIndex < (int)sizeof(m_snBuf))
+    {
+        stepSn();
+        return;
+    }
 
-    QByteArray raw64 = list.first().toUtf8();
+    QString SN = "";
+    for (int i=0;i<12;i++)
+    {
+        SN += (m_snBuf[i] <= 0xF ? "0" : "") + QString::number(m_snBuf[i],16).toUpper() + " ";
+    }
+    //QLOG_INFO() << "Board SN:" << SN;
+    m_snString = SN;
+    stepBoardInfo();
+}
 
-    fwimage.append(QByteArray::fromBase64(raw64));
-    QByteArray uncompressed = qUncompress(fwimage);
+void F4BYFirmwareUploader::stepBoardInfo()
+{
+    emit boardRev(m_boardRev);
+    emit boardId(m_boardId);
+    emit bootloaderRev(m_bootloaderRev);
+    emit flashSize(m_flashSize);
+    emit serialNumber(m_snString);
+    emit OTP(m_otpString);
+
+    m_failure = 0;
+    m_window = m_progWindow;
+    //A known image is checked before anything is erased
+    if (!m_image.isEmpty() && !checkImage())
+        return;
+    stepErase();
+}
 
-    //QLOG_INFO() << "Firmware size:" << uncompressed.size() << "expected" << m_loadedFwSize << "bytes";
-    if (uncompressed.size() != m_loadedFwSize)
+bool F4BYFirmwareUploader::checkImage()
+{
+    if ((int)m_loadedBoardID != m_boardId)
     {
-        //QLOG_ERROR() << "Error in decompressing firmware. Please re-download and try again";
-        m_port->close();
+        fail(QString("Firmware is built for board %1, this board is %2").arg(m_loadedBoardID).arg(m_boardId));
         return false;
     }
-    //Per QUpgrade, pad it to a 4 byte multiple.
-    while ((uncompressed.count() % 4) != 0)
+    if (m_image.size() > m_flashSize)
     {
-        uncompressed.append((char)0xFF);
+        fail(QString("Firmware of %1 bytes does not fit into %2 bytes of flash").arg(m_image.size()).arg(m_flashSize));
+        return false;
     }
-    tempFile = new QTemporaryFile();
-    tempFile->open();
-    tempFile->write(uncompressed);
-    tempFile->close();
-    start();
     return true;
 }
 
-void F4BYFirmwareUploader::run()
+void F4BYFirmwareUploader::stepErase()
 {
-    //emit requestDevicePlug();
-    bool found = false;
-    QList<QString> portlist;
-    QString portnametouse = "";
-    int size = 0;
-    int devicesCount = 0;
-    int deviceIndex = -1;
-    foreach (QSerialPortInfo info,QSerialPortInfo::availablePorts())
+    //QLOG_INFO() << "Requesting erase";
+    emit statusUpdate("Erasing flash, this may take up to a minute");
+    trace("erase");
+    m_link->drain();
+    transact(QByteArray().append(PROTO_CHIP_ERASE).append(PROTO_EOC), 0, 60000, &F4BYFirmwareUploader::eraseReply);
+}
+
+void F4BYFirmwareUploader::eraseReply(bool ok, const QByteArray &/*reply*/)
+{
+    if (!ok)
     {
-        if(info.hasVendorIdentifier() && info.vendorIdentifier() == 0x26AC && info.hasProductIdentifier() && info.productIdentifier() == 0x0010)
-        {
-            ++devicesCount;
-            deviceIndex = portlist.size();
-        }
-        portlist.append(info.portName());
+        //QLOG_DEBUG() << "never returned from erase.";
+        fail("Flash erase never completed, please restart autopilot board and retry.");
+        return;
     }
+    m_link->drain();
+    if (m_image.isEmpty())
+    {
+        //Prepared ahead of the download, the bootloader waits for us
+        emit statusUpdate("Board erased, waiting for the firmware");
+        trace("wait for firmware");
+        m_waitingForImage = true;
+        return;
+    }
+    settle(1000, &F4BYFirmwareUploader::stepProgramStart);
+}
 
-    if(devicesCount == 1 && deviceIndex != -1)
+void F4BYFirmwareUploader::stepProgramStart()
+{
+    //Pipelined, the image arrived only after the board was read and erased
+    if (!checkImage())
+        return;
+    //QLOG_INFO() << "Starting flash process";
+    emit statusUpdate("Flashing firmware");
+    trace("program");
+    if (m_tracer)
     {
-        portnametouse = portlist[deviceIndex];
-        emit statusUpdate("Board found. Trying to reboot");
-        found = rebootBoard(portnametouse);
+        m_tracer->setArg(SessionTracer::DeviceLane, "bytes", m_image.size());
+        m_tracer->setArg(SessionTracer::DeviceLane, "window", m_window);
     }
-    if(!found)
-        emit requestDevicePlug();
+    m_inflight.clear();
+    m_inflightSent.clear();
+    m_frameRtt.clear();
+    m_rttTimer.start();
+    m_sent = 0;
+    m_acked = 0;
+    m_crc = 0;
+    m_crcDone = 0;
+    m_progressCounter = 0;
+    m_link->drain();
+    programFill();
+}
 
-    size = portlist.size();
-    while (!found)
+void F4BYFirmwareUploader::programFill()
+{
+    //Keep up to m_window PROG_MULTI frames in flight, the replies
+    //arrive in order so every INSYNC/OK acknowledges the oldest
+    //outstanding frame. A window of 1 is plain stop-and-wait.
+    while (m_inflight.size() < m_window && m_sent < m_image.size())
     {
-        foreach (QSerialPortInfo info,QSerialPortInfo::availablePorts())
-        {
-            if (!portlist.contains(info.portName()))
-            {
-                portnametouse = info.portName();
-                found = true;
-                break;
-            }
-        }
-        if (size > QSerialPortInfo::availablePorts().size())
-        {
-            //Something has been removed. Rescan.
-            portlist.clear();
-            foreach (QSerialPortInfo info,QSerialPortInfo::availablePorts())
-            {
-                portlist.append(info.portName());
-            }
-            size = portlist.size();
-        }
-        if (m_stop)
-        {
-            return;
-        }
-        msleep(10);
+        int len = qMin(PROG_MULTI_MAX, m_image.size() - m_sent);
+        QByteArray tosend;
+        tosend.append(PROTO_PROG_MULTI);
+        tosend.append(len);
+        tosend.append(m_image.constData() + m_sent, len);
+        tosend.append(PROTO_EOC);
+        m_link->send(tosend);
+        m_inflight.append(len);
+        m_inflightSent.append(m_rttTimer.nsecsElapsed() / 1000);
+        m_sent += len;
     }
-    emit devicePlugDetected();
-    m_port = new QSerialPort();
-    msleep(500);
-    m_port->setPortName(portnametouse);
-    if (!m_port->open(QIODevice::ReadWrite))
+    //Fold what just went out into the running CRC, so the verify step
+    //only has to account for the 0xFF padding
+    m_crc = crc32Update(m_crc, m_image.constData() + m_crcDone, m_sent - m_crcDone);
+    m_crcDone = m_sent;
+    m_replyHandler = &F4BYFirmwareUploader::programReply;
+    m_replyBytes = 2;
+    m_link->expect(m_replyBytes, 1000);
+}
+
+void F4BYFirmwareUploader::programReply(bool ok, const QByteArray &/*reply*/)
+{
+    if (!ok)
     {
-        //QLOG_ERROR() << "Unable to open port" << m_port->errorString() << m_port->portName();
-#ifdef Q_OS_LINUX
-        if(m_port->errorString().contains("busy"))
+        if (++m_failure > 2)
         {
-            emit statusUpdate("ERROR: Port " + m_port->portName() + " is locked by an external process. Try uninstalling \"modemmanager\" or run: \"sudo lsof /dev/" + m_port->portName() + "\" to determine the interfering application.");
+            //QLOG_FATAL() << "error writing firmware" << m_acked << m_image.size();
+            if (m_tracer)
+                m_tracer->setArg(SessionTracer::DeviceLane, "error", "invalid sync");
+            emit error("Error writing firmware, invalid sync. Please retry");
+            finish();
+            return;
         }
-#endif
+        //Fall back to stop-and-wait for the retry
+        traceCount("failures");
+        m_window = 1;
+        delay(1000, &F4BYFirmwareUploader::stepErase);
         return;
     }
-    m_port->setBaudRate(QSerialPort::Baud115200);
-    m_port->setDataBits(QSerialPort::Data8);
-    m_port->setStopBits(QSerialPort::OneStop);
-    m_port->setParity(QSerialPort::NoParity);
-    m_port->setFlowControl(QSerialPort::NoFlowControl);
-    m_port->setTextModeEnabled(false);
-
-    //Clear out the port if anything was in it
-    for (int i=0;i<128;i++)
+    m_acked += m_inflight.takeFirst();
+    //Time from queueing the frame to its INSYNC/OK, waiting behind the
+    //rest of the window included
+    m_frameRtt.append(m_rttTimer.nsecsElapsed() / 1000 - m_inflightSent.takeFirst());
+    if (m_progressCounter++ % 50 == 0)
     {
-        m_port->write(QByteArray().append((char)0x0));
+        emit flashProgress(m_acked, m_image.size());
+        //QLOG_INFO() << "flashing:" << m_acked << "/" << m_image.size();
     }
-    m_port->waitForBytesWritten(100);
-    msleep(1000);
-    while(m_port->bytesAvailable())
+    if (m_acked < m_image.size())
     {
-        m_port->read(1)[0];
+        programFill();
+        return;
     }
+    if (m_tracer)
+        m_tracer->setArg(SessionTracer::DeviceLane, "frame_rtt", SessionTracer::histogram(m_frameRtt));
+    stepCrc();
+}
 
-    if (m_stop)
+void F4BYFirmwareUploader::stepCrc()
+{
+    //QLOG_DEBUG() << "Done";
+    emit statusUpdate("Flashing complete, verifying");
+    trace("verify crc");
+    m_link->drain();
+    transact(QByteArray().append(PROTO_GET_CRC).append(PROTO_EOC), 4, 7000, &F4BYFirmwareUploader::crcReply);
+}
+
+void F4BYFirmwareUploader::crcReply(bool ok, const QByteArray &reply)
+{
+    if (!ok)
     {
-        m_port->close();
-        delete m_port;
+        fail("Unable to read the firmware CRC from the board, please try again");
         return;
     }
 
-    //5 retries
-    for (int retry=0;retry<5;retry++)
+    //reply has our expected CRC, calculate it ourselves.
+    //The image was summed while sending, the bootloader pads the rest
+    //of the flash with 0xFF.
+    quint32 remotecrc = m_crc;
+    if (m_flashSize > m_image.size())
+        remotecrc = crc32Fill(remotecrc, 0xFF, m_flashSize - m_image.size());
+    quint32 localcrc = 0;
+    localcrc += static_cast<unsigned char>(reply[0]);
+    localcrc += static_cast<unsigned char>(reply[1]) << 8;
+    localcrc += static_cast<unsigned char>(reply[2]) << 16;
+    localcrc += static_cast<unsigned char>(reply[3]) << 24;
+    //QLOG_DEBUG() << "Remote CRC:" << QString::number(remotecrc,16).toUpper();
+    //QLOG_DEBUG() << "Local CRC:" << QString::number(localcrc,16).toUpper();
+    if (remotecrc != localcrc)
     {
-        //QLOG_INFO() << "Sending SYNC command, loop" << retry << "of" << 5;
-        m_port->write(QByteArray().append(0x21).append(0x20));
-        m_port->waitForBytesWritten(-1);
-        m_port->flush();
-        int sync = get_sync();
-        if (sync == 0)
-        {
-            //QLOG_INFO() << "Initial Sync successful";
-            int bootloaderrev=0;
-            int boardid=0;
-            int boardrev=0;
-            int flashsize=0;
-            QString otpstr = "";
-            QString snstr = "";
-            //we're synced
-            unsigned int read = 0;
-            emit statusUpdate("Requesting bootloader rev");
-            bool reply = reqInfo(PROTO_DEVICE_BL_REV,&read);
-            if (!reply)
-            {
-                //QLOG_WARN() << "Bad sync";
-                emit statusUpdate("Bad sync, retrying from start");
-                continue;
-            }
-            bootloaderrev = read;
-            //QLOG_INFO() << "Bootloader rev:" << read;
-            emit statusUpdate("Bootloader Rev: " + QString::number(read));
-            if (bootloaderrev >= 4)
-            {
-                //QLOG_FATAL() << "F4BYFirmware Uploader does not yet support V4 bootloaders";
-                //emit statusUpdate("F4BY Firmware Uploader does not yet support V4 bootloaders");
-                //emit error("F4BYFirmwareUploader does not yet support V4 bootloaders");
-                //return;
-            }
-            msleep(500);
-            emit statusUpdate("Requesting board ID");
-            reply = reqInfo(PROTO_DEVICE_BOARD_ID,&read);
-            if (!reply)
-            {
-                //QLOG_WARN() << "Bad sync";
-                emit statusUpdate("Bad sync, retrying from start");
-                continue;
-            }
-            boardid = read;
-            //QLOG_INFO() << "Board ID:" << read;
-            emit statusUpdate("Board ID: " + QString::number(read));
-            msleep(500);
-            emit statusUpdate("Requesting board rev");
-            reply = reqInfo(PROTO_DEVICE_BOARD_REV,&read);
-            if (!reply)
-            {
-                //QLOG_WARN() << "Bad sync";
-                emit statusUpdate("Bad sync, retrying from start");
-                continue;
-            }
-            //QLOG_INFO() << "Board rev:" << read;
-            emit statusUpdate("Board Rev: " + QString::number(read));
-            boardrev = read;
-            msleep(500);
-            emit statusUpdate("Requesting firmware size");
-            reply = reqInfo(PROTO_DEVICE_FW_SIZE,&read);
-            if (!reply)
-            {
-                //QLOG_WARN() << "Bad sync";
-                emit statusUpdate("Bad sync, retrying from start");
-                continue;
-            }
-            //QLOG_INFO() << "Flash size:" << read;
-            emit statusUpdate("Flash size: " + QString::number(read));
-            flashsize = read;
-
-            while(m_port->bytesAvailable())
-            {
-                m_port->read(1)[0];
-            }
-            if (m_stop)
-            {
-                m_port->close();
-                delete m_port;
-                return;
-            }
-
-            //Create an empty buffer
-            msleep(250);
-            unsigned char otpbuf[512];
-            memset(otpbuf,0,512);
-            bool bad = false;
-            int timeout = 0;
-            if (bootloaderrev >= 4)
-            {
-                //QLOG_INFO() << "Requesting COA";
-                emit statusUpdate("Requesting COA");
-                for (int i=0;i<512;i+=4)
-                {
-                    m_port->clear();
-                    m_port->write(QByteArray().append(0x2A).append(i & 0xFF).append(((i >> 8) & 0xFF)).append((char)0).append((char)0));//.append(PROTO_EOC));
-                    m_port->waitForBytesWritten(-1);
-                    m_port->flush();
-                    timeout = 0;
-
-                    QByteArray bytes;
-                    int count = readBytes(4,2000,bytes);
-                    if (count < 4)
-                    {
-                        //QLOG_ERROR() << "wrong bytes available:" << count;
-                        //bad = true;
-                        i-=4;
-                        m_port->waitForReadyRead(1000);
-                        while(m_port->bytesAvailable())
-                        {
-                            m_port->read(1)[0];
-                        }
-                        //Clear the port
-                        m_port->clear();
-                        continue;
-                    }
-
-                    otpbuf[i] = bytes[0];
-                    otpbuf[i+1] = bytes[1];
-                    otpbuf[i+2] = bytes[2];
-                    otpbuf[i+3] = bytes[3];
-                    int sync = get_sync(2000);
-                    if (sync != 0)
-                    {
-                        //QLOG_ERROR() << "Bad sync";
-                        i-=4;
-                        m_port->waitForReadyRead(1000);
-                        while(m_port->bytesAvailable())
-                        {
-                            m_port->read(1)[0];
-                        }
-                        continue;
-                        //bad = true;
-                        //break;
-                    }
-                    if (m_stop)
-                    {
-                        m_port->close();
-                        delete m_port;
-                        return;
-                    }
-                }
-                if (bad)
-                {
-                    continue;
-                }
-                //QLOG_INFO() << "COA read";
-                if (otpbuf[0] != 80 && otpbuf[1] != 88 && otpbuf[2] != 52 && otpbuf[3] != 0)
-                {
-                    //QLOG_ERROR() << "COA header failure";
-                    continue;
-                }
-                //Let's format this like MP does
-                QString otpoutput = "";
-                for (int i=0;i<512;i++)
-                {
-                    otpoutput += (otpbuf[i] <= 0xF ? "0" : "") + QString::number(otpbuf[i],16).toUpper() + " ";
-                    if (i % 16 == 15)
-                    {
-                        //QLOG_TRACE() << otpoutput;
-                        otpstr += otpoutput + "\n";
-                        otpoutput = "";
-                    }
-                }
-                //QLOG_INFO() << "COA:" << otpstr;
-
-
-                //Create an empty buffer for the serialnumber
-                emit statusUpdate("Requesting board SN");
-                unsigned char snbuf[12];
-                memset(snbuf,0,12);
-                for (int i=0;i<12;i+=4)
-                {
-                    m_port->clear();
-                    m_port->write(QByteArray().append(0x2B).append(i).append((char)0).append((char)0).append((char)0).append(PROTO_EOC));
-                    m_port->flush();
-                    timeout = 0;
-                    QByteArray bytes;
-                    int count = readBytes(4,2000,bytes);
-                    if (count < 4)
-                    {
-                        //QLOG_ERROR() << "wrong bytes available:" << count;
-                        //bad = true;
-                        i-=4;
-                        m_port->waitForReadyRead(1000);
-                        while(m_port->bytesAvailable())
-                        {
-                            m_port->read(1)[0];
-                        }
-                        continue;
-                    }
-                    snbuf[i] = bytes[3];
-                    snbuf[i+1] = bytes[2];
-                    snbuf[i+2] = bytes[1];
-                    snbuf[i+3] = bytes[0];
-                    int sync = get_sync(2000);
-                    if (sync != 0)
-                    {
-                        //QLOG_ERROR() << "Bad sync";
-                        bad = true;
-                        break;
-                    }
-                    while(m_port->bytesAvailable())
-                    {
-                        m_port->read(1)[0];
-                    }
-
-                }
-                if (bad)
-                {
-                    continue;
-                }
-                QString SN = "";
-                for (int i=0;i<12;i++)
-                {
-                    //(otpbuf[i] <= 0xF ? "0" : "") + QString::number(otpbuf[i],16).toUpper() + " ";
-                    SN += (snbuf[i] <= 0xF ? "0" : "") + QString::number(snbuf[i],16).toUpper() + " ";
-                    //snstr += SN + "\n";
-                }
-
-                //QLOG_INFO() << "Board SN:" << SN;
-                snstr = SN;
-                QByteArray signature;
-                QString SIGarg = "";
-                for (int i=32;i<(128+32);i++)
-                {
-                    signature.append(otpbuf[i]);
-                    SIGarg += (otpbuf[i] <= 0xF ? "0" : "") + QString::number(otpbuf[i],16).toUpper();
-                }
-                QByteArray serial;
-                QString SNarg = "";
-                for (int i=0;i<12;i++)
-                {
-                    serial.append(snbuf[i]);
-                    SNarg += (snbuf[i] <= 0xF ? "0" : "") + QString::number(snbuf[i],16).toUpper();
-                }
-                for (int i=0;i<8;i++)
-                {
-                    serial.append((char)0);
-                    SNarg += "00";
-                }
-                serial[0] = serial[1];
-                qDebug() << "Serial size:" << serial.size();
-                emit statusUpdate("Verifying COA");
-
-#define CERT_OF_A_FAILED "Certificate of Authenticity check failed! Please check with your autopilot hardware supplier for support."
-#define CERT_OF_A_PUB_KEY_FAILED "Certificate of Authenticity failed COA check! Public Key is not valid."
-#if 0
-#ifdef Q_OS_WIN
-                QProcess *proc = new QProcess();
-                //QLOG_DEBUG() << "Attempting to start" << QApplication::instance()->applicationDirPath() + "/uploader/AP2OTPCheck.exe" << SNarg << SIGarg;
-                proc->start(QApplication::instance()->applicationDirPath() + "/uploader/AP2OTPCheck.exe",QStringList() << SNarg << SIGarg);
-                proc->waitForStarted();
-                proc->waitForFinished();
-                QString result = proc->readAll() + " " + proc->readAllStandardError() + " " + proc->readAllStandardOutput();
-                //QLOG_DEBUG() << "Proc finished with:" << result;
-                delete proc;
-                if (!result.contains("Valid Key"))
-                {
-                    //QLOG_WARN() << CERT_OF_A_FAILED;
-                    emit statusUpdate(CERT_OF_A_FAILED);
-                    emit warning(CERT_OF_A_FAILED);
-                }
-                else
-                {
-                    //QLOG_DEBUG() << "COA verification successful";
-                    emit statusUpdate("COA verification successful");
-                }
-#else
-                // [TODO] Need to read XML file of list of authorized keys.
-
-                // 3DR COA Public Key
-                QString test = "\r\nMIGfMA0GCSqGSIb3DQEBAQUAA4GNADCBiQKBgQDqi8E6EdZ11iE7nAc95bjdUTwd\r\n/gLetSAAx8X9jgjInz5j47DIcDqFVFKEFZWiAc3AxJE/fNrPQey16SfI0FyDAX/U\t\n4jyGIv9w+M1dKgUPI8UdpEMS2w1YnfzW0GO3PX0SBL6pctEIdXr0NGsFFaqU9Yz4\r\nDbgBdR6wBz9qdfRRoQIDAQAB";
-                QByteArray bytes = QByteArray::fromBase64(test.toLatin1());
-
-                BIO *bi = BIO_new(BIO_s_mem());
-                BIO_write(bi, bytes.data(), bytes.size());
-                EVP_PKEY *pkey = d2i_PUBKEY_bio(bi, NULL);
-                BIO_free(bi);
-                if(!pkey)
-                {
-                    //QLOG_FATAL() << CERT_OF_A_PUB_KEY_FAILED;
-                    emit statusUpdate(CERT_OF_A_PUB_KEY_FAILED);
-                    emit error(CERT_OF_A_PUB_KEY_FAILED);
-                    m_port->close();
-                    delete m_port;
-                    return;
-                }
-
-                int verify = RSA_verify(NID_sha1,(unsigned char*)serial.data(),serial.size(),(unsigned char*)signature.data(),signature.size(),pkey->pkey.rsa);
-                if (verify)
-                {
-                    //Failed!
-                    //QLOG_FATAL() << CERT_OF_A_FAILED;
-                    emit statusUpdate(CERT_OF_A_FAILED);
-                    emit error(CERT_OF_A_FAILED);
-                }
-                else
-                {
-                    //QLOG_DEBUG() << "COA verification successful";
-                    emit statusUpdate("COA verification successful");
-                }
-#endif //Q_OS_WIN
-#endif
-                //QLOG_INFO() << "COA Successful";
-                //emit statusUpdate("COA Verification successful!");
-                //qDebug() << "Sig size:" << signature.size();
-                //qDebug() << "First three of sig:" << QString::number(signature[0],16) << QString::number(signature[1],16) << QString::number(signature[2],16);
-                //qDebug() << "Last three of sig:" << QString::number(signature[125],16) << QString::number(signature[126],16) << QString::number(signature[127],16);
-                //qDebug() << "Serial size:" << serial.size();
-            } //if bootloaderrev >= 4
-            if (m_stop)
-            {
-                m_port->close();
-                delete m_port;
-                return;
-            }
-
-            emit boardRev(boardrev);
-            emit boardId(boardid);
-            emit bootloaderRev(bootloaderrev);
-            emit flashSize(flashsize);
-            emit serialNumber(snstr);
-            emit OTP(otpstr);
-
-            //Erase
-            //QLOG_INFO() << "Requesting erase";
-            emit statusUpdate("Erasing flash, this may take up to a minute");
-            m_port->write(QByteArray().append(0x23).append(0x20));
-            m_port->flush();
-            //msleep(20000);
-            sync = get_sync(60000);
-            if (sync)
-            {
-                //QLOG_DEBUG() << "never returned from erase.";
-                emit statusUpdate("Flash erase never completed, please restart autopilot board and retry.");
-                emit error("Flash erase never completed, please restart autopilot board and retry.");
-                m_port->close();
-                delete tempFile;
-                delete m_port;
-                return;
-            }
-            if (m_stop)
-            {
-                m_port->close();
-                delete tempFile;
-                delete m_port;
-                return;
-            }
-
-
-            {
-
-                //unsigned int fwsize = fwmap["image_size"].toUInt();
-                //Lorenz says that this is a more reliable way of parsing out the image, I agree.
-                //Clear out the m_port->
-                m_port->clear();
-                msleep(1000);
-
-                //QLOG_INFO() << "Starting flash process";
-                emit statusUpdate("Flashing firmware");
-                tempFile->open();
-                int counter = 0;
-                int failure = 0;
-                QByteArray writtenbuf = tempFile->readAll();
-                tempFile->seek(0);
-                while (!tempFile->atEnd())
-                {
-                    QByteArray buf = tempFile->read(60);
-                    if (buf.size() > 0)
-                    {
-                        QByteArray tosend;
-                        tosend.append(0x27);
-                        tosend.append(buf.size());
-                        tosend.append(buf);
-                        tosend.append(0x20);
-                        m_port->clear();
-                        m_port->write(tosend);
-                        m_port->waitForBytesWritten(-1);
-                        m_port->flush();
-                        //msleep(1000);
-                        int sync = get_sync(1000);
-                        if (sync != 0)
-                        {
-                            failure++;
-                            if (failure > 2)
-                            {
-                                //QLOG_FATAL() << "error writing firmware" << tempFile->pos() << tempFile->size();
-                                emit error("Error writing firmware, invalid sync. Please retry");
-                                m_port->close();
-                                tempFile->close();
-                                delete tempFile;
-                                return;
-                            }
-                            msleep(1000);
-                            //QLOG_INFO() << "Requesting erase";
-                            emit statusUpdate("Erasing flash, this may take up to a minute");
-                            m_port->clear();
-                            m_port->write(QByteArray().append(0x23).append(0x20));
-                            m_port->flush();
-                            //msleep(20000);
-                            sync = get_sync(60000);
-                            if (sync)
-                            {
-                                //QLOG_DEBUG() << "never returned from erase.";
-                                emit statusUpdate("Flash erase never completed, please restart autopilot board and retry.");
-                                emit error("Flash erase never completed, please restart autopilot board and retry.");
-                                m_port->close();
-                                tempFile->close();
-                                delete tempFile;
-                                delete m_port;
-                                return;
-                            }
-                            tempFile->seek(0);
-                            continue;
-                        }
-                        if (counter++ % 50 == 0)
-                        {
-                            emit flashProgress(tempFile->pos(),tempFile->size());
-                            //QLOG_INFO() << "flashing:" << tempFile->pos() << "/" << tempFile->size();
-                        }
-                        if (m_stop)
-                        {
-                            m_port->close();
-                            tempFile->close();
-                            delete tempFile;
-                            delete m_port;
-                            return;
-                        }
-
-                    }
-                    else
-                    {
-                        //QLOG_ERROR() << "Something went wrong, couldn't read from tmp file";
-                        m_port->close();
-                        tempFile->close();
-                        delete tempFile;
-                        delete m_port;
-                        return;
-                    }
-                }
-                //QLOG_DEBUG() << "Done";
-                emit statusUpdate("Flashing complete, verifying");
-                m_port->clear();
-
-                m_port->write(QByteArray().append(0x29).append(0x20));
-                m_port->waitForBytesWritten(-1);
-                m_port->flush();
-
-
-
-                QByteArray infobuf;
-                int read = readBytes(4,5000,infobuf);
-                if (read != 4)
-                {
-                    //QLOG_ERROR() << "Tried to read 4, only read:" << read;
-                }
-                int sync = get_sync(2000);
-                if (sync != 0)
-                {
-                    return;
-                }
-
-                //infobuf has our expected CRC, calculate it ourselves.
-                //writtenbuf contains the data to CRC verify.
-                int oldsize = writtenbuf.size();
-                for (int i=oldsize;i<flashsize;i++)
-                {
-                    writtenbuf.append(0xFF);
-                }
-                quint32 remotecrc = crc32(writtenbuf);
-                quint32 localcrc = 0;
-                localcrc += static_cast<unsigned char>(infobuf[0]);
-                localcrc += static_cast<unsigned char>(infobuf[1]) << 8;
-                localcrc += static_cast<unsigned char>(infobuf[2]) << 16;
-                localcrc += static_cast<unsigned char>(infobuf[3]) << 24;
-                //QLOG_DEBUG() << "Remote CRC:" << QString::number(remotecrc,16).toUpper();
-                //QLOG_DEBUG() << "Local CRC:" << QString::number(localcrc,16).toUpper();
-                if (remotecrc != localcrc)
-                {
-                    emit error("CRC mismatch! Firmware write failed, please try again");
-                    emit statusUpdate("CRC mismatch! Firmware write failed, please try again");
-                    m_port->close();
-                    tempFile->close();
-                    delete tempFile;
-                    delete m_port;
-                    return;
-                }
-
-                m_port->write(QByteArray().append(0x30).append(0x20));
-                m_port->flush();
-                m_port->waitForBytesWritten(1000);
-                m_port->close();
-                tempFile->close();
-                emit statusUpdate("Verification successful, rebooting...");
-                delete tempFile;
-                delete m_port;
-                emit done();
-                return;
-            }
-            m_port->close();
-        }
-        else
-        {
-            msleep(500);
-            continue;
-        }
+        fail("CRC mismatch! Firmware write failed, please try again");
+        return;
     }
-    //QLOG_DEBUG() << "Retry timeout";
-    m_port->close();
-    delete m_port;
-    emit statusUpdate("Unable to flash board, 5 retries attempted. Please check hardware and try again");
-    emit error("Unable to flash board, 5 retries attempted. Please check hardware and try again");
 
+    trace("boot");
+    m_link->send(QByteArray().append(PROTO_BOOT).append(PROTO_EOC));
+    whenWritten(1000, &F4BYFirmwareUploader::stepRebooted);
+}
+
+void F4BYFirmwareUploader::stepRebooted()
+{
+    m_link->close();
+    emit statusUpdate("Verification successful, rebooting...");
+    emit done();
+    finish();
 }
-int F4BYFirmwareUploader::get_sync(int timeout)
+
+bool F4BYFirmwareUploader::loadFile(QString file)
 {
-    QByteArray infobuf;
-    int read = readBytes(2,timeout,infobuf);
-    if (read != 2)
+    Px4Image px4;
+    if (!px4.load(file))
     {
-        //QLOG_ERROR() << "Wrong number of bytes read on sync:" << read;
-        return -1;
+        //QLOG_ERROR() << px4.errorString();
+        emit statusUpdate(px4.errorString());
+        return false;
     }
-    else
+    m_loadedBoardID = px4.boardId();
+    m_loadedFwSize = px4.imageSize();
+    m_loadedDescription = px4.description();
+    m_image = px4.image();
+
+    if (!m_running)
     {
-        if (infobuf[0] != (char)0x12  || infobuf[1] != (char)0x10)
-        {
-            //QLOG_ERROR() << "Bad sync return:" << QString::number(infobuf[0],16) << QString::number(infobuf[1],16);
-            return -1;
-        }
-        return 0;
+        start();
+        return true;
+    }
+    //prepare() is still busy with the board or already waits after the erase
+    if (m_waitingForImage)
+    {
+        m_waitingForImage = false;
+        settle(1000, &F4BYFirmwareUploader::stepProgramStart);
     }
+    return true;
+}
+
+bool F4BYFirmwareUploader::prepare()
+{
+    if (m_running)
+        return false;
+    m_image.clear();
+    start();
+    return true;
+}
+
+void F4BYFirmwareUploader::start()
+{
+    m_stop = false;
+    m_running = true;
+    m_waitingForImage = false;
+    delay(0, &F4BYFirmwareUploader::stepDiscover);
 }
@@ -1,39 +1,155 @@
 #ifndef F4BYFIRMWAREUPLOADER_H
 #define F4BYFIRMWAREUPLOADER_H
 
-#include <QThread>
-#include <qserialport.h>
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
 #include <QFile>
-#include <QTemporaryFile>
 #include <QDebug>
 //#include <qjson/parser.h>
 #include <QStringList>
-class F4BYFirmwareUploader : public QThread
+#include <QSerialPortInfo>
+
+#include "seriallink.h"
+
+class SessionTracer;
+
+/**
+ * PX4 bootloader protocol as a non blocking state machine. Every step
+ * sends one command through SerialLink and continues in the matching
+ * reply handler, so any number of uploaders can share one event loop.
+ * finished() is emitted exactly once per loadFile(), done() only after a
+ * verified flash.
+ * prepare() starts without firmware: the board is rebooted, synced, read
+ * out and erased while the firmware is still being downloaded, and waits
+ * in the bootloader until loadFile() hands over the image. Programming
+ * starts as soon as both sides are ready.
+ * With a SessionTracer every step is a span on its device lane, the
+ * program span carries the round trip times of the PROG_MULTI frames.
+ */
+class F4BYFirmwareUploader : public QObject
 {
     Q_OBJECT
 public:
+    /**
+     * ConservativeHandshake keeps the historic fixed sleeps between the
+     * setup commands. FastHandshake waits for the line to go quiet instead
+     * and syncs with a short, exponentially growing timeout.
+     */
+    enum HandshakeProfile { ConservativeHandshake, FastHandshake };
+
     explicit F4BYFirmwareUploader(QObject *parent = 0);
+    ~F4BYFirmwareUploader();
+    bool prepare();
     bool loadFile(QString file);
+    void setPortName(const QString &portName);
+    void setProgWindow(int window);
+    void setHandshakeProfile(HandshakeProfile profile);
+    void setTracer(SessionTracer *tracer);
     void stop();
-protected:
-    void run();
+    bool isRunning() const;
 private:
+    typedef void (F4BYFirmwareUploader::*Step)();
+    typedef void (F4BYFirmwareUploader::*ReplyHandler)(bool ok, const QByteArray &reply);
+    enum WaitMode { WaitNone, WaitPlug, WaitReenumeration };
+
     bool m_stop;
-    QSerialPort *m_port;
-    QByteArray m_serialBuffer;
-    int get_sync(int timeout=1000);
-    bool reqInfo(unsigned char infobyte,unsigned int *reply);
-    int readBytes(int num,int timeout,QByteArray &buf);
-    bool rebootBoard(const QString& portName);
+    bool m_running;
+    bool m_waitingForImage;
+    QString m_portName;
+    QString m_portToUse;
+    QString m_portSerial;
+    WaitMode m_waitMode;
+    int m_progWindow;
+    HandshakeProfile m_handshake;
+    SerialLink *m_link;
+    QTimer *m_delayTimer;
+    Step m_delayStep;
+    Step m_writtenStep;
+    Step m_quietStep;
+    ReplyHandler m_replyHandler;
+    int m_replyBytes;
+
+    int m_syncTries;
+    int m_infoIndex;
+    int m_bootloaderRev;
+    int m_boardId;
+    int m_boardRev;
+    int m_flashSize;
+    unsigned char m_otpBuf[512];
+    int m_otpIndex;
+    unsigned char m_snBuf[12];
+    int m_snIndex;
+    QString m_otpString;
+    QString m_snString;
+
+    QByteArray m_image;
+    QList<int> m_inflight;
+    QList<qint64> m_inflightSent;
+    QVector<qint64> m_frameRtt;
+    QElapsedTimer m_rttTimer;
+    int m_window;
+    int m_sent;
+    int m_acked;
+    quint32 m_crc;
+    int m_crcDone;
+    int m_failure;
+    int m_progressCounter;
+
+    SessionTracer *m_tracer;
+
     unsigned int m_loadedBoardID;
     unsigned int m_loadedFwSize;
     QString m_loadedDescription;
-    QTemporaryFile *tempFile;
-    QTemporaryFile *tempJsonFile;
+
+    void transact(const QByteArray &command, int replyBytes, int timeout, ReplyHandler handler);
+    void delay(int ms, Step step);
+    void whenWritten(int timeout, Step step);
+    void settle(int ms, Step step);
+    void fail(const QString &message);
+    bool checkImage();
+    void start();
+    void finish();
+    void waitForDevice();
+    void trace(const QString &phase);
+    void traceCount(const QString &key);
+
+    void stepDiscover();
+    void stepReboot();
+    void stepRebootSent();
+    void stepOpen();
+    void stepSync();
+    void syncReply(bool ok, const QByteArray &reply);
+    void stepInfo();
+    void infoReply(bool ok, const QByteArray &reply);
+    void stepOtpStart();
+    void stepOtp();
+    void otpReply(bool ok, const QByteArray &reply);
+    void stepSn();
+    void snReply(bool ok, const QByteArray &reply);
+    void stepBoardInfo();
+    void stepErase();
+    void eraseReply(bool ok, const QByteArray &reply);
+    void stepProgramStart();
+    void programFill();
+    void programReply(bool ok, const QByteArray &reply);
+    void stepCrc();
+    void crcReply(bool ok, const QByteArray &reply);
+    void stepRebooted();
+private slots:
+    void linkReady();
+    void linkTimeout();
+    void linkWritten();
+    void linkQuiet();
+    void delayElapsed();
+    void portAdded(QSerialPortInfo info);
+    void portRemoved(QSerialPortInfo info);
 signals:
     void requestDevicePlug();
     void devicePlugDetected();
     void done();
+    void finished();
     void serialNumber(QString sn);
     void OTP(QString otp);
     void boardRev(int rev);
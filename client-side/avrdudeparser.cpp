@@ -0,0 +1,130 @@
+#include "avrdudeparser.h"
+
+//Longer lines are cut, nothing of interest is that long
+#define AVRDUDE_LINE_MAX 256
+//avrdude draws 50 '#' per bar
+#define AVRDUDE_BAR_LENGTH 50
+
+AvrdudeParser::AvrdudeParser(int logCapacity, QObject *parent) :
+    QObject(parent),
+    m_log(logCapacity),
+    m_logCapacity(logCapacity)
+{
+    reset(QByteArray());
+}
+
+void AvrdudeParser::reset(const QByteArray &commandLine)
+{
+    m_commandLine = commandLine;
+    m_log.clear();
+    m_dropped = 0;
+    m_line.clear();
+    m_phase = Init;
+    m_written = false;
+    m_inBar = false;
+    m_hashes = 0;
+    m_lastError.clear();
+}
+
+QByteArray AvrdudeParser::log() const
+{
+    QByteArray log = m_commandLine + "\n";
+    if (m_dropped > 0)
+        log += "[... " + QByteArray::number(m_dropped) + " bytes of output dropped ...]\n";
+    QByteArray tail(m_log.size(), 0);
+    m_log.peek(tail.data(), tail.size());
+    return log + tail;
+}
+
+void AvrdudeParser::appendLog(const QByteArray &chunk)
+{
+    const char *data = chunk.constData();
+    int len = chunk.size();
+    if (len > m_logCapacity)
+    {
+        m_dropped += len - m_logCapacity;
+        data += len - m_logCapacity;
+        len = m_logCapacity;
+    }
+    m_log.append(data, len);
+    int overflow = m_log.size() - m_logCapacity;
+    if (overflow > 0)
+    {
+        m_log.skip(overflow);
+        m_dropped += overflow;
+    }
+}
+
+void AvrdudeParser::feed(const QByteArray &chunk)
+{
+    appendLog(chunk);
+
+    for (int i = 0; i < chunk.size(); i++)
+    {
+        char c = chunk[i];
+        if (m_inBar)
+        {
+            if (c == '#')
+            {
+                m_hashes++;
+                if (m_phase != Init)
+                    emit progress(m_phase, qMin(100, m_hashes * 100 / AVRDUDE_BAR_LENGTH));
+                continue;
+            }
+            if (c == '|')
+            {
+                m_inBar = false;
+                continue;
+            }
+        }
+        if (c == '\n' || c == '\r')
+        {
+            lineComplete();
+            continue;
+        }
+        if (m_line.size() >= AVRDUDE_LINE_MAX)
+            continue;
+        m_line.append(c);
+
+        //"Writing | " or "Reading | " starts a bar on the same line
+        if (c == '|' && !m_inBar && m_line.size() <= 10)
+        {
+            if (m_line.startsWith("Writing"))
+            {
+                m_phase = Write;
+                m_inBar = true;
+                m_hashes = 0;
+            }
+            else if (m_line.startsWith("Reading"))
+            {
+                //Reading before anything was written is the signature check
+                m_phase = m_written ? Verify : Init;
+                m_inBar = true;
+                m_hashes = 0;
+            }
+        }
+    }
+}
+
+void AvrdudeParser::lineComplete()
+{
+    m_inBar = false;
+    if (m_line.isEmpty())
+        return;
+
+    if (m_line.contains("AVR device initialized and ready to accept instructions"))
+    {
+        emit initialized();
+    }
+    else if (m_line.contains("bytes of flash written"))
+    {
+        m_written = true;
+    }
+    else if (m_line.contains("error") || m_line.contains("can't") || m_line.contains("timeout")
+             || m_line.contains("not in sync") || m_line.contains("mismatch"))
+    {
+        m_lastError = QString::fromLocal8Bit(m_line).trimmed();
+        emit errorLine(m_lastError);
+    }
+    m_line.clear();
+}
@@ -0,0 +1,51 @@
+#ifndef AVRDUDEPARSER_H
+#define AVRDUDEPARSER_H
+
+#include <QObject>
+#include <QByteArray>
+
+#include "ringbuffer.h"
+
+/**
+ * Turns avrdude's output into progress events while it arrives. Every
+ * chunk is looked at once; the only state is the current line (capped),
+ * the phase and the number of '#' in the current progress bar, so long
+ * -v or verify runs cost the same per byte as short ones. The raw output
+ * is kept in a ring of logCapacity bytes for error.txt.
+ */
+class AvrdudeParser : public QObject
+{
+    Q_OBJECT
+public:
+    enum Phase { Init, Write, Verify };
+
+    explicit AvrdudeParser(int logCapacity = 65536, QObject *parent = 0);
+
+    void reset(const QByteArray &commandLine);
+    void feed(const QByteArray &chunk);
+
+    QString lastError() const { return m_lastError; }
+    QByteArray log() const;
+
+signals:
+    void initialized();
+    void progress(int phase, int percent);
+    void errorLine(QString line);
+
+private:
+    QByteArray m_commandLine;
+    ByteRingBuffer m_log;
+    int m_logCapacity;
+    qint64 m_dropped;
+    QByteArray m_line;
+    Phase m_phase;
+    bool m_written;
+    bool m_inBar;
+    int m_hashes;
+    QString m_lastError;
+
+    void appendLog(const QByteArray &chunk);
+    void lineComplete();
+};
+
+#endif // AVRDUDEPARSER_H
@@ -0,0 +1,169 @@
+#include "avrdudeuploader.h"
+#include "sessiontracer.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QStringList>
+
+AvrdudeUploader::AvrdudeUploader(QObject *parent) :
+    QObject(parent),
+    m_process(0),
+    m_phase(AvrdudeParser::Init),
+    m_stop(false),
+    m_tracer(0)
+{
+    m_parser = new AvrdudeParser(65536, this);
+    connect(m_parser, SIGNAL(progress(int,int)), this, SLOT(parserProgress(int,int)));
+}
+
+void AvrdudeUploader::setPortName(const QString &portName)
+{
+    m_portName = portName;
+}
+
+void AvrdudeUploader::setTracer(SessionTracer *tracer)
+{
+    m_tracer = tracer;
+}
+
+void AvrdudeUploader::traceEnd(const QString &error)
+{
+    if (!m_tracer)
+        return;
+    if (!error.isEmpty())
+        m_tracer->setArg(SessionTracer::DeviceLane, "error", error);
+    m_tracer->end(SessionTracer::DeviceLane);
+}
+
+bool AvrdudeUploader::isRunning() const
+{
+    return m_process != 0;
+}
+
+bool AvrdudeUploader::loadFile(QString file)
+{
+    QString program = qApp->applicationDirPath() + "/external/avrdude.exe";
+    QStringList arguments;
+    arguments << "-C" + qApp->applicationDirPath() + "/external/avrdude.conf";
+    arguments << "-patmega2560";
+    arguments << "-cwiring";
+    arguments << "-P" + m_portName;
+    arguments << "-b115200";
+    arguments << "-D";
+    arguments << "-Uflash:w:" + file + ":i";
+
+    m_stop = false;
+    m_processError.clear();
+    m_phase = AvrdudeParser::Init;
+    m_parser->reset((">" + program + " " + arguments.join(" ")).toLocal8Bit());
+    m_process = new QProcess(this);
+
+    connect(m_process,SIGNAL(readyReadStandardOutput()),this, SLOT(readStandardOutput()));
+    connect(m_process,SIGNAL(readyReadStandardError()),this, SLOT(readStandardError()));
+    connect(m_process,SIGNAL(finished(int)),this, SLOT(processFinished(int)));
+    connect(m_process,SIGNAL(error(QProcess::ProcessError)),this, SLOT(processError(QProcess::ProcessError)));
+
+    emit statusUpdate(tr("Starting flashing process..."));
+    if (m_tracer)
+        m_tracer->begin(SessionTracer::DeviceLane, "avrdude sync");
+    m_process->start(program, arguments);
+    return true;
+}
+
+void AvrdudeUploader::stop()
+{
+    if (!m_process)
+        return;
+    m_stop = true;
+    m_process->kill();
+}
+
+void AvrdudeUploader::parserProgress(int phase, int percent)
+{
+    if (phase != m_phase) {
+        m_phase = phase;
+        if (phase == AvrdudeParser::Write) {
+            emit statusUpdate(tr("Writing firmware please wait..."));
+        } else {
+            emit statusUpdate(tr("Verifying firmware please wait..."));
+        }
+        if (m_tracer)
+            m_tracer->begin(SessionTracer::DeviceLane, phase == AvrdudeParser::Write ? "write" : "verify");
+    }
+    emit flashProgress(percent, 100);
+}
+
+void AvrdudeUploader::processError(QProcess::ProcessError processError)
+{
+    QString errorMsg;
+
+    switch (processError) {
+    case QProcess::FailedToStart:
+        errorMsg = tr("Failed to start avrdude. (executable missing?)");
+        break;
+    case QProcess::Crashed:
+        errorMsg = tr("avrdude crashed somehow.");
+        break;
+    case QProcess::Timedout:
+    case QProcess::ReadError:
+    case QProcess::WriteError:
+    case QProcess::UnknownError:
+    default:
+        errorMsg = tr("Some internal error occured. Errorcode: %1").arg(processError);
+        break;
+    }
+
+    //Everything but a failed start ends up in processFinished() as well
+    if (processError != QProcess::FailedToStart) {
+        m_processError = errorMsg;
+        return;
+    }
+    m_process->deleteLater();
+    m_process = 0;
+    traceEnd(errorMsg);
+    emit error(errorMsg);
+    emit finished();
+}
+
+void AvrdudeUploader::processFinished(int exitCode)
+{
+    QProcess::ExitStatus exitStatus = m_process->exitStatus();
+    m_process->deleteLater();
+    m_process = 0;
+
+    if (m_stop) {
+        traceEnd();
+        emit finished();
+        return;
+    }
+
+    if (exitCode == 0 && exitStatus == QProcess::NormalExit) {
+        traceEnd();
+        emit done();
+    } else if (!m_processError.isEmpty()) {
+        traceEnd(m_processError);
+        emit error(m_processError);
+    } else {
+        QString errorFilename = qApp->applicationDirPath() + "/error.txt";
+        QFile errorFile(errorFilename);
+        errorFile.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        errorFile.write(m_parser->log());
+        errorFile.close();
+        QString message = tr("Flashing failed, please consulte the error.txt file located here: %1").arg(errorFilename);
+        if (!m_parser->lastError().isEmpty())
+            message = m_parser->lastError() + "\n\n" + message;
+        traceEnd(message);
+        emit error(message);
+    }
+    emit finished();
+}
+
+void AvrdudeUploader::readStandardOutput()
+{
+    m_parser->feed(m_process->readAllStandardOutput());
+}
+
+void AvrdudeUploader::readStandardError()
+{
+    m_parser->feed(m_process->readAllStandardError());
+}
@@ -0,0 +1,54 @@
+#ifndef AVRDUDEUPLOADER_H
+#define AVRDUDEUPLOADER_H
+
+#include <QObject>
+#include <QProcess>
+
+#include "avrdudeparser.h"
+
+class SessionTracer;
+
+/**
+ * Flashes an Intel HEX file to an ATmega2560 wiring bootloader by running
+ * the bundled avrdude. Signals mirror the ones of F4BYFirmwareUploader.
+ * A SessionTracer only sees the phases avrdude prints: everything up to
+ * the first progress bar, writing and reading back.
+ */
+class AvrdudeUploader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AvrdudeUploader(QObject *parent = 0);
+    void setPortName(const QString &portName);
+    void setTracer(SessionTracer *tracer);
+    bool loadFile(QString file);
+    void stop();
+    bool isRunning() const;
+
+private slots:
+    void readStandardOutput();
+    void readStandardError();
+    void processFinished(int exitCode);
+    void processError(QProcess::ProcessError processError);
+    void parserProgress(int phase, int percent);
+
+private:
+    QProcess *m_process;
+    QString m_portName;
+    AvrdudeParser *m_parser;
+    int m_phase;
+    QString m_processError;
+    bool m_stop;
+    SessionTracer *m_tracer;
+
+    void traceEnd(const QString &error = QString());
+
+signals:
+    void done();
+    void finished();
+    void flashProgress(qint64 current,qint64 total);
+    void error(QString error);
+    void statusUpdate(QString status);
+};
+
+#endif // AVRDUDEUPLOADER_H
@@ -0,0 +1,212 @@
+/*
+ * The AVR flashing path against Stk500Emulator, an ATmega2560 wiring
+ * bootloader on a pseudo-terminal paced at 115200 baud: wall time per
+ * phase, write throughput, what the verify costs and how well the
+ * progress events follow. Round 1 starts from an erased chip, every
+ * further round changes --change pages of the firmware first, which is
+ * where the differential mode of Stk500v2Uploader shows. Linux only.
+ *
+ *    qmake avrflashbench.pro && make && ./avrflashbench --size 200
+ *
+ * --avrdude runs the bundled avrdude instead (external/avrdude.exe and
+ * avrdude.conf next to this binary, a link to a native avrdude works).
+ * --serve only starts the emulator and prints its port.
+ */
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <string.h>
+
+#include "avrdudeuploader.h"
+#include "stk500v2uploader.h"
+#include "intelhex.h"
+#include "flashbenchrunner.h"
+#include "stk500emulator.h"
+
+static QByteArray hexRecord(int type, unsigned int address, const char *data, int length)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    QByteArray bytes;
+    bytes.append((char)length);
+    bytes.append((char)((address >> 8) & 0xFF));
+    bytes.append((char)(address & 0xFF));
+    bytes.append((char)type);
+    bytes.append(data, length);
+    unsigned char checksum = 0;
+    QByteArray line(":");
+    for (int i = 0; i < bytes.size(); i++)
+    {
+        unsigned char c = bytes[i];
+        checksum += c;
+        line.append(digits[c >> 4]).append(digits[c & 0x0F]);
+    }
+    checksum = -checksum;
+    line.append(digits[checksum >> 4]).append(digits[checksum & 0x0F]).append('\n');
+    return line;
+}
+
+static bool writeHex(QTemporaryFile &hex, const QByteArray &firmware)
+{
+    //16 bytes per record and a linear address record every 64 KiB, like avr-objcopy
+    QByteArray text;
+    for (int address = 0; address < firmware.size(); address += 16)
+    {
+        if (address % 0x10000 == 0)
+        {
+            char upper[2] = { (char)((address >> 24) & 0xFF), (char)((address >> 16) & 0xFF) };
+            text.append(hexRecord(0x04, 0, upper, 2));
+        }
+        text.append(hexRecord(0x00, address & 0xFFFF, firmware.constData() + address, qMin(16, firmware.size() - address)));
+    }
+    text.append(hexRecord(0x01, 0, 0, 0));
+
+    //A fresh name every round, nothing may come from a stale .bin
+    hex.setFileTemplate(QDir::tempPath() + "/avrflashbench-XXXXXX.hex");
+    if (!hex.open())
+        return false;
+    hex.write(text);
+    hex.close();
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption sizeOption("size", "Firmware size.", "KiB", "200");
+    QCommandLineOption roundsOption("rounds", "Flash sessions to run.", "count", "2");
+    QCommandLineOption changeOption("change", "Pages changed before every round after the first.", "pages", "4");
+    QCommandLineOption baudOption("baud", "Emulated line speed, 0 for none.", "baud", "115200");
+    QCommandLineOption pageWriteOption("page-write", "Emulated page write time.", "us", "4500");
+    QCommandLineOption fullOption("full-flash", "Write and verify every page (Stk500v2Uploader).");
+    QCommandLineOption avrdudeOption("avrdude", "Flash with the external avrdude.");
+    QCommandLineOption serveOption("serve", "Only run the emulator until killed.");
+    parser.addOption(sizeOption);
+    parser.addOption(roundsOption);
+    parser.addOption(changeOption);
+    parser.addOption(baudOption);
+    parser.addOption(pageWriteOption);
+    parser.addOption(fullOption);
+    parser.addOption(avrdudeOption);
+    parser.addOption(serveOption);
+    parser.process(app);
+
+    Stk500EmulatorConfig config;
+    config.baudRate = parser.value(baudOption).toInt();
+    config.pageWriteUs = parser.value(pageWriteOption).toInt();
+    Stk500Emulator emulator(config);
+    if (!emulator.open())
+    {
+        out << "cannot create pty: " << QString::fromStdString(emulator.errorString()) << endl;
+        return 1;
+    }
+    QString port = QString::fromStdString(emulator.slaveName());
+    if (parser.isSet(serveOption))
+    {
+        out << "STK500v2 wiring bootloader emulator on " << port << endl;
+        return app.exec();
+    }
+
+    //Code like data: compressible, but not trivially
+    int imageSize = parser.value(sizeOption).toInt() * 1024;
+    QByteArray firmware(imageSize, 0);
+    quint32 seed = 1;
+    for (int i = 0; i < imageSize; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        firmware[i] = (seed >> 16) & 0x0F;
+    }
+    bool useAvrdude = parser.isSet(avrdudeOption);
+    out << "image " << imageSize << " bytes on " << port << " at " << config.baudRate << " baud, "
+        << (useAvrdude ? "avrdude" : parser.isSet(fullOption) ? "Stk500v2Uploader full" : "Stk500v2Uploader differential")
+        << endl;
+
+    int rounds = qMax(1, parser.value(roundsOption).toInt());
+    int pages = imageSize / 256;
+    int failures = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        if (round > 0)
+        {
+            //Spread over the image, like a changed parameter table and code
+            for (int i = 0; i < parser.value(changeOption).toInt() && pages > 0; i++)
+            {
+                int page = (i * 7919 + round * 104729) % pages;
+                firmware[page * 256 + round % 256] = firmware[page * 256 + round % 256] ^ 0x80;
+            }
+        }
+        QTemporaryFile hex;
+        if (!writeHex(hex, firmware))
+            return 1;
+
+        Stk500EmulatorStats before = emulator.stats();
+        FlashBenchRunner runner;
+        QObject *uploader = 0;
+        bool loaded = false;
+        if (useAvrdude)
+        {
+            AvrdudeUploader *avrdude = new AvrdudeUploader();
+            avrdude->setPortName(port);
+            uploader = avrdude;
+            runner.watch(uploader);
+            runner.start();
+            loaded = avrdude->loadFile(hex.fileName());
+        }
+        else
+        {
+            Stk500v2Uploader *native = new Stk500v2Uploader();
+            native->setPortName(port);
+            native->setDifferential(!parser.isSet(fullOption));
+            uploader = native;
+            runner.watch(uploader);
+            runner.start();
+            loaded = native->loadFile(hex.fileName());
+        }
+        bool ok = loaded && runner.wait(600000);
+        delete uploader;
+        QFile::remove(IntelHex::binaryPath(hex.fileName()));
+        Stk500EmulatorStats after = emulator.stats();
+
+        out << endl << "round " << round + 1 << (ok ? " ok" : " FAILED") << endl;
+        QList<FlashBenchPhase> phases = runner.phases();
+        FlashBenchRunner::print(phases, imageSize);
+        qint64 writeMs = 0;
+        qint64 verifyMs = 0;
+        foreach (const FlashBenchPhase &phase, phases)
+        {
+            if (phase.status.startsWith("Writing"))
+                writeMs += phase.durationMs;
+            if (phase.status.startsWith("Verifying"))
+                verifyMs += phase.durationMs;
+        }
+        qint64 written = after.bytesWritten - before.bytesWritten;
+        qint64 read = after.bytesRead - before.bytesRead;
+        out << "written " << written << " bytes (" << (writeMs > 0 ? written * 1000 / writeMs : 0) << " bytes/s), read "
+            << read << " bytes, verify " << verifyMs << " ms ("
+            << (runner.elapsed() > 0 ? verifyMs * 100 / runner.elapsed() : 0) << "% of the session)" << endl;
+        out << "line " << after.lineBytesIn - before.lineBytesIn << " bytes in, "
+            << after.lineBytesOut - before.lineBytesOut << " bytes out, "
+            << after.loadAddresses - before.loadAddresses << " address loads, "
+            << after.checksumErrors - before.checksumErrors << " checksum errors" << endl;
+        out << "progress " << runner.progressEvents() << " events, longest gap " << runner.progressMaxGap() << " ms, "
+            << (runner.progressMonotonic() ? "monotonic" : "NOT MONOTONIC") << ", "
+            << (runner.progressComplete() ? "reaches 100%" : "DOES NOT REACH 100%") << endl;
+        foreach (const QString &error, runner.errors())
+            out << "error: " << error << endl;
+
+        std::vector<unsigned char> flash = emulator.flash();
+        if (ok && memcmp(flash.data(), firmware.constData(), imageSize) != 0)
+        {
+            out << "FLASH CONTENT DIFFERS" << endl;
+            ok = false;
+        }
+        if (!ok)
+            failures++;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+QT = core serialport
+
+TARGET = avrflashbench
+
+LIBS += -lpthread
+
+#Uploaders, SessionTracer and FLASHTOOL_VERSION as the tool builds them
+include(../flashcore.pri)
+
+SOURCES += \
+    avrflashbench.cpp \
+    flashbenchrunner.cpp \
+    ptydevice.cpp \
+    stk500emulator.cpp
+
+HEADERS += \
+    flashbenchrunner.h \
+    ptydevice.h \
+    stk500emulator.h
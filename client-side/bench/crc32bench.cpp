@@ -0,0 +1,76 @@
+/*
+ * Throughput of the CRC32 kernels against the old byte at a time table
+ * loop, plus the cost of the 0xFF padding up to the flash size, once
+ * materialised like the uploader used to and once with crc32Fill().
+ *
+ *    qmake crc32bench.pro && make && ./crc32bench [image KiB] [flash KiB]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "crc32.h"
+
+typedef uint32_t (*Kernel)(uint32_t crc, const void *data, size_t len);
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void run(const char *name, Kernel kernel, const std::vector<unsigned char> &data, uint32_t expected)
+{
+    const int rounds = 20;
+    uint32_t crc = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        crc = kernel(0, &data[0], data.size());
+    double elapsed = seconds(start);
+    printf("%-10s %9.1f MB/s  %08x %s\n", name, rounds * data.size() / elapsed / 1e6,
+           crc, crc == expected ? "ok" : "MISMATCH");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t imageSize = (argc > 1 ? atoi(argv[1]) : 1536) * 1024;
+    size_t flashSize = (argc > 2 ? atoi(argv[2]) : 2048) * 1024;
+
+    std::vector<unsigned char> image(imageSize);
+    srand(1);
+    for (size_t i = 0; i < image.size(); i++)
+        image[i] = rand() & 0xff;
+
+    uint32_t expected = crc32Bytewise(0, &image[0], image.size());
+    printf("image %u KiB, selected kernel %s\n", (unsigned)(imageSize / 1024), crc32KernelName());
+    run("bytewise", crc32Bytewise, image, expected);
+    run("slice8", crc32Slice8, image, expected);
+    if (crc32HasHardware())
+        run("hardware", crc32Hardware, image, expected);
+
+    //Per PROG_MULTI frame, as the uploader feeds it
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint32_t crc = 0;
+    for (size_t sent = 0; sent < image.size(); sent += 240)
+        crc = crc32Update(crc, &image[sent], image.size() - sent < 240 ? image.size() - sent : 240);
+    printf("%-10s %9.1f MB/s  %08x %s\n", "frames", image.size() / seconds(start) / 1e6,
+           crc, crc == expected ? "ok" : "MISMATCH");
+
+    if (flashSize <= imageSize)
+        return 0;
+
+    start = std::chrono::steady_clock::now();
+    std::vector<unsigned char> written(image);
+    written.resize(flashSize, 0xFF);
+    uint32_t padded = crc32Bytewise(0, &written[0], written.size());
+    double materialised = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    uint32_t analytic = crc32Fill(expected, 0xFF, flashSize - imageSize);
+    double fill = seconds(start);
+
+    printf("padding to %u KiB: materialised %.3f ms, crc32Fill %.4f ms  %s\n",
+           (unsigned)(flashSize / 1024), materialised * 1e3, fill * 1e3,
+           padded == analytic ? "ok" : "MISMATCH");
+    return 0;
+}
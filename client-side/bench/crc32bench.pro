@@ -0,0 +1,14 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+TARGET = crc32bench
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    crc32bench.cpp \
+    ../crc32.cpp
+
+HEADERS += \
+    ../crc32.h
@@ -0,0 +1,116 @@
+#include "flashbenchrunner.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+
+FlashBenchRunner::FlashBenchRunner(QObject *parent) :
+    QObject(parent),
+    m_done(false),
+    m_finished(false),
+    m_totalMs(0),
+    m_progressEvents(0),
+    m_progressMonotonic(true),
+    m_lastProgress(0),
+    m_lastTotal(0),
+    m_lastProgressMs(-1),
+    m_progressMaxGap(0)
+{
+}
+
+void FlashBenchRunner::watch(QObject *uploader)
+{
+    connect(uploader, SIGNAL(statusUpdate(QString)), this, SLOT(status(QString)));
+    connect(uploader, SIGNAL(flashProgress(qint64,qint64)), this, SLOT(progress(qint64,qint64)));
+    connect(uploader, SIGNAL(error(QString)), this, SLOT(error(QString)));
+    connect(uploader, SIGNAL(done()), this, SLOT(done()));
+    connect(uploader, SIGNAL(finished()), this, SLOT(finished()));
+}
+
+void FlashBenchRunner::start()
+{
+    m_phases.clear();
+    m_errors.clear();
+    m_done = false;
+    m_finished = false;
+    m_totalMs = 0;
+    m_progressEvents = 0;
+    m_progressMonotonic = true;
+    m_lastProgress = 0;
+    m_lastTotal = 0;
+    m_lastProgressMs = -1;
+    m_progressMaxGap = 0;
+    m_timer.start();
+    status("Starting");
+}
+
+bool FlashBenchRunner::wait(int timeout)
+{
+    QElapsedTimer waited;
+    waited.start();
+    while (!m_finished && waited.elapsed() < timeout)
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 50);
+    if (!m_finished)
+        error("Benchmark timed out");
+    return succeeded();
+}
+
+void FlashBenchRunner::closePhase()
+{
+    if (!m_phases.isEmpty())
+        m_phases.last().durationMs = m_timer.elapsed() - m_phases.last().startMs;
+}
+
+void FlashBenchRunner::status(QString status)
+{
+    closePhase();
+    FlashBenchPhase phase;
+    phase.status = status;
+    phase.startMs = m_timer.elapsed();
+    phase.durationMs = 0;
+    m_phases.append(phase);
+}
+
+void FlashBenchRunner::progress(qint64 current, qint64 total)
+{
+    //A new total starts a new count, e.g. after a retry from erase
+    if (total == m_lastTotal && current < m_lastProgress)
+        m_progressMonotonic = false;
+    m_progressEvents++;
+    qint64 now = m_timer.elapsed();
+    if (m_lastProgressMs >= 0)
+        m_progressMaxGap = qMax(m_progressMaxGap, now - m_lastProgressMs);
+    m_lastProgressMs = now;
+    m_lastProgress = current;
+    m_lastTotal = total;
+}
+
+void FlashBenchRunner::error(QString error)
+{
+    m_errors.append(error);
+}
+
+void FlashBenchRunner::done()
+{
+    m_done = true;
+}
+
+void FlashBenchRunner::finished()
+{
+    closePhase();
+    m_totalMs = m_timer.elapsed();
+    m_finished = true;
+}
+
+void FlashBenchRunner::print(const QList<FlashBenchPhase> &phases, qint64 bytes)
+{
+    QTextStream out(stdout);
+    qint64 total = 0;
+    foreach (const FlashBenchPhase &phase, phases)
+    {
+        out << QString("%1 ms").arg(phase.durationMs, 8) << "  " << phase.status << endl;
+        total += phase.durationMs;
+    }
+    out << QString("%1 ms").arg(total, 8) << "  total, "
+        << (total > 0 ? bytes * 1000 / total : 0) << " bytes/s effective" << endl;
+}
@@ -0,0 +1,74 @@
+#ifndef FLASHBENCHRUNNER_H
+#define FLASHBENCHRUNNER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+struct FlashBenchPhase
+{
+    QString status;
+    qint64 startMs;
+    qint64 durationMs;
+};
+
+/**
+ * Runs one flash session of any uploader with the common signals
+ * (statusUpdate, flashProgress, error, done, finished) to its end and
+ * records when each status line appeared, so the time between two of
+ * them is the wall time of that phase. Progress events are counted and
+ * checked to only move forward within one total; the longest time
+ * without one shows how smooth a progress bar would move.
+ */
+class FlashBenchRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FlashBenchRunner(QObject *parent = 0);
+
+    void watch(QObject *uploader);
+    void start();
+    bool wait(int timeout);
+
+    bool succeeded() const { return m_done && m_errors.isEmpty(); }
+    qint64 elapsed() const { return m_totalMs; }
+    QList<FlashBenchPhase> phases() const { return m_phases; }
+    QStringList errors() const { return m_errors; }
+    int progressEvents() const { return m_progressEvents; }
+    bool progressMonotonic() const { return m_progressMonotonic; }
+    bool progressComplete() const { return m_lastTotal > 0 && m_lastProgress == m_lastTotal; }
+    qint64 progressMaxGap() const { return m_progressMaxGap; }
+
+    static void print(const QList<FlashBenchPhase> &phases, qint64 bytes);
+
+public slots:
+    //Starts a phase, also for work the benchmark itself emulates
+    void status(QString status);
+
+private slots:
+    void progress(qint64 current, qint64 total);
+    void error(QString error);
+    void done();
+    void finished();
+
+private:
+    QElapsedTimer m_timer;
+    QList<FlashBenchPhase> m_phases;
+    QStringList m_errors;
+    bool m_done;
+    bool m_finished;
+    qint64 m_totalMs;
+    int m_progressEvents;
+    bool m_progressMonotonic;
+    qint64 m_lastProgress;
+    qint64 m_lastTotal;
+    qint64 m_lastProgressMs;
+    qint64 m_progressMaxGap;
+
+    void closePhase();
+};
+
+#endif // FLASHBENCHRUNNER_H
@@ -0,0 +1,137 @@
+#include "ptydevice.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+//Poll interval of the device thread, bounds how long close() waits
+#define PTY_POLL_INTERVAL 20
+
+PtyDevice::PtyDevice() :
+    m_master(-1),
+    m_slave(-1),
+    m_baudRate(0),
+    m_stop(false)
+{
+}
+
+PtyDevice::~PtyDevice()
+{
+    //Subclasses have to close() in their destructor, received() is theirs
+    close();
+}
+
+void PtyDevice::setBaudRate(int baudRate)
+{
+    m_baudRate = baudRate;
+}
+
+bool PtyDevice::setError(const char *what)
+{
+    m_errorString = std::string(what) + ": " + strerror(errno);
+    close();
+    return false;
+}
+
+bool PtyDevice::open()
+{
+    close();
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (m_master < 0)
+        return setError("posix_openpt");
+    if (grantpt(m_master) < 0 || unlockpt(m_master) < 0)
+        return setError("grantpt");
+    const char *name = ptsname(m_master);
+    if (!name)
+        return setError("ptsname");
+    m_slaveName = name;
+
+    //Raw like a UART, no echo or line editing before a client sets its
+    //own mode, and held open so the master never sees a hangup
+    m_slave = ::open(name, O_RDWR | O_NOCTTY);
+    if (m_slave < 0)
+        return setError("open slave");
+    struct termios tio;
+    if (tcgetattr(m_slave, &tio) < 0)
+        return setError("tcgetattr");
+    cfmakeraw(&tio);
+    if (tcsetattr(m_slave, TCSANOW, &tio) < 0)
+        return setError("tcsetattr");
+
+    m_stop = false;
+    m_thread = std::thread(&PtyDevice::run, this);
+    return true;
+}
+
+void PtyDevice::close()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+    if (m_slave >= 0)
+        ::close(m_slave);
+    if (m_master >= 0)
+        ::close(m_master);
+    m_slave = -1;
+    m_master = -1;
+}
+
+void PtyDevice::sleepMicroseconds(long us)
+{
+    if (us <= 0)
+        return;
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+void PtyDevice::pace(size_t bytes) const
+{
+    //Start bit, eight data bits, stop bit
+    if (m_baudRate > 0)
+        sleepMicroseconds((long)(bytes * 10 * 1000000LL / m_baudRate));
+}
+
+void PtyDevice::send(const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    while (len > 0)
+    {
+        ssize_t written = ::write(m_master, p, len);
+        if (written < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return;
+        }
+        pace(written);
+        p += written;
+        len -= written;
+    }
+}
+
+void PtyDevice::run()
+{
+    unsigned char buffer[4096];
+    while (!m_stop)
+    {
+        struct pollfd fd;
+        fd.fd = m_master;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        if (poll(&fd, 1, PTY_POLL_INTERVAL) <= 0 || !(fd.revents & POLLIN))
+            continue;
+        ssize_t len = ::read(m_master, buffer, sizeof(buffer));
+        if (len <= 0)
+            continue;
+        pace(len);
+        received(buffer, len);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef PTYDEVICE_H
+#define PTYDEVICE_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+/**
+ * A simulated serial device on a Linux pseudo-terminal. open() creates
+ * the pty and a thread that hands everything written to slaveName() to
+ * received(); replies go back with send(). Anything that opens a serial
+ * port by path (SerialLink, avrdude, flashtool-cli --port) can talk to it.
+ * The emulator keeps its own handle on the slave side, so clients can
+ * close and reopen the port as with a real board.
+ *
+ * With setBaudRate() every byte costs ten bit times in both directions,
+ * like a real UART, otherwise the pty runs at memory speed. Qt free.
+ */
+class PtyDevice
+{
+public:
+    PtyDevice();
+    virtual ~PtyDevice();
+
+    void setBaudRate(int baudRate);
+    bool open();
+    void close();
+    const std::string &slaveName() const { return m_slaveName; }
+    const std::string &errorString() const { return m_errorString; }
+
+protected:
+    //Called on the device thread
+    virtual void received(const unsigned char *data, size_t len) = 0;
+    void send(const void *data, size_t len);
+    static void sleepMicroseconds(long us);
+
+private:
+    int m_master;
+    int m_slave;
+    int m_baudRate;
+    std::string m_slaveName;
+    std::string m_errorString;
+    std::thread m_thread;
+    std::atomic<bool> m_stop;
+
+    void run();
+    void pace(size_t bytes) const;
+    bool setError(const char *what);
+};
+
+#endif // PTYDEVICE_H
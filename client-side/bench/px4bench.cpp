@@ -0,0 +1,101 @@
+/*
+ * Decoding a .px4 container: the QString/split()/qUncompress/temp file
+ * path the uploader used before against Px4Image. A synthetic firmware
+ * of the given size is written to a temporary .px4 first.
+ *
+ *    qmake px4bench.pro && make && ./px4bench [image KiB]
+ */
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QTextStream>
+
+#include "px4image.h"
+
+static QByteArray legacyDecode(const QString &file)
+{
+    QFile json(file);
+    json.open(QIODevice::ReadOnly);
+    QByteArray jsonbytes = json.readAll();
+    QString jsonstring(jsonbytes);
+    json.close();
+
+    QTemporaryFile tempJsonFile;
+    tempJsonFile.open();
+    tempJsonFile.write(jsonbytes);
+    tempJsonFile.close();
+
+    QStringList decode_list = jsonstring.split("\"board_id\":");
+    decode_list = decode_list.last().split(",");
+    decode_list = jsonstring.split("\"image_size\":");
+    decode_list = decode_list.last().split(",");
+    int fwSize = QString(decode_list.first().toUtf8()).trimmed().toInt();
+    decode_list = jsonstring.split("\"description\": \"");
+    decode_list = decode_list.last().split("\"");
+    QStringList list = jsonstring.split("\"image\": \"");
+    list = list.last().split("\"");
+
+    QByteArray fwimage;
+    fwimage.append((unsigned char)((fwSize >> 24) & 0xFF));
+    fwimage.append((unsigned char)((fwSize >> 16) & 0xFF));
+    fwimage.append((unsigned char)((fwSize >> 8) & 0xFF));
+    fwimage.append((unsigned char)((fwSize >> 0) & 0xFF));
+    fwimage.append(QByteArray::fromBase64(list.first().toUtf8()));
+    QByteArray uncompressed = qUncompress(fwimage);
+    while ((uncompressed.count() % 4) != 0)
+        uncompressed.append((char)0xFF);
+
+    QTemporaryFile tempFile;
+    tempFile.open();
+    tempFile.write(uncompressed);
+    tempFile.close();
+    tempFile.open();
+    QByteArray image = tempFile.readAll();
+    tempFile.close();
+    return image;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    int imageSize = (argc > 1 ? QByteArray(argv[1]).toInt() : 2048) * 1024 + 3;
+
+    //Code like data: compressible, but not trivially
+    QByteArray firmware(imageSize, 0);
+    quint32 seed = 1;
+    for (int i = 0; i < imageSize; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        firmware[i] = (seed >> 16) & 0x0F;
+    }
+    QByteArray compressed = qCompress(firmware, 9).mid(4);
+
+    QTemporaryFile px4;
+    px4.open();
+    px4.write("{\n    \"board_id\": 9, \n    \"description\": \"Benchmark firmware\", \n    \"image\": \"");
+    px4.write(compressed.toBase64());
+    px4.write("\", \n    \"image_maxsize\": 2080768, \n    \"image_size\": " + QByteArray::number(imageSize) + "\n}\n");
+    px4.close();
+    out << "image " << imageSize << " bytes, .px4 " << px4.size() << " bytes" << endl;
+
+    const int rounds = 10;
+    QElapsedTimer timer;
+    QByteArray legacy;
+    timer.start();
+    for (int i = 0; i < rounds; i++)
+        legacy = legacyDecode(px4.fileName());
+    qint64 legacyTime = timer.elapsed();
+
+    Px4Image image;
+    timer.start();
+    for (int i = 0; i < rounds; i++)
+        image.load(px4.fileName());
+    qint64 streamTime = timer.elapsed();
+
+    out << "legacy   " << double(legacyTime) / rounds << " ms per image" << endl;
+    out << "Px4Image " << double(streamTime) / rounds << " ms per image" << endl;
+    out << (image.image() == legacy ? "images match" : "IMAGES DIFFER") << endl;
+    return image.image() == legacy ? 0 : 1;
+}
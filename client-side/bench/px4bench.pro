@@ -0,0 +1,17 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QT = core
+
+TARGET = px4bench
+
+LIBS += -lz
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    px4bench.cpp \
+    ../px4image.cpp
+
+HEADERS += \
+    ../px4image.h
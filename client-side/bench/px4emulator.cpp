@@ -0,0 +1,253 @@
+#include "px4emulator.h"
+#include "crc32.h"
+
+#include <string.h>
+
+#define PROTO_INSYNC 0x12
+#define PROTO_OK 0x10
+#define PROTO_FAILED 0x11
+#define PROTO_INVALID 0x13
+#define PROTO_EOC 0x20
+#define PROTO_GET_SYNC 0x21
+#define PROTO_GET_DEVICE 0x22
+#define PROTO_CHIP_ERASE 0x23
+#define PROTO_PROG_MULTI 0x27
+#define PROTO_GET_CRC 0x29
+#define PROTO_GET_OTP 0x2A
+#define PROTO_GET_SN 0x2B
+#define PROTO_BOOT 0x30
+#define PROTO_DEVICE_BL_REV 0x01
+#define PROTO_DEVICE_BOARD_ID 0x02
+#define PROTO_DEVICE_BOARD_REV 0x03
+#define PROTO_DEVICE_FW_SIZE 0x04
+#define OTP_SIZE 512
+#define SN_SIZE 12
+
+//Not a complete command yet, wait for more bytes
+#define NEED_MORE 0
+
+Px4EmulatorConfig::Px4EmulatorConfig() :
+    bootloaderRev(4),
+    boardId(9),
+    boardRev(0),
+    //STM32F4 with 1 MiB, less the 16 KiB bootloader
+    flashSize(1032192),
+    latencyUs(0),
+    eraseMs(0),
+    syncErrorRate(0),
+    dropRate(0),
+    seed(1)
+{
+}
+
+Px4EmulatorStats::Px4EmulatorStats() :
+    syncs(0),
+    erases(0),
+    progFrames(0),
+    progBytes(0),
+    crcs(0),
+    boots(0),
+    invalid(0),
+    injectedErrors(0),
+    drops(0)
+{
+}
+
+Px4Emulator::Px4Emulator(const Px4EmulatorConfig &config) :
+    m_config(config),
+    m_flash(config.flashSize, 0xFF),
+    m_programOffset(0),
+    m_random(config.seed)
+{
+}
+
+Px4Emulator::~Px4Emulator()
+{
+    close();
+}
+
+Px4EmulatorStats Px4Emulator::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::vector<unsigned char> Px4Emulator::flash() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_flash;
+}
+
+bool Px4Emulator::chance(double rate)
+{
+    return rate > 0 && std::uniform_real_distribution<double>(0, 1)(m_random) < rate;
+}
+
+void Px4Emulator::reply(const unsigned char *data, size_t len, unsigned char status)
+{
+    unsigned char frame[16];
+    if (len > 0)
+        memcpy(frame, data, len);
+    frame[len] = PROTO_INSYNC;
+    frame[len + 1] = status;
+    sleepMicroseconds(m_config.latencyUs);
+    send(frame, len + 2);
+}
+
+void Px4Emulator::replyWord(unsigned int value)
+{
+    unsigned char word[4] = { (unsigned char)(value & 0xFF), (unsigned char)((value >> 8) & 0xFF),
+                              (unsigned char)((value >> 16) & 0xFF), (unsigned char)((value >> 24) & 0xFF) };
+    reply(word, 4, PROTO_OK);
+}
+
+void Px4Emulator::received(const unsigned char *data, size_t len)
+{
+    m_rx.insert(m_rx.end(), data, data + len);
+    size_t done = 0;
+    while (done < m_rx.size())
+    {
+        size_t used = command(m_rx.data() + done, m_rx.size() - done);
+        if (used == NEED_MORE)
+            break;
+        done += used;
+    }
+    m_rx.erase(m_rx.begin(), m_rx.begin() + done);
+}
+
+size_t Px4Emulator::command(const unsigned char *p, size_t len)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    //Like the real bootloader, a command with a bad EOC only costs its
+    //first byte and the rest is looked at again
+    size_t size = 0;
+    switch (p[0])
+    {
+    case PROTO_EOC:
+        //GET_OTP goes out without EOC from some hosts, with it from others
+        return 1;
+    case PROTO_GET_SYNC:
+    case PROTO_CHIP_ERASE:
+    case PROTO_GET_CRC:
+    case PROTO_BOOT:
+        size = 2;
+        break;
+    case PROTO_GET_DEVICE:
+        size = 3;
+        break;
+    case PROTO_GET_OTP:
+        size = 5;
+        break;
+    case PROTO_GET_SN:
+        size = 6;
+        break;
+    case PROTO_PROG_MULTI:
+        if (len < 2)
+            return NEED_MORE;
+        size = 3 + p[1];
+        break;
+    default:
+        m_stats.invalid++;
+        reply(0, 0, PROTO_INVALID);
+        return 1;
+    }
+    if (len < size)
+        return NEED_MORE;
+    if (p[0] != PROTO_GET_OTP && p[size - 1] != PROTO_EOC)
+    {
+        m_stats.invalid++;
+        reply(0, 0, PROTO_INVALID);
+        return 1;
+    }
+    if (chance(m_config.dropRate))
+    {
+        m_stats.drops++;
+        return size;
+    }
+
+    switch (p[0])
+    {
+    case PROTO_GET_SYNC:
+        m_stats.syncs++;
+        if (chance(m_config.syncErrorRate))
+        {
+            m_stats.injectedErrors++;
+            reply(0, 0, PROTO_INVALID);
+            break;
+        }
+        reply(0, 0, PROTO_OK);
+        break;
+    case PROTO_GET_DEVICE:
+        if (chance(m_config.syncErrorRate))
+        {
+            m_stats.injectedErrors++;
+            reply(0, 0, PROTO_INVALID);
+            break;
+        }
+        switch (p[1])
+        {
+        case PROTO_DEVICE_BL_REV: replyWord(m_config.bootloaderRev); break;
+        case PROTO_DEVICE_BOARD_ID: replyWord(m_config.boardId); break;
+        case PROTO_DEVICE_BOARD_REV: replyWord(m_config.boardRev); break;
+        case PROTO_DEVICE_FW_SIZE: replyWord(m_config.flashSize); break;
+        default:
+            m_stats.invalid++;
+            reply(0, 0, PROTO_INVALID);
+            break;
+        }
+        break;
+    case PROTO_CHIP_ERASE:
+        m_stats.erases++;
+        sleepMicroseconds(m_config.eraseMs * 1000L);
+        memset(m_flash.data(), 0xFF, m_flash.size());
+        m_programOffset = 0;
+        reply(0, 0, PROTO_OK);
+        break;
+    case PROTO_PROG_MULTI:
+    {
+        size_t count = p[1];
+        if (count % 4 != 0 || m_programOffset + count > m_flash.size())
+        {
+            reply(0, 0, PROTO_FAILED);
+            break;
+        }
+        memcpy(m_flash.data() + m_programOffset, p + 2, count);
+        m_programOffset += count;
+        m_stats.progFrames++;
+        m_stats.progBytes += count;
+        reply(0, 0, PROTO_OK);
+        break;
+    }
+    case PROTO_GET_CRC:
+        m_stats.crcs++;
+        replyWord(crc32Update(0, m_flash.data(), m_flash.size()));
+        break;
+    case PROTO_GET_OTP:
+    {
+        //"PX4\0" header, the rest of the certificate area blank
+        unsigned int address = p[1] | (p[2] << 8) | (p[3] << 16) | ((unsigned int)p[4] << 24);
+        static const unsigned char header[4] = { 'P', 'X', '4', 0 };
+        unsigned char word[4] = { 0, 0, 0, 0 };
+        if (address == 0)
+            memcpy(word, header, 4);
+        reply(word, 4, address + 4 <= OTP_SIZE ? PROTO_OK : PROTO_FAILED);
+        break;
+    }
+    case PROTO_GET_SN:
+    {
+        unsigned int address = p[1] | (p[2] << 8) | (p[3] << 16) | ((unsigned int)p[4] << 24);
+        unsigned char word[4];
+        for (int i = 0; i < 4; i++)
+            word[i] = (unsigned char)(0xA0 + address + i);
+        reply(word, 4, address + 4 <= SN_SIZE ? PROTO_OK : PROTO_FAILED);
+        break;
+    }
+    case PROTO_BOOT:
+        m_stats.boots++;
+        m_programOffset = 0;
+        reply(0, 0, PROTO_OK);
+        break;
+    }
+    return size;
+}
@@ -0,0 +1,77 @@
+#ifndef PX4EMULATOR_H
+#define PX4EMULATOR_H
+
+#include "ptydevice.h"
+
+#include <mutex>
+#include <random>
+#include <vector>
+
+struct Px4EmulatorConfig
+{
+    Px4EmulatorConfig();
+
+    int bootloaderRev;
+    int boardId;
+    int boardRev;
+    int flashSize;
+    //Before every reply and for CHIP_ERASE
+    int latencyUs;
+    int eraseMs;
+    //Share of GET_SYNC/GET_DEVICE answered INSYNC INVALID, and of any
+    //command silently dropped
+    double syncErrorRate;
+    double dropRate;
+    unsigned int seed;
+};
+
+struct Px4EmulatorStats
+{
+    Px4EmulatorStats();
+
+    int syncs;
+    int erases;
+    int progFrames;
+    long long progBytes;
+    int crcs;
+    int boots;
+    int invalid;
+    int injectedErrors;
+    int drops;
+};
+
+/**
+ * The PX4 bootloader as F4BYFirmwareUploader sees it (GET_SYNC,
+ * GET_DEVICE, CHIP_ERASE, PROG_MULTI, GET_CRC, GET_OTP, GET_SN, BOOT) on
+ * a pseudo-terminal. Flash is kept in memory and GET_CRC sums all of it,
+ * so a CRC match proves what was written. Timing and faults come from
+ * Px4EmulatorConfig. Qt free.
+ */
+class Px4Emulator : public PtyDevice
+{
+public:
+    explicit Px4Emulator(const Px4EmulatorConfig &config = Px4EmulatorConfig());
+    ~Px4Emulator();
+
+    Px4EmulatorStats stats() const;
+    std::vector<unsigned char> flash() const;
+
+protected:
+    void received(const unsigned char *data, size_t len);
+
+private:
+    Px4EmulatorConfig m_config;
+    std::vector<unsigned char> m_rx;
+    std::vector<unsigned char> m_flash;
+    size_t m_programOffset;
+    std::mt19937 m_random;
+    Px4EmulatorStats m_stats;
+    mutable std::mutex m_mutex;
+
+    size_t command(const unsigned char *p, size_t len);
+    bool chance(double rate);
+    void reply(const unsigned char *data, size_t len, unsigned char status);
+    void replyWord(unsigned int value);
+};
+
+#endif // PX4EMULATOR_H
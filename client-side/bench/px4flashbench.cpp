@@ -0,0 +1,172 @@
+/*
+ * Complete F4BYFirmwareUploader sessions against Px4Emulator on a
+ * pseudo-terminal: reboot, sync, device info, OTP/SN, erase, PROG_MULTI
+ * and CRC, with wall time per phase and effective bytes/s. Linux only.
+ *
+ *    qmake px4flashbench.pro && make && ./px4flashbench --size 1000 --window 4
+ *
+ * --download emulates the firmware download of a FlashSession: by
+ * default the board is prepared (reboot to erase) in the meantime like
+ * the pipelined session does, --sequential waits for the download first.
+ *
+ * --serve only starts the emulator and prints its port, e.g. for
+ * flashtool-cli --f4by --file x.px4 --port <pty>.
+ */
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <string.h>
+
+#include "F4BYFirmwareUploader.h"
+#include "flashbenchrunner.h"
+#include "px4emulator.h"
+
+static bool writePx4(QTemporaryFile &px4, int imageSize, QByteArray *firmware)
+{
+    //Code like data: compressible, but not trivially
+    firmware->resize(imageSize);
+    quint32 seed = 1;
+    for (int i = 0; i < imageSize; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        (*firmware)[i] = (seed >> 16) & 0x0F;
+    }
+    QByteArray compressed = qCompress(*firmware, 9).mid(4);
+
+    if (!px4.open())
+        return false;
+    px4.write("{\n    \"board_id\": 9, \n    \"description\": \"Benchmark firmware\", \n    \"image\": \"");
+    px4.write(compressed.toBase64());
+    px4.write("\", \n    \"image_maxsize\": 2080768, \n    \"image_size\": " + QByteArray::number(imageSize) + "\n}\n");
+    px4.close();
+    return true;
+}
+
+static void runEvents(int ms)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < ms)
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 10);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption sizeOption("size", "Firmware size.", "KiB", "1000");
+    QCommandLineOption roundsOption("rounds", "Flash sessions to run.", "count", "3");
+    QCommandLineOption windowOption("window", "PROG_MULTI frames in flight.", "frames", "4");
+    QCommandLineOption handshakeOption("handshake", "conservative or fast.", "profile", "conservative");
+    QCommandLineOption latencyOption("latency", "Emulated reply latency.", "us", "0");
+    QCommandLineOption eraseOption("erase", "Emulated chip erase time.", "ms", "0");
+    QCommandLineOption baudOption("baud", "Emulated line speed, 0 for none (USB CDC).", "baud", "0");
+    QCommandLineOption flashOption("flash-size", "Emulated flash size.", "bytes", "1032192");
+    QCommandLineOption revOption("bl-rev", "Emulated bootloader revision, below 4 skips OTP/SN.", "rev", "4");
+    QCommandLineOption syncErrorOption("sync-errors", "Share of GET_SYNC/GET_DEVICE answered INVALID.", "rate", "0");
+    QCommandLineOption dropOption("drops", "Share of commands without any answer.", "rate", "0");
+    QCommandLineOption downloadOption("download", "Emulated firmware download time.", "ms", "0");
+    QCommandLineOption sequentialOption("sequential", "Prepare the board only after the download.");
+    QCommandLineOption serveOption("serve", "Only run the emulator until killed.");
+    parser.addOption(sizeOption);
+    parser.addOption(roundsOption);
+    parser.addOption(windowOption);
+    parser.addOption(handshakeOption);
+    parser.addOption(latencyOption);
+    parser.addOption(eraseOption);
+    parser.addOption(baudOption);
+    parser.addOption(flashOption);
+    parser.addOption(revOption);
+    parser.addOption(syncErrorOption);
+    parser.addOption(dropOption);
+    parser.addOption(downloadOption);
+    parser.addOption(sequentialOption);
+    parser.addOption(serveOption);
+    parser.process(app);
+
+    Px4EmulatorConfig config;
+    config.latencyUs = parser.value(latencyOption).toInt();
+    config.eraseMs = parser.value(eraseOption).toInt();
+    config.flashSize = parser.value(flashOption).toInt();
+    config.bootloaderRev = parser.value(revOption).toInt();
+    config.syncErrorRate = parser.value(syncErrorOption).toDouble();
+    config.dropRate = parser.value(dropOption).toDouble();
+    Px4Emulator emulator(config);
+    emulator.setBaudRate(parser.value(baudOption).toInt());
+    if (!emulator.open())
+    {
+        out << "cannot create pty: " << QString::fromStdString(emulator.errorString()) << endl;
+        return 1;
+    }
+    QString port = QString::fromStdString(emulator.slaveName());
+    if (parser.isSet(serveOption))
+    {
+        out << "PX4 bootloader emulator on " << port << endl;
+        return app.exec();
+    }
+
+    QTemporaryFile px4;
+    QByteArray firmware;
+    int imageSize = parser.value(sizeOption).toInt() * 1024;
+    if (!writePx4(px4, imageSize, &firmware))
+        return 1;
+    out << "image " << imageSize << " bytes on " << port << ", window " << parser.value(windowOption)
+        << ", " << parser.value(handshakeOption) << " handshake" << endl;
+
+    int rounds = qMax(1, parser.value(roundsOption).toInt());
+    int failures = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        F4BYFirmwareUploader uploader;
+        uploader.setPortName(port);
+        uploader.setProgWindow(parser.value(windowOption).toInt());
+        uploader.setHandshakeProfile(parser.value(handshakeOption) == "fast"
+                                     ? F4BYFirmwareUploader::FastHandshake
+                                     : F4BYFirmwareUploader::ConservativeHandshake);
+        FlashBenchRunner runner;
+        runner.watch(&uploader);
+        runner.start();
+        int download = parser.value(downloadOption).toInt();
+        if (download > 0 && parser.isSet(sequentialOption))
+        {
+            runner.status("Downloading firmware (emulated)");
+            runEvents(download);
+        }
+        else if (download > 0)
+        {
+            uploader.prepare();
+            runEvents(download);
+        }
+        if (!uploader.loadFile(px4.fileName()))
+            return 1;
+        bool ok = runner.wait(300000);
+        uploader.stop();
+
+        out << endl << "round " << round + 1 << (ok ? " ok" : " FAILED") << endl;
+        FlashBenchRunner::print(runner.phases(), imageSize);
+        foreach (const QString &error, runner.errors())
+            out << "error: " << error << endl;
+
+        //The emulator CRC already matched, check the bytes anyway
+        std::vector<unsigned char> flash = emulator.flash();
+        if (ok && memcmp(flash.data(), firmware.constData(), imageSize) != 0)
+        {
+            out << "FLASH CONTENT DIFFERS" << endl;
+            ok = false;
+        }
+        if (!ok)
+            failures++;
+    }
+
+    Px4EmulatorStats stats = emulator.stats();
+    out << endl << "emulator: " << stats.syncs << " syncs, " << stats.erases << " erases, "
+        << stats.progFrames << " PROG_MULTI (" << stats.progBytes << " bytes), "
+        << stats.crcs << " CRCs, " << stats.invalid << " invalid, "
+        << stats.injectedErrors << " injected errors, " << stats.drops << " drops" << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+QT = core serialport
+
+TARGET = px4flashbench
+
+LIBS += -lpthread
+
+#Uploaders, SessionTracer and FLASHTOOL_VERSION as the tool builds them
+include(../flashcore.pri)
+
+SOURCES += \
+    px4flashbench.cpp \
+    flashbenchrunner.cpp \
+    ptydevice.cpp \
+    px4emulator.cpp
+
+HEADERS += \
+    flashbenchrunner.h \
+    ptydevice.h \
+    px4emulator.h
@@ -0,0 +1,301 @@
+#include "stk500emulator.h"
+
+#include <string.h>
+
+#define MESSAGE_START 0x1B
+#define TOKEN 0x0E
+#define CMD_SIGN_ON 0x01
+#define CMD_SET_PARAMETER 0x02
+#define CMD_GET_PARAMETER 0x03
+#define CMD_LOAD_ADDRESS 0x06
+#define CMD_ENTER_PROGMODE_ISP 0x10
+#define CMD_LEAVE_PROGMODE_ISP 0x11
+#define CMD_CHIP_ERASE_ISP 0x12
+#define CMD_PROGRAM_FLASH_ISP 0x13
+#define CMD_READ_FLASH_ISP 0x14
+#define CMD_PROGRAM_EEPROM_ISP 0x15
+#define CMD_READ_EEPROM_ISP 0x16
+#define CMD_PROGRAM_FUSE_ISP 0x17
+#define CMD_READ_FUSE_ISP 0x18
+#define CMD_PROGRAM_LOCK_ISP 0x19
+#define CMD_READ_LOCK_ISP 0x1A
+#define CMD_READ_SIGNATURE_ISP 0x1B
+#define CMD_SPI_MULTI 0x1D
+#define PARAM_HW_VER 0x90
+#define PARAM_SW_MAJOR 0x91
+#define PARAM_SW_MINOR 0x92
+#define STATUS_CMD_OK 0x00
+#define STATUS_CMD_FAILED 0xC0
+#define STATUS_CMD_UNKNOWN 0xC9
+#define AVR_PAGE_SIZE 256
+//Header, largest body (a page plus the command fields), checksum
+#define MAX_MESSAGE (5 + 10 + AVR_PAGE_SIZE + 1)
+
+static const unsigned char AVR_SIGNATURE[] = { 0x1E, 0x98, 0x01 };
+//Arduino Mega 2560 defaults
+#define FUSE_LOW 0xFF
+#define FUSE_HIGH 0xD8
+#define FUSE_EXTENDED 0xFD
+#define LOCK_BITS 0xCF
+
+Stk500EmulatorConfig::Stk500EmulatorConfig() :
+    baudRate(115200),
+    pageWriteUs(4500),
+    //Without the 8 KiB bootloader section
+    flashSize(256 * 1024 - 8 * 1024)
+{
+}
+
+Stk500EmulatorStats::Stk500EmulatorStats() :
+    frames(0),
+    checksumErrors(0),
+    signOns(0),
+    loadAddresses(0),
+    pagesWritten(0),
+    pagesRead(0),
+    bytesWritten(0),
+    bytesRead(0),
+    lineBytesIn(0),
+    lineBytesOut(0)
+{
+}
+
+Stk500Emulator::Stk500Emulator(const Stk500EmulatorConfig &config) :
+    m_config(config),
+    m_flash(config.flashSize, 0xFF),
+    m_address(0)
+{
+    setBaudRate(config.baudRate);
+}
+
+Stk500Emulator::~Stk500Emulator()
+{
+    close();
+}
+
+Stk500EmulatorStats Stk500Emulator::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::vector<unsigned char> Stk500Emulator::flash() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_flash;
+}
+
+void Stk500Emulator::setFlash(const std::vector<unsigned char> &flash)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_flash = flash;
+    m_flash.resize(m_config.flashSize, 0xFF);
+}
+
+void Stk500Emulator::received(const unsigned char *data, size_t len)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.lineBytesIn += len;
+    m_rx.insert(m_rx.end(), data, data + len);
+
+    size_t done = 0;
+    while (done < m_rx.size())
+    {
+        const unsigned char *p = m_rx.data() + done;
+        size_t left = m_rx.size() - done;
+        //Noise between messages is skipped like stk500boot.c does
+        if (p[0] != MESSAGE_START)
+        {
+            done++;
+            continue;
+        }
+        if (left < 5)
+            break;
+        size_t size = (p[2] << 8) | p[3];
+        if (p[4] != TOKEN || size == 0 || 5 + size + 1 > MAX_MESSAGE)
+        {
+            done++;
+            continue;
+        }
+        if (left < 5 + size + 1)
+            break;
+        unsigned char checksum = 0;
+        for (size_t i = 0; i < 5 + size + 1; i++)
+            checksum ^= p[i];
+        if (checksum != 0)
+        {
+            //No answer, the host times out and sends it again
+            m_stats.checksumErrors++;
+            done++;
+            continue;
+        }
+        m_stats.frames++;
+        message(p[1], p + 5, size);
+        done += 5 + size + 1;
+    }
+    m_rx.erase(m_rx.begin(), m_rx.begin() + done);
+}
+
+void Stk500Emulator::answer(unsigned char sequence, const std::vector<unsigned char> &body)
+{
+    std::vector<unsigned char> frame;
+    frame.reserve(body.size() + 6);
+    frame.push_back(MESSAGE_START);
+    frame.push_back(sequence);
+    frame.push_back((body.size() >> 8) & 0xFF);
+    frame.push_back(body.size() & 0xFF);
+    frame.push_back(TOKEN);
+    frame.insert(frame.end(), body.begin(), body.end());
+    unsigned char checksum = 0;
+    for (size_t i = 0; i < frame.size(); i++)
+        checksum ^= frame[i];
+    frame.push_back(checksum);
+    m_stats.lineBytesOut += frame.size();
+    send(frame.data(), frame.size());
+}
+
+unsigned char Stk500Emulator::fuse(unsigned char high, unsigned char low) const
+{
+    //The ISP read instruction tells which fuse or lock byte is meant
+    if (high == 0x50 && low == 0x00)
+        return FUSE_LOW;
+    if (high == 0x58 && low == 0x08)
+        return FUSE_HIGH;
+    if (high == 0x50 && low == 0x08)
+        return FUSE_EXTENDED;
+    if (high == 0x58 && low == 0x00)
+        return LOCK_BITS;
+    return 0;
+}
+
+void Stk500Emulator::message(unsigned char sequence, const unsigned char *body, size_t len)
+{
+    unsigned char command = body[0];
+    std::vector<unsigned char> reply;
+    reply.push_back(command);
+
+    switch (command)
+    {
+    case CMD_SIGN_ON:
+    {
+        static const char name[] = "AVRISP_2";
+        m_stats.signOns++;
+        reply.push_back(STATUS_CMD_OK);
+        reply.push_back(sizeof(name) - 1);
+        reply.insert(reply.end(), name, name + sizeof(name) - 1);
+        break;
+    }
+    case CMD_GET_PARAMETER:
+    {
+        unsigned char value = 0;
+        if (len >= 2 && body[1] == PARAM_HW_VER)
+            value = 0x0F;
+        else if (len >= 2 && body[1] == PARAM_SW_MAJOR)
+            value = 0x02;
+        else if (len >= 2 && body[1] == PARAM_SW_MINOR)
+            value = 0x0A;
+        reply.push_back(STATUS_CMD_OK);
+        reply.push_back(value);
+        break;
+    }
+    case CMD_SET_PARAMETER:
+    case CMD_ENTER_PROGMODE_ISP:
+    case CMD_LEAVE_PROGMODE_ISP:
+    case CMD_CHIP_ERASE_ISP:
+    case CMD_PROGRAM_FUSE_ISP:
+    case CMD_PROGRAM_LOCK_ISP:
+        //The bootloader cannot change any of these, it just agrees
+        reply.push_back(STATUS_CMD_OK);
+        break;
+    case CMD_LOAD_ADDRESS:
+    {
+        if (len < 5)
+        {
+            reply.push_back(STATUS_CMD_FAILED);
+            break;
+        }
+        //Word address, bit 31 only selects the extended address byte
+        unsigned int word = ((unsigned int)body[1] << 24) | (body[2] << 16) | (body[3] << 8) | body[4];
+        m_address = (word & 0x7FFFFFFF) * 2;
+        m_stats.loadAddresses++;
+        reply.push_back(STATUS_CMD_OK);
+        break;
+    }
+    case CMD_PROGRAM_FLASH_ISP:
+    {
+        size_t size = len >= 3 ? (body[1] << 8) | body[2] : 0;
+        if (len < 10 + size || m_address + size > m_flash.size())
+        {
+            reply.push_back(STATUS_CMD_FAILED);
+            break;
+        }
+        memcpy(m_flash.data() + m_address, body + 10, size);
+        m_address += size;
+        m_stats.pagesWritten++;
+        m_stats.bytesWritten += size;
+        sleepMicroseconds(m_config.pageWriteUs);
+        reply.push_back(STATUS_CMD_OK);
+        break;
+    }
+    case CMD_READ_FLASH_ISP:
+    case CMD_READ_EEPROM_ISP:
+    {
+        size_t size = len >= 3 ? (body[1] << 8) | body[2] : 0;
+        reply.push_back(STATUS_CMD_OK);
+        for (size_t i = 0; i < size; i++)
+        {
+            //EEPROM reads as erased, the flash tools never write it
+            unsigned int address = m_address + i;
+            bool flash = command == CMD_READ_FLASH_ISP && address < m_flash.size();
+            reply.push_back(flash ? m_flash[address] : 0xFF);
+        }
+        reply.push_back(STATUS_CMD_OK);
+        m_address += size;
+        if (command == CMD_READ_FLASH_ISP)
+        {
+            m_stats.pagesRead++;
+            m_stats.bytesRead += size;
+        }
+        break;
+    }
+    case CMD_READ_SIGNATURE_ISP:
+        reply.push_back(STATUS_CMD_OK);
+        reply.push_back(len >= 5 && body[4] < sizeof(AVR_SIGNATURE) ? AVR_SIGNATURE[body[4]] : 0);
+        reply.push_back(STATUS_CMD_OK);
+        break;
+    case CMD_READ_FUSE_ISP:
+    case CMD_READ_LOCK_ISP:
+        reply.push_back(STATUS_CMD_OK);
+        reply.push_back(len >= 4 ? fuse(body[2], body[3]) : 0);
+        reply.push_back(STATUS_CMD_OK);
+        break;
+    case CMD_SPI_MULTI:
+    {
+        //numTx, numRx, rxStartAddr, then the ISP instruction; avrdude
+        //uses it for the signature and fuses
+        if (len < 8)
+        {
+            reply.push_back(STATUS_CMD_FAILED);
+            break;
+        }
+        unsigned char value = 0;
+        if (body[4] == 0x30)
+            value = body[6] < sizeof(AVR_SIGNATURE) ? AVR_SIGNATURE[body[6]] : 0;
+        else
+            value = fuse(body[4], body[5]);
+        int numRx = body[2];
+        reply.push_back(STATUS_CMD_OK);
+        for (int i = 0; i < numRx; i++)
+            reply.push_back(i == numRx - 1 ? value : 0);
+        reply.push_back(STATUS_CMD_OK);
+        break;
+    }
+    case CMD_PROGRAM_EEPROM_ISP:
+        reply.push_back(STATUS_CMD_FAILED);
+        break;
+    default:
+        reply.push_back(STATUS_CMD_UNKNOWN);
+        break;
+    }
+    answer(sequence, reply);
+}
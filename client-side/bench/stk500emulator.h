@@ -0,0 +1,70 @@
+#ifndef STK500EMULATOR_H
+#define STK500EMULATOR_H
+
+#include "ptydevice.h"
+
+#include <mutex>
+#include <vector>
+
+struct Stk500EmulatorConfig
+{
+    Stk500EmulatorConfig();
+
+    //Line speed of the USB serial bridge, 0 runs at memory speed
+    int baudRate;
+    //Self timed page write of the ATmega2560, t_WD_FLASH
+    int pageWriteUs;
+    int flashSize;
+};
+
+struct Stk500EmulatorStats
+{
+    Stk500EmulatorStats();
+
+    int frames;
+    int checksumErrors;
+    int signOns;
+    int loadAddresses;
+    int pagesWritten;
+    int pagesRead;
+    long long bytesWritten;
+    long long bytesRead;
+    long long lineBytesIn;
+    long long lineBytesOut;
+};
+
+/**
+ * The STK500v2 wiring bootloader of an ATmega2560 (stk500boot.c, what
+ * "avrdude -cwiring -patmega2560" and Stk500v2Uploader talk to) on a
+ * pseudo-terminal. Keeps the whole flash in memory, paces the line at
+ * the configured baud rate and takes pageWriteUs for every page written.
+ * Answers the parameter, fuse, lock and SPI_MULTI queries avrdude sends
+ * during setup the way the real bootloader does. Qt free.
+ */
+class Stk500Emulator : public PtyDevice
+{
+public:
+    explicit Stk500Emulator(const Stk500EmulatorConfig &config = Stk500EmulatorConfig());
+    ~Stk500Emulator();
+
+    Stk500EmulatorStats stats() const;
+    std::vector<unsigned char> flash() const;
+    void setFlash(const std::vector<unsigned char> &flash);
+
+protected:
+    void received(const unsigned char *data, size_t len);
+
+private:
+    Stk500EmulatorConfig m_config;
+    std::vector<unsigned char> m_rx;
+    std::vector<unsigned char> m_flash;
+    unsigned int m_address;
+    Stk500EmulatorStats m_stats;
+    mutable std::mutex m_mutex;
+
+    void message(unsigned char sequence, const unsigned char *body, size_t len);
+    void answer(unsigned char sequence, const std::vector<unsigned char> &body);
+    unsigned char fuse(unsigned char high, unsigned char low) const;
+};
+
+#endif // STK500EMULATOR_H
@@ -0,0 +1,435 @@
+#include "catalog.h"
+
+#include <string.h>
+
+//More than any catalog element carries, the rest is ignored
+#define CATALOG_MAX_ATTRIBUTES 16
+
+struct Attribute
+{
+    const char *name;
+    int nameLength;
+    const char *value;
+    const char *valueEnd;
+};
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool isName(const char *name, int length, const char *literal)
+{
+    return (int)strlen(literal) == length && memcmp(name, literal, length) == 0;
+}
+
+static void trim(const char **begin, const char **end)
+{
+    while (*begin < *end && isSpace(**begin))
+        ++*begin;
+    while (*end > *begin && isSpace((*end)[-1]))
+        --*end;
+}
+
+static int scanAttributes(const char *p, const char *end, Attribute *attributes)
+{
+    int count = 0;
+    while (count < CATALOG_MAX_ATTRIBUTES) {
+        while (p < end && isSpace(*p))
+            ++p;
+        if (p >= end || *p == '/')
+            break;
+        Attribute &attribute = attributes[count];
+        attribute.name = p;
+        while (p < end && *p != '=' && !isSpace(*p))
+            ++p;
+        attribute.nameLength = p - attribute.name;
+        while (p < end && isSpace(*p))
+            ++p;
+        if (p >= end || *p != '=')
+            break;
+        ++p;
+        while (p < end && isSpace(*p))
+            ++p;
+        if (p >= end || (*p != '"' && *p != '\''))
+            break;
+        const char *valueEnd = (const char *)memchr(p + 1, *p, end - p - 1);
+        if (!valueEnd)
+            break;
+        attribute.value = p + 1;
+        attribute.valueEnd = valueEnd;
+        p = valueEnd + 1;
+        count++;
+    }
+    return count;
+}
+
+static const Attribute *findAttribute(const Attribute *attributes, int count, const char *name)
+{
+    for (int i = 0; i < count; i++) {
+        if (isName(attributes[i].name, attributes[i].nameLength, name))
+            return &attributes[i];
+    }
+    return 0;
+}
+
+static QByteArray decodeEntities(const char *begin, const char *end)
+{
+    QByteArray text;
+    text.reserve(end - begin);
+    for (const char *p = begin; p < end; ++p) {
+        const char *semicolon = *p == '&' ? (const char *)memchr(p, ';', end - p) : 0;
+        if (!semicolon) {
+            text.append(*p);
+            continue;
+        }
+        QByteArray entity(p + 1, semicolon - p - 1);
+        if (entity == "amp")
+            text.append('&');
+        else if (entity == "lt")
+            text.append('<');
+        else if (entity == "gt")
+            text.append('>');
+        else if (entity == "quot")
+            text.append('"');
+        else if (entity == "apos")
+            text.append('\'');
+        else if (entity.startsWith("#x"))
+            text.append(QString(QChar(entity.mid(2).toUInt(0, 16))).toUtf8());
+        else if (entity.startsWith('#'))
+            text.append(QString(QChar(entity.mid(1).toUInt())).toUtf8());
+        else
+            text.append(p, semicolon + 1 - p);
+        p = semicolon;
+    }
+    return text;
+}
+
+static QString attributeText(const Attribute *attribute)
+{
+    if (!attribute)
+        return QString();
+    const char *begin = attribute->value;
+    const char *end = attribute->valueEnd;
+    if (memchr(begin, '&', end - begin)) {
+        QByteArray text = decodeEntities(begin, end);
+        return QString::fromUtf8(text.constData(), text.size()).simplified();
+    }
+    return QString::fromUtf8(begin, end - begin).simplified();
+}
+
+static bool attributeFlag(const Attribute *attribute, bool defaultValue)
+{
+    return attribute ? attributeText(attribute).toInt() : defaultValue;
+}
+
+Catalog::Catalog()
+{
+}
+
+void Catalog::clear()
+{
+    m_settings = GlobalSettings();
+    m_boards.clear();
+    m_rcInputs.clear();
+    m_rcMappings.clear();
+    m_platforms.clear();
+    m_gpsTypes.clear();
+    m_gpsBauds.clear();
+    m_versions.clear();
+    m_atomIds.clear();
+    m_atoms.clear();
+    for (int i = 0; i < KindCount; i++)
+        m_byId[i].clear();
+    m_versionIndex.clear();
+    m_versionCache.clear();
+    m_errorString.clear();
+}
+
+int Catalog::intern(const char *begin, const char *end)
+{
+    trim(&begin, &end);
+    QByteArray decoded;
+    if (memchr(begin, '&', end - begin)) {
+        decoded = decodeEntities(begin, end);
+        begin = decoded.constData();
+        end = begin + decoded.size();
+    }
+
+    //Raw data lookup, the key is only copied for a new atom
+    QHash<QByteArray, int>::const_iterator it = m_atomIds.constFind(QByteArray::fromRawData(begin, end - begin));
+    if (it != m_atomIds.constEnd())
+        return it.value();
+    int atom = m_atoms.count();
+    m_atomIds.insert(QByteArray(begin, end - begin), atom);
+    m_atoms.append(QString::fromUtf8(begin, end - begin).simplified());
+    return atom;
+}
+
+int Catalog::atom(const QString &text) const
+{
+    return m_atomIds.value(text.toUtf8(), -1);
+}
+
+void Catalog::addId(Kind kind, int atom, int index)
+{
+    //The first one wins, like a linear search would
+    if (!m_byId[kind].contains(atom))
+        m_byId[kind].insert(atom, index);
+}
+
+bool Catalog::parse(const QByteArray &data)
+{
+    clear();
+
+    const char *p = data.constData();
+    const char *end = p + data.size();
+    while (p < end) {
+        const char *open = (const char *)memchr(p, '<', end - p);
+        if (!open)
+            break;
+        p = open + 1;
+
+        if (end - p >= 3 && memcmp(p, "!--", 3) == 0) {
+            const char *close = 0;
+            for (const char *dash = p + 3; dash + 3 <= end; ++dash) {
+                dash = (const char *)memchr(dash, '-', end - dash);
+                if (!dash || dash + 3 > end)
+                    break;
+                if (dash[1] == '-' && dash[2] == '>') {
+                    close = dash + 3;
+                    break;
+                }
+            }
+            if (!close) {
+                m_errorString = "Unterminated comment";
+                return false;
+            }
+            p = close;
+            continue;
+        }
+        if (p < end && (*p == '?' || *p == '!' || *p == '/')) {
+            const char *close = (const char *)memchr(p, '>', end - p);
+            if (!close) {
+                m_errorString = "Unterminated tag";
+                return false;
+            }
+            p = close + 1;
+            continue;
+        }
+
+        const char *name = p;
+        while (p < end && !isSpace(*p) && *p != '>' && *p != '/')
+            ++p;
+        const char *attributes = p;
+        char quote = 0;
+        while (p < end && (quote || *p != '>')) {
+            if (quote) {
+                if (*p == quote)
+                    quote = 0;
+            } else if (*p == '"' || *p == '\'') {
+                quote = *p;
+            }
+            ++p;
+        }
+        if (p >= end) {
+            m_errorString = "Unterminated element";
+            return false;
+        }
+        addElement(name, attributes - name, attributes, p);
+        ++p;
+    }
+
+    if (m_boards.isEmpty()) {
+        m_errorString = "No boards in the catalog";
+        return false;
+    }
+    return true;
+}
+
+void Catalog::addElement(const char *name, int nameLength, const char *attributes, const char *end)
+{
+    Attribute list[CATALOG_MAX_ATTRIBUTES];
+    int count = scanAttributes(attributes, end, list);
+    const Attribute *idAttribute = findAttribute(list, count, "id");
+    const Attribute *nameAttribute = findAttribute(list, count, "name");
+    int idAtom = idAttribute ? intern(idAttribute->value, idAttribute->valueEnd) : intern(end, end);
+
+    if (isName(name, nameLength, "board")) {
+        BoardType board;
+        board.id = m_atoms[idAtom];
+        board.name = attributeText(nameAttribute);
+        board.showInputs = attributeFlag(findAttribute(list, count, "showInputs"), true);
+        board.showGPS = attributeFlag(findAttribute(list, count, "showGPS"), true);
+        board.useBootloader = attributeFlag(findAttribute(list, count, "useBootloader"), false);
+        addId(Boards, idAtom, m_boards.count());
+        m_boards.append(board);
+    } else if (isName(name, nameLength, "rcinput")) {
+        RCInput input;
+        input.id = m_atoms[idAtom];
+        input.name = attributeText(nameAttribute);
+        addId(RCInputs, idAtom, m_rcInputs.count());
+        m_rcInputs.append(input);
+    } else if (isName(name, nameLength, "rcmapping")) {
+        RCInputMapping mapping;
+        mapping.id = m_atoms[idAtom];
+        mapping.name = attributeText(nameAttribute);
+        addId(RCMappings, idAtom, m_rcMappings.count());
+        m_rcMappings.append(mapping);
+    } else if (isName(name, nameLength, "platform")) {
+        const Attribute *versionAttribute = findAttribute(list, count, "version");
+        Platform platform;
+        platform.id = m_atoms[idAtom];
+        platform.name = attributeText(nameAttribute);
+        platform.image = attributeText(findAttribute(list, count, "image"));
+        platform.version = m_atoms[versionAttribute ? intern(versionAttribute->value, versionAttribute->valueEnd) : intern(end, end)];
+        addId(Platforms, idAtom, m_platforms.count());
+        m_platforms.append(platform);
+    } else if (isName(name, nameLength, "gpstype")) {
+        GpsType gpstype;
+        gpstype.id = m_atoms[idAtom];
+        gpstype.name = attributeText(nameAttribute);
+        addId(GpsTypes, idAtom, m_gpsTypes.count());
+        m_gpsTypes.append(gpstype);
+    } else if (isName(name, nameLength, "gpsbaud")) {
+        GpsBaudrate gpsbaud;
+        gpsbaud.id = m_atoms[idAtom];
+        gpsbaud.name = attributeText(nameAttribute);
+        addId(GpsBauds, idAtom, m_gpsBauds.count());
+        m_gpsBauds.append(gpsbaud);
+    } else if (isName(name, nameLength, "version")) {
+        const Attribute *platformAttribute = findAttribute(list, count, "platform");
+        const Attribute *boardsAttribute = findAttribute(list, count, "boards");
+        int index = m_versions.count();
+        int platformAtom = platformAttribute ? intern(platformAttribute->value, platformAttribute->valueEnd) : intern(end, end);
+        VersionIndex &versionIndex = m_versionIndex[platformAtom];
+
+        Version version;
+        version.id = m_atoms[idAtom];
+        version.number = attributeText(findAttribute(list, count, "number"));
+        version.platform = m_atoms[platformAtom];
+        const char *p = boardsAttribute ? boardsAttribute->value : end;
+        const char *boardsEnd = boardsAttribute ? boardsAttribute->valueEnd : end;
+        while (p < boardsEnd) {
+            const char *comma = (const char *)memchr(p, ',', boardsEnd - p);
+            if (!comma)
+                comma = boardsEnd;
+            int boardAtom = intern(p, comma);
+            if (!m_atoms[boardAtom].isEmpty()) {
+                version.boards<<m_atoms[boardAtom];
+                QVector<int> &boardVersions = versionIndex.byBoard[boardAtom];
+                if (boardVersions.isEmpty() || boardVersions.last() != index)
+                    boardVersions.append(index);
+            }
+            p = comma + 1;
+        }
+        if (version.boards.isEmpty())
+            versionIndex.generic.append(index);
+        addId(Versions, idAtom, index);
+        m_versions.append(version);
+    } else if (isName(name, nameLength, "settings")) {
+        m_settings.hexurl = attributeText(findAttribute(list, count, "hexurl"));
+        m_settings.flashToolVersion = attributeText(findAttribute(list, count, "flashToolVersion"));
+        m_settings.flashToolURL = attributeText(findAttribute(list, count, "flashToolURL"));
+    }
+}
+
+int Catalog::count(Kind kind) const
+{
+    switch (kind) {
+    case Boards: return m_boards.count();
+    case RCInputs: return m_rcInputs.count();
+    case RCMappings: return m_rcMappings.count();
+    case Platforms: return m_platforms.count();
+    case GpsTypes: return m_gpsTypes.count();
+    case GpsBauds: return m_gpsBauds.count();
+    case Versions: return m_versions.count();
+    default: return 0;
+    }
+}
+
+QString Catalog::id(Kind kind, int index) const
+{
+    switch (kind) {
+    case Boards: return board(index).id;
+    case RCInputs: return rcInput(index).id;
+    case RCMappings: return rcMapping(index).id;
+    case Platforms: return platform(index).id;
+    case GpsTypes: return gpsType(index).id;
+    case GpsBauds: return gpsBaud(index).id;
+    case Versions: return version(index).id;
+    default: return QString();
+    }
+}
+
+QString Catalog::name(Kind kind, int index) const
+{
+    switch (kind) {
+    case Boards: return board(index).name;
+    case RCInputs: return rcInput(index).name;
+    case RCMappings: return rcMapping(index).name;
+    case Platforms: return platform(index).name;
+    case GpsTypes: return gpsType(index).name;
+    case GpsBauds: return gpsBaud(index).name;
+    case Versions: return version(index).number;
+    default: return QString();
+    }
+}
+
+int Catalog::indexOf(Kind kind, const QString &id) const
+{
+    if (kind < 0 || kind >= KindCount)
+        return -1;
+    return m_byId[kind].value(atom(id), -1);
+}
+
+//Out of range gives an empty entry, like itemData() of a bad combo index
+template <typename T>
+static const T &entry(const QVector<T> &list, int index)
+{
+    static const T empty = T();
+    return index >= 0 && index < list.count() ? list.at(index) : empty;
+}
+
+const BoardType &Catalog::board(int index) const { return entry(m_boards, index); }
+const RCInput &Catalog::rcInput(int index) const { return entry(m_rcInputs, index); }
+const RCInputMapping &Catalog::rcMapping(int index) const { return entry(m_rcMappings, index); }
+const Platform &Catalog::platform(int index) const { return entry(m_platforms, index); }
+const GpsType &Catalog::gpsType(int index) const { return entry(m_gpsTypes, index); }
+const GpsBaudrate &Catalog::gpsBaud(int index) const { return entry(m_gpsBauds, index); }
+const Version &Catalog::version(int index) const { return entry(m_versions, index); }
+
+QVector<int> Catalog::versions(const QString &platformVersion, const QString &boardId) const
+{
+    QHash<int, VersionIndex>::const_iterator it = m_versionIndex.constFind(atom(platformVersion));
+    if (it == m_versionIndex.constEnd())
+        return QVector<int>();
+
+    int boardAtom = atom(boardId);
+    QHash<int, QVector<int> >::const_iterator specific = it->byBoard.constFind(boardAtom);
+    if (specific == it->byBoard.constEnd())
+        return it->generic;
+    if (it->generic.isEmpty())
+        return specific.value();
+
+    //Both kinds, merge them back into catalog order once
+    QPair<int, int> key(it.key(), boardAtom);
+    QHash<QPair<int, int>, QVector<int> >::const_iterator cached = m_versionCache.constFind(key);
+    if (cached != m_versionCache.constEnd())
+        return cached.value();
+
+    const QVector<int> &a = it->generic;
+    const QVector<int> &b = specific.value();
+    QVector<int> merged;
+    merged.reserve(a.count() + b.count());
+    int i = 0;
+    int j = 0;
+    while (i < a.count() || j < b.count()) {
+        if (j >= b.count() || (i < a.count() && a[i] < b[j]))
+            merged.append(a[i++]);
+        else
+            merged.append(b[j++]);
+    }
+    m_versionCache.insert(key, merged);
+    return merged;
+}
@@ -0,0 +1,153 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+struct BoardType
+{
+    BoardType() :
+        showInputs(true),
+        showGPS(true),
+        useBootloader(false)
+    {
+
+    }
+
+    QString id;
+    QString name;
+    bool showInputs;
+    bool showGPS;
+    bool useBootloader;
+};
+
+struct RCInput
+{
+    QString id;
+    QString name;
+};
+
+struct RCInputMapping
+{
+    QString id;
+    QString name;
+};
+
+struct Platform
+{
+    QString id;
+    QString name;
+    QString version;
+    QString image;
+};
+
+struct GpsType
+{
+    QString id;
+    QString name;
+};
+
+struct GpsBaudrate
+{
+    QString id;
+    QString name;
+};
+
+struct Version
+{
+    QString id;
+    QString platform;
+    QString number;
+    QStringList boards;
+};
+
+struct GlobalSettings
+{
+    QString hexurl;
+    QString flashToolVersion;
+    QString flashToolURL;
+};
+
+/**
+ * The firmware catalog (update.xml) in memory. parse() scans the text
+ * once with plain pointers: attributes are only looked at in place, ids
+ * are interned to small integers on the way, and only the values that
+ * are kept become QStrings. Versions are indexed by platform and board
+ * while parsing, so versions() costs O(results), not O(catalog).
+ */
+class Catalog
+{
+public:
+    enum Kind {
+        Boards,
+        RCInputs,
+        RCMappings,
+        Platforms,
+        GpsTypes,
+        GpsBauds,
+        Versions,
+        KindCount
+    };
+
+    Catalog();
+
+    bool parse(const QByteArray &data);
+    QString errorString() const { return m_errorString; }
+
+    const GlobalSettings &settings() const { return m_settings; }
+
+    int count(Kind kind) const;
+    QString id(Kind kind, int index) const;
+    QString name(Kind kind, int index) const;
+    int indexOf(Kind kind, const QString &id) const;
+
+    const BoardType &board(int index) const;
+    const RCInput &rcInput(int index) const;
+    const RCInputMapping &rcMapping(int index) const;
+    const Platform &platform(int index) const;
+    const GpsType &gpsType(int index) const;
+    const GpsBaudrate &gpsBaud(int index) const;
+    const Version &version(int index) const;
+
+    // Indexes of the versions for platformVersion that either list boardId
+    // or are not limited to any board, in catalog order
+    QVector<int> versions(const QString &platformVersion, const QString &boardId) const;
+
+private:
+    struct VersionIndex
+    {
+        QVector<int> generic;
+        QHash<int, QVector<int> > byBoard;
+    };
+
+    GlobalSettings m_settings;
+    QVector<BoardType> m_boards;
+    QVector<RCInput> m_rcInputs;
+    QVector<RCInputMapping> m_rcMappings;
+    QVector<Platform> m_platforms;
+    QVector<GpsType> m_gpsTypes;
+    QVector<GpsBaudrate> m_gpsBauds;
+    QVector<Version> m_versions;
+
+    // Interned strings, the atom number is the index into m_atoms
+    QHash<QByteArray, int> m_atomIds;
+    QVector<QString> m_atoms;
+    // Per kind: id atom -> index
+    QHash<int, int> m_byId[KindCount];
+    // Platform version atom -> versions
+    QHash<int, VersionIndex> m_versionIndex;
+    mutable QHash<QPair<int, int>, QVector<int> > m_versionCache;
+    QString m_errorString;
+
+    void clear();
+    int intern(const char *begin, const char *end);
+    int atom(const QString &text) const;
+    void addId(Kind kind, int atom, int index);
+    void addElement(const char *name, int nameLength, const char *attributes, const char *end);
+};
+
+#endif // CATALOG_H
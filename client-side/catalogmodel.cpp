@@ -0,0 +1,81 @@
+#include "catalogmodel.h"
+
+CatalogModel::CatalogModel(Catalog::Kind kind, QObject *parent) :
+    QAbstractListModel(parent),
+    m_catalog(0),
+    m_kind(kind),
+    m_filtered(false)
+{
+}
+
+void CatalogModel::setCatalog(const Catalog *catalog)
+{
+    beginResetModel();
+    m_catalog = catalog;
+    m_rows.clear();
+    m_filtered = false;
+    endResetModel();
+}
+
+void CatalogModel::setRows(const QVector<int> &rows)
+{
+    beginResetModel();
+    m_rows = rows;
+    m_filtered = true;
+    endResetModel();
+}
+
+void CatalogModel::setPlaceholder(const QString &placeholder)
+{
+    m_placeholder = placeholder;
+}
+
+int CatalogModel::itemAt(int row) const
+{
+    if (!m_catalog || row < 0)
+        return -1;
+    if (m_filtered)
+        return row < m_rows.count() ? m_rows[row] : -1;
+    return row < m_catalog->count(m_kind) ? row : -1;
+}
+
+int CatalogModel::rowOf(const QString &id) const
+{
+    if (!m_catalog)
+        return -1;
+    int index = m_catalog->indexOf(m_kind, id);
+    if (!m_filtered || index < 0)
+        return index;
+    return m_rows.indexOf(index);
+}
+
+bool CatalogModel::isEmpty() const
+{
+    if (!m_catalog)
+        return true;
+    return m_filtered ? m_rows.isEmpty() : m_catalog->count(m_kind) == 0;
+}
+
+int CatalogModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid() || !m_catalog)
+        return 0;
+    if (isEmpty())
+        return m_placeholder.isEmpty() ? 0 : 1;
+    return m_filtered ? m_rows.count() : m_catalog->count(m_kind);
+}
+
+QVariant CatalogModel::data(const QModelIndex &index, int role) const
+{
+    int item = itemAt(index.row());
+    if (item < 0) {
+        if (role == Qt::DisplayRole && isEmpty())
+            return m_placeholder;
+        return QVariant();
+    }
+    if (role == Qt::DisplayRole)
+        return m_catalog->name(m_kind, item);
+    if (role == Qt::UserRole)
+        return m_catalog->id(m_kind, item);
+    return QVariant();
+}
@@ -0,0 +1,42 @@
+#ifndef CATALOGMODEL_H
+#define CATALOGMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+
+#include "catalog.h"
+
+/**
+ * List model over one kind of Catalog entries, for the combo boxes to
+ * bind to directly: the display role is the name, Qt::UserRole the id.
+ * Shows the whole kind, or after setRows() only the given catalog
+ * indexes, e.g. the result of Catalog::versions(). An empty filtered
+ * list shows the placeholder text instead.
+ */
+class CatalogModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit CatalogModel(Catalog::Kind kind, QObject *parent = 0);
+
+    void setCatalog(const Catalog *catalog);
+    void setRows(const QVector<int> &rows);
+    void setPlaceholder(const QString &placeholder);
+
+    int itemAt(int row) const;
+    int rowOf(const QString &id) const;
+    bool isEmpty() const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+private:
+    const Catalog *m_catalog;
+    Catalog::Kind m_kind;
+    QVector<int> m_rows;
+    bool m_filtered;
+    QString m_placeholder;
+};
+
+#endif // CATALOGMODEL_H
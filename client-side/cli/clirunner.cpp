@@ -0,0 +1,287 @@
+#include "clirunner.h"
+#include "catalog.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+#include <cstdio>
+
+CliRunner::CliRunner(QObject *parent) :
+    QObject(parent),
+    m_out(stdout),
+    m_session(0),
+    m_scheduler(0),
+    m_downloader(0),
+    m_isF4BY(false)
+{
+}
+
+int CliRunner::start(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless MegaPirateNG FlashTool");
+    parser.addHelpOption();
+
+    QCommandLineOption boardOption("board", "Board id, e.g. crius2 or f4by.", "id");
+    QCommandLineOption rcinputOption("rcinput", "RC input id.", "id");
+    QCommandLineOption rcmappingOption("rcmapping", "RC mapping id.", "id");
+    QCommandLineOption platformOption("platform", "Platform id, e.g. copter-quad.", "id");
+    QCommandLineOption versionOption("version", "Firmware version id.", "id");
+    QCommandLineOption gpstypeOption("gpstype", "GPS type id.", "id");
+    QCommandLineOption gpsbaudOption("gpsbaud", "GPS baudrate id.", "id");
+    QCommandLineOption fileOption("file", "Flash a local firmware file (.hex or .px4) instead of requesting one.", "path");
+    QCommandLineOption portOption("port", "Serial port of the board, repeat or separate with commas to flash several boards at once.", "port");
+    QCommandLineOption windowOption("window", "F4BY program frames in flight, 1 disables pipelining.", "frames", "0");
+    QCommandLineOption handshakeOption("handshake", "F4BY session setup: conservative (fixed sleeps) or fast (event based).", "profile", "conservative");
+    QCommandLineOption jobsOption("jobs", "Number of boards flashed at the same time.", "count", "4");
+    QCommandLineOption sequentialOption("sequential", "Reboot and erase F4BY boards only after the firmware is downloaded.");
+    QCommandLineOption avrdudeOption("avrdude", "Flash AVR boards with the external avrdude instead of the built in STK500v2 programmer.");
+    QCommandLineOption fullFlashOption("full-flash", "Write and verify every page of AVR boards instead of only the changed ones.");
+    QCommandLineOption f4byOption("f4by", "Force the F4BY uploader.");
+    QCommandLineOption hexurlOption("hexurl", "Build server hex url, skips the catalog download.", "url");
+    QCommandLineOption catalogOption("catalog", "Catalog url to read the hex url from.", "url", FLASHTOOL_PATH_URI);
+    QCommandLineOption traceOption("trace", "Write a Chrome trace JSON of every session to this directory.", "directory");
+    QCommandLineOption cacheOption("cache-budget", "Size limit of the firmware cache in MiB.", "MiB", "256");
+    QCommandLineOption firmwaresOption("firmwares", "Local firmware directory.", "path", qApp->applicationDirPath() + "/firmwares/");
+
+    parser.addOption(boardOption);
+    parser.addOption(rcinputOption);
+    parser.addOption(rcmappingOption);
+    parser.addOption(platformOption);
+    parser.addOption(versionOption);
+    parser.addOption(gpstypeOption);
+    parser.addOption(gpsbaudOption);
+    parser.addOption(fileOption);
+    parser.addOption(portOption);
+    parser.addOption(jobsOption);
+    parser.addOption(windowOption);
+    parser.addOption(handshakeOption);
+    parser.addOption(f4byOption);
+    parser.addOption(sequentialOption);
+    parser.addOption(avrdudeOption);
+    parser.addOption(fullFlashOption);
+    parser.addOption(hexurlOption);
+    parser.addOption(catalogOption);
+    parser.addOption(firmwaresOption);
+    parser.addOption(cacheOption);
+    parser.addOption(traceOption);
+
+    if (!parser.parse(arguments)) {
+        printLine(QStringList() << "result" << QString::number(UsageError) << "usage" << parser.errorText());
+        return UsageError;
+    }
+    if (parser.isSet("help")) {
+        parser.showHelp(0);
+    }
+
+    m_file = parser.value(fileOption);
+    m_request.board = parser.value(boardOption);
+    m_request.rcinput = parser.value(rcinputOption);
+    m_request.rcmapping = parser.value(rcmappingOption);
+    m_request.platform = parser.value(platformOption);
+    m_request.version = parser.value(versionOption);
+    m_request.gpstype = parser.value(gpstypeOption);
+    m_request.gpsbaud = parser.value(gpsbaudOption);
+
+    if (m_file.isEmpty()) {
+        QStringList missing;
+        if (m_request.board.isEmpty()) missing << "--board";
+        if (m_request.rcinput.isEmpty()) missing << "--rcinput";
+        if (m_request.rcmapping.isEmpty()) missing << "--rcmapping";
+        if (m_request.platform.isEmpty()) missing << "--platform";
+        if (m_request.version.isEmpty()) missing << "--version";
+        if (m_request.gpstype.isEmpty()) missing << "--gpstype";
+        if (m_request.gpsbaud.isEmpty()) missing << "--gpsbaud";
+        if (!missing.isEmpty()) {
+            printLine(QStringList() << "result" << QString::number(UsageError) << "usage" << "missing " + missing.join(" "));
+            return UsageError;
+        }
+    }
+
+    QString handshake = parser.value(handshakeOption);
+    if (handshake != "conservative" && handshake != "fast") {
+        printLine(QStringList() << "result" << QString::number(UsageError) << "usage" << "unknown --handshake " + handshake);
+        return UsageError;
+    }
+    bool fastHandshake = (handshake == "fast");
+
+    foreach (QString port, parser.values(portOption)) {
+        m_ports << port.split(',', QString::SkipEmptyParts);
+    }
+
+    m_isF4BY = parser.isSet(f4byOption) || m_request.board == "f4by" || m_file.endsWith(".px4", Qt::CaseInsensitive);
+    if (!m_isF4BY && m_ports.isEmpty()) {
+        printLine(QStringList() << "result" << QString::number(UsageError) << "usage" << "missing --port");
+        return UsageError;
+    }
+
+    QString firmwareDirectory = QDir::fromNativeSeparators(parser.value(firmwaresOption));
+    if (!firmwareDirectory.endsWith('/')) {
+        firmwareDirectory.append('/');
+    }
+    QDir().mkpath(firmwareDirectory);
+
+    m_session = new FlashSession(this);
+    m_session->setFirmwareDirectory(firmwareDirectory);
+    m_session->setCacheBudget(parser.value(cacheOption).toLongLong() * 1024 * 1024);
+    m_session->setPortName(m_ports.value(0));
+    m_session->setF4BY(m_isF4BY);
+    m_session->setProgWindow(parser.value(windowOption).toInt());
+    m_session->setFastHandshake(fastHandshake);
+    m_session->setUseAvrdude(parser.isSet(avrdudeOption));
+    m_session->setDifferentialFlash(!parser.isSet(fullFlashOption));
+    m_session->setPipelined(!parser.isSet(sequentialOption));
+    m_session->setTraceDirectory(parser.value(traceOption));
+
+    connect(m_session, SIGNAL(statusUpdate(QString)), this, SLOT(sessionStatus(QString)));
+    connect(m_session, SIGNAL(progress(qint64,qint64)), this, SLOT(sessionProgress(qint64,qint64)));
+    connect(m_session, SIGNAL(requestDevicePlug()), this, SLOT(sessionRequestDevicePlug()));
+    connect(m_session, SIGNAL(finished(int,QString)), this, SLOT(sessionFinished(int,QString)));
+
+    if (m_ports.count() > 1) {
+        m_scheduler = new FlashScheduler(this);
+        m_scheduler->setMaxConcurrent(parser.value(jobsOption).toInt());
+        m_scheduler->setProgWindow(parser.value(windowOption).toInt());
+        m_scheduler->setFastHandshake(fastHandshake);
+        m_scheduler->setUseAvrdude(parser.isSet(avrdudeOption));
+        m_scheduler->setDifferentialFlash(!parser.isSet(fullFlashOption));
+        m_scheduler->setTraceDirectory(parser.value(traceOption));
+
+        connect(m_session, SIGNAL(firmwareReady(QString)), this, SLOT(firmwareReady(QString)));
+        connect(m_scheduler, SIGNAL(jobStatus(QString,QString)), this, SLOT(jobStatus(QString,QString)));
+        connect(m_scheduler, SIGNAL(jobProgress(QString,qint64,qint64)), this, SLOT(jobProgress(QString,qint64,qint64)));
+        connect(m_scheduler, SIGNAL(jobFinished(QString,int,QString)), this, SLOT(jobFinished(QString,int,QString)));
+        connect(m_scheduler, SIGNAL(allFinished()), this, SLOT(schedulerFinished()));
+    }
+
+    if (!m_file.isEmpty() || parser.isSet(hexurlOption)) {
+        m_session->setHexUrl(parser.value(hexurlOption));
+        //A bad file fails at once, the exit must happen inside exec()
+        QTimer::singleShot(0, this, SLOT(startSession()));
+        return 0;
+    }
+
+    //Only the hex url is needed from the catalog
+    sessionStatus("Requesting catalog " + parser.value(catalogOption));
+    m_downloader = new Downloader(this);
+    connect(m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(catalogDownloaded(DownloadsList)));
+    m_downloader->startDownloads(Download(parser.value(catalogOption)));
+    return 0;
+}
+
+void CliRunner::catalogDownloaded(DownloadsList downloads)
+{
+    Download download = downloads[0];
+
+    QFile file(download.tmpFile);
+    file.open(QIODevice::ReadOnly | QIODevice::Text);
+    Catalog catalog;
+    catalog.parse(file.readAll());
+    QString hexurl = catalog.settings().hexurl;
+    file.close();
+    file.remove();
+
+    if (!download.success || hexurl.isEmpty()) {
+        exitWith(FlashSession::RequestFailed, "Failed to download firmware informations.");
+        return;
+    }
+
+    m_session->setHexUrl(hexurl);
+    startSession();
+}
+
+void CliRunner::startSession()
+{
+    if (m_scheduler && !m_file.isEmpty()) {
+        firmwareReady(m_file);
+    } else if (m_scheduler) {
+        sessionStatus(QString("Requesting firmware %1 (%2) ...").arg(m_request.platform).arg(m_request.version));
+        m_session->fetch(m_request);
+    } else if (!m_file.isEmpty()) {
+        sessionStatus("Flashing " + QFileInfo(m_file).absoluteFilePath());
+        m_session->flashFile(m_file);
+    } else {
+        sessionStatus(QString("Requesting firmware %1 (%2) ...").arg(m_request.platform).arg(m_request.version));
+        m_session->start(m_request);
+    }
+}
+
+void CliRunner::firmwareReady(QString filename)
+{
+    sessionStatus(QString("Flashing %1 on %2 ports, %3 at a time").arg(QFileInfo(filename).absoluteFilePath()).arg(m_ports.count()).arg(m_scheduler->maxConcurrent()));
+    foreach (QString port, m_ports) {
+        m_scheduler->addJob(port, filename, m_isF4BY);
+    }
+    m_scheduler->start();
+}
+
+void CliRunner::jobStatus(QString portName, QString status)
+{
+    printLine(QStringList() << "port" << portName << "status" << status);
+}
+
+void CliRunner::jobProgress(QString portName, qint64 current, qint64 total)
+{
+    printLine(QStringList() << "port" << portName << "progress" << QString::number(current) << QString::number(total));
+}
+
+void CliRunner::jobFinished(QString portName, int result, QString message)
+{
+    printLine(QStringList() << "port" << portName << "result" << QString::number(result) << FlashSession::resultName(result) << message);
+}
+
+void CliRunner::schedulerFinished()
+{
+    FlashSummary summary = m_scheduler->summary();
+    printLine(QStringList() << "summary"
+              << QString::number(summary.total)
+              << QString::number(summary.succeeded)
+              << QString::number(summary.failed)
+              << QString::number(summary.elapsed / 1000.0, 'f', 1)
+              << QString::number(summary.boardsPerHour(), 'f', 1));
+
+    int result = summary.failed == 0 ? FlashSession::Success : FlashSession::FlashFailed;
+    exitWith(result, QString("%1 of %2 boards flashed").arg(summary.succeeded).arg(summary.total));
+}
+
+void CliRunner::sessionStatus(QString status)
+{
+    printLine(QStringList() << "status" << status);
+}
+
+void CliRunner::sessionProgress(qint64 current, qint64 total)
+{
+    printLine(QStringList() << "progress" << QString::number(current) << QString::number(total));
+}
+
+void CliRunner::sessionRequestDevicePlug()
+{
+    printLine(QStringList() << "status" << "Please unplug, and plug back in the F4BY");
+}
+
+void CliRunner::sessionFinished(int result, QString message)
+{
+    //A successful fetch continues in firmwareReady()
+    if (m_scheduler && result == FlashSession::Success)
+        return;
+    exitWith(result, message);
+}
+
+void CliRunner::printLine(const QStringList &fields)
+{
+    QStringList escaped;
+    foreach (QString field, fields) {
+        escaped << field.simplified();
+    }
+    m_out << escaped.join("\t") << "\n";
+    m_out.flush();
+}
+
+void CliRunner::exitWith(int result, const QString &message)
+{
+    printLine(QStringList() << "result" << QString::number(result) << FlashSession::resultName(result) << message);
+    QCoreApplication::exit(result);
+}
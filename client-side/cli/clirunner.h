@@ -0,0 +1,62 @@
+#ifndef CLIRUNNER_H
+#define CLIRUNNER_H
+
+#include <QObject>
+#include <QTextStream>
+
+#include "flashsession.h"
+#include "flashscheduler.h"
+
+/**
+ * Drives one FlashSession from command line options and reports every
+ * event as a tab separated line on stdout:
+ *
+ *   status<TAB>text
+ *   progress<TAB>current<TAB>total
+ *   result<TAB>code<TAB>name<TAB>message
+ *
+ * The process exit code equals the FlashSession::Result code.
+ * With more than one --port every board gets its own session through a
+ * FlashScheduler, per board lines are prefixed with "port<TAB>name" and
+ * a final "summary" line reports the station throughput.
+ */
+class CliRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum {
+        UsageError = 1
+    };
+
+    explicit CliRunner(QObject *parent = 0);
+    int start(const QStringList &arguments);
+
+private slots:
+    void catalogDownloaded(DownloadsList downloads);
+    void sessionStatus(QString status);
+    void sessionProgress(qint64 current, qint64 total);
+    void sessionRequestDevicePlug();
+    void sessionFinished(int result, QString message);
+    void firmwareReady(QString filename);
+    void jobStatus(QString portName, QString status);
+    void jobProgress(QString portName, qint64 current, qint64 total);
+    void jobFinished(QString portName, int result, QString message);
+    void schedulerFinished();
+    void startSession();
+
+private:
+    QTextStream m_out;
+    FlashSession *m_session;
+    FlashScheduler *m_scheduler;
+    Downloader *m_downloader;
+    FirmwareRequest m_request;
+    QString m_file;
+    QStringList m_ports;
+    bool m_isF4BY;
+
+    void printLine(const QStringList &fields);
+    void exitWith(int result, const QString &message);
+};
+
+#endif // CLIRUNNER_H
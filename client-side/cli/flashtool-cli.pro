@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Headless command line FlashTool, no widgets involved
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = flashtool-cli
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../flashcore.pri)
+
+SOURCES += main.cpp \
+    clirunner.cpp
+
+HEADERS += clirunner.h
@@ -0,0 +1,20 @@
+#include <QCoreApplication>
+
+#include "clirunner.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setOrganizationName("MegaPirateNG");
+    a.setOrganizationDomain("megapirateng.com");
+    a.setApplicationName("FlashTool");
+    a.setApplicationVersion(FLASHTOOL_VERSION);
+
+    CliRunner runner;
+    int ret = runner.start(a.arguments());
+    if (ret != 0) {
+        return ret;
+    }
+
+    return a.exec();
+}
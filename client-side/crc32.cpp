@@ -0,0 +1,337 @@
+#include "crc32.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_PCLMUL
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#define CRC32_ARMV8
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#define CRC32_POLY 0xEDB88320u
+
+//PCLMUL folds 64 byte blocks, shorter input is not worth the setup
+#define CRC32_PCLMUL_MINIMUM 64
+
+typedef uint32_t (*Crc32Kernel)(uint32_t crc, const unsigned char *buf, size_t len);
+
+static uint32_t crcTable[8][256];
+static uint32_t x2nTable[32];
+
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    //a * b modulo the polynomial, both reflected
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+    return p;
+}
+
+static uint32_t x2nmodp(uint64_t n, unsigned k)
+{
+    //x^(n * 2^k) modulo the polynomial
+    uint32_t p = 1u << 31;
+    while (n)
+    {
+        if (n & 1)
+            p = multmodp(x2nTable[k & 31], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static uint32_t shiftBytes(uint32_t crc, uint64_t bytes)
+{
+    //crc of the same data followed by bytes zero bytes
+    return multmodp(x2nmodp(bytes, 3), crc);
+}
+
+static inline uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t bytewise(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    while (len--)
+        crc = crcTable[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static uint32_t slice8(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    while (len >= 8)
+    {
+        uint32_t lo = crc ^ load32(buf);
+        uint32_t hi = load32(buf + 4);
+        crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff]
+            ^ crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24]
+            ^ crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff]
+            ^ crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    return bytewise(crc, buf, len);
+}
+
+#ifdef CRC32_PCLMUL
+/*
+ * Folding with carry-less multiplication as in Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction",
+ * constants for the bit reflected 0x04C11DB7 polynomial. len must be a
+ * multiple of 16 and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t pclmulFold(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ull, 0x01c6e41596ull };
+    static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ull, 0x00ccaa009eull };
+    static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ull, 0x0000000000ull };
+    static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641ull, 0x01f7011641ull };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+    buf += 64;
+    len -= 64;
+
+    //Four lanes of 128 bit in parallel
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        len -= 64;
+    }
+
+    //Fold the lanes into one
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    //128 to 64 bit
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    //Barrett reduction to 32 bit
+    x0 = _mm_load_si128((const __m128i *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t hardware(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    if (len >= CRC32_PCLMUL_MINIMUM)
+    {
+        size_t blocks = len & ~(size_t)15;
+        crc = pclmulFold(crc, buf, blocks);
+        buf += blocks;
+        len -= blocks;
+    }
+    return slice8(crc, buf, len);
+}
+
+static bool detectHardware()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+static const char *hardwareName = "pclmul";
+#elif defined(CRC32_ARMV8)
+__attribute__((target("+crc")))
+static uint32_t hardware(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    while (len >= 8)
+    {
+        uint64_t word = (uint64_t)load32(buf) | ((uint64_t)load32(buf + 4) << 32);
+        crc = __crc32d(crc, word);
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = __crc32b(crc, *buf++);
+    return crc;
+}
+
+static bool detectHardware()
+{
+#if defined(__APPLE__)
+    return true;
+#elif defined(__linux__) && defined(HWCAP_CRC32)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+static const char *hardwareName = "armv8-crc";
+#else
+static uint32_t hardware(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    return slice8(crc, buf, len);
+}
+
+static bool detectHardware()
+{
+    return false;
+}
+
+static const char *hardwareName = "slice8";
+#endif
+
+static Crc32Kernel selectedKernel = slice8;
+static bool hasHardware = false;
+
+static struct Crc32Init
+{
+    Crc32Init()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+            crcTable[0][n] = c;
+        }
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = crcTable[0][n];
+            for (int k = 1; k < 8; k++)
+            {
+                c = crcTable[0][c & 0xff] ^ (c >> 8);
+                crcTable[k][n] = c;
+            }
+        }
+
+        //x^1, then repeated squaring
+        uint32_t p = 1u << 30;
+        x2nTable[0] = p;
+        for (int n = 1; n < 32; n++)
+            x2nTable[n] = p = multmodp(p, p);
+
+        hasHardware = detectHardware();
+        selectedKernel = hasHardware ? hardware : slice8;
+    }
+} crc32Init;
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len)
+{
+    return selectedKernel(crc, (const unsigned char *)data, len);
+}
+
+uint32_t crc32Fill(uint32_t crc, unsigned char byte, uint64_t count)
+{
+    //crc(A || B) = shift(crc(A), |B|) ^ crc(0, B), so the CRC of the run
+    //itself is built by doubling along the bits of count
+    uint32_t run = 0;
+    uint64_t runLength = 0;
+    for (int bit = 63; bit >= 0; bit--)
+    {
+        if (runLength)
+        {
+            run = shiftBytes(run, runLength) ^ run;
+            runLength *= 2;
+        }
+        if ((count >> bit) & 1)
+        {
+            run = crcTable[0][(run ^ byte) & 0xff] ^ (run >> 8);
+            runLength++;
+        }
+    }
+    return shiftBytes(crc, count) ^ run;
+}
+
+uint32_t crc32Bytewise(uint32_t crc, const void *data, size_t len)
+{
+    return bytewise(crc, (const unsigned char *)data, len);
+}
+
+uint32_t crc32Slice8(uint32_t crc, const void *data, size_t len)
+{
+    return slice8(crc, (const unsigned char *)data, len);
+}
+
+uint32_t crc32Hardware(uint32_t crc, const void *data, size_t len)
+{
+    if (!hasHardware)
+        return slice8(crc, (const unsigned char *)data, len);
+    return hardware(crc, (const unsigned char *)data, len);
+}
+
+bool crc32HasHardware()
+{
+    return hasHardware;
+}
+
+const char *crc32KernelName()
+{
+    return hasHardware ? hardwareName : "slice8";
+}
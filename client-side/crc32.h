@@ -0,0 +1,28 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * CRC32 as the PX4 bootloader computes it: reflected polynomial 0xEDB88320,
+ * initial value 0 and no final xor. crc32Update() can be fed in pieces, so
+ * the uploader folds every chunk in while it is being sent. The fastest
+ * kernel the CPU supports is picked on first use: PCLMULQDQ folding on x86,
+ * the ARMv8 CRC32 instructions on aarch64, slicing-by-8 everywhere else.
+ * Qt free, so the benchmarks build without it.
+ */
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len);
+
+// CRC of count times byte appended, in O(log(count)) instead of O(count)
+uint32_t crc32Fill(uint32_t crc, unsigned char byte, uint64_t count);
+
+// Single kernels, for the benchmarks
+uint32_t crc32Bytewise(uint32_t crc, const void *data, size_t len);
+uint32_t crc32Slice8(uint32_t crc, const void *data, size_t len);
+uint32_t crc32Hardware(uint32_t crc, const void *data, size_t len);
+bool crc32HasHardware();
+const char *crc32KernelName();
+
+#endif // CRC32_H
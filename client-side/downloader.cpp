@@ -0,0 +1,275 @@
+#include "downloader.h"
+
+#include <QDir>
+#include <QFile>
+#include <QThreadStorage>
+#include <QUuid>
+
+//Qt itself opens at most six connections per host
+#define DOWNLOAD_MAX_CONCURRENT 6
+#define DOWNLOAD_TIMEOUT 30000
+
+Downloader::Downloader(QObject *parent) :
+    QObject(parent),
+    m_nextIndex(0),
+    m_pending(0),
+    m_finishedBytes(0),
+    m_maxConcurrent(DOWNLOAD_MAX_CONCURRENT),
+    m_aborted(false)
+{
+}
+
+Downloader::~Downloader()
+{
+    abort();
+}
+
+QNetworkAccessManager *Downloader::networkManager()
+{
+    //One manager per thread, so all downloads share its connection pool
+    static QThreadStorage<QNetworkAccessManager *> managers;
+    if (!managers.hasLocalData())
+        managers.setLocalData(new QNetworkAccessManager);
+    return managers.localData();
+}
+
+void Downloader::setMaxConcurrent(int maxConcurrent)
+{
+    this->m_maxConcurrent = qMax(1, maxConcurrent);
+}
+
+void Downloader::startDownloads(Download download)
+{
+    DownloadsList downloads;
+    downloads<<download;
+    startDownloads(downloads);
+}
+
+void Downloader::startDownloads(DownloadsList downloads)
+{
+    abort();
+    this->m_aborted = false;
+    this->m_downloads = downloads;
+    this->m_nextIndex = 0;
+    this->m_pending = downloads.count();
+    this->m_finishedBytes = 0;
+    startNext();
+}
+
+bool Downloader::isRunning() const
+{
+    return !this->m_transfers.isEmpty();
+}
+
+void Downloader::startNext()
+{
+    while (this->m_nextIndex < this->m_downloads.count() && this->m_transfers.count() < this->m_maxConcurrent) {
+        Transfer transfer;
+        transfer.index = this->m_nextIndex++;
+        transfer.reply = 0;
+        transfer.tmpFile = 0;
+        transfer.timeout = new QTimer(this);
+        transfer.timeout->setSingleShot(true);
+        transfer.bytesReceived = 0;
+        transfer.bytesTotal = 0;
+        connect(transfer.timeout, SIGNAL(timeout()), this, SLOT(networkReplyTimedOut()));
+        this->m_transfers.append(transfer);
+        doUrlDownload(this->m_transfers.last(), this->m_downloads[transfer.index].uri);
+    }
+}
+
+void Downloader::doUrlDownload(Transfer &transfer, const QString &uri)
+{
+    const Download &download = this->m_downloads[transfer.index];
+    QString userAgent = "FlashTool ";
+    userAgent.append(FLASHTOOL_VERSION);
+    QNetworkRequest request;
+    request.setUrl(uri);
+    request.setRawHeader("User-Agent", userAgent.toLatin1());
+    if (download.etag.isEmpty() && download.lastModified.isEmpty()) {
+        request.setRawHeader("Cache-Control", "no-cache");
+    } else {
+        //The server answers 304 without a body if the copy is current
+        if (!download.etag.isEmpty()) {
+            request.setRawHeader("If-None-Match", download.etag.toLatin1());
+        }
+        if (!download.lastModified.isEmpty()) {
+            request.setRawHeader("If-Modified-Since", download.lastModified.toLatin1());
+        }
+    }
+    request.setRawHeader("Content-Type", "text/xml");
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0) && QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+    //Default from Qt 6 on, only used where the server offers it
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+
+    closeTmpFile(transfer, true);
+    if (!download.streamed) {
+        transfer.tmpFile = new QFile(QDir::tempPath() + "/flashTool." + QUuid::createUuid().toString());
+        transfer.tmpFile->open(QIODevice::ReadWrite);
+    }
+    transfer.bytesReceived = 0;
+    transfer.bytesTotal = 0;
+
+    emit downloadStarted(transfer.index);
+    if (download.body.isEmpty()) {
+        transfer.reply = networkManager()->get(request);
+    } else {
+        transfer.reply = networkManager()->post(request, download.body.toLatin1());
+    }
+    transfer.timeout->start(DOWNLOAD_TIMEOUT);
+    connect(transfer.reply, SIGNAL(finished()), this, SLOT(networkReplyFinished()));
+    connect(transfer.reply, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(networkReplyDownloadProgress(qint64,qint64)));
+    connect(transfer.reply, SIGNAL(readyRead()), this, SLOT(networkReplyReadyRead()));
+}
+
+int Downloader::transferFor(QObject *object) const
+{
+    for (int i = 0; i < this->m_transfers.count(); i++) {
+        if (this->m_transfers[i].reply == object || this->m_transfers[i].timeout == object) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void Downloader::closeTmpFile(Transfer &transfer, bool remove)
+{
+    if (!transfer.tmpFile) {
+        return;
+    }
+    transfer.tmpFile->close();
+    if (remove) {
+        transfer.tmpFile->remove();
+    }
+    delete transfer.tmpFile;
+    transfer.tmpFile = 0;
+}
+
+void Downloader::abort()
+{
+    this->m_aborted = true;
+    //abort() emits finished() synchronously, the slot ignores it by now
+    QList<Transfer> transfers = this->m_transfers;
+    this->m_transfers.clear();
+    for (int i = 0; i < transfers.count(); i++) {
+        transfers[i].timeout->stop();
+        transfers[i].timeout->deleteLater();
+        if (transfers[i].reply) {
+            transfers[i].reply->disconnect(this);
+            transfers[i].reply->abort();
+            transfers[i].reply->deleteLater();
+        }
+        closeTmpFile(transfers[i], true);
+    }
+}
+
+void Downloader::networkReplyTimedOut()
+{
+    int i = transferFor(sender());
+    if (i < 0) {
+        return;
+    }
+    abort();
+    emit timedOut();
+}
+
+void Downloader::networkReplyReadyRead()
+{
+    int i = transferFor(sender());
+    if (i < 0 || this->m_aborted) {
+        return;
+    }
+    Transfer &transfer = this->m_transfers[i];
+    QByteArray data = transfer.reply->readAll();
+
+    //Redirect bodies are never the payload, error pages only for the
+    //callers that read the server's error message from tmpFile
+    int status = transfer.reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if ((status >= 300 && status < 400) || data.isEmpty()) {
+        return;
+    }
+    if (this->m_downloads[transfer.index].streamed) {
+        if (status < 400) {
+            emit dataReceived(transfer.index, data);
+        }
+    } else if (transfer.tmpFile) {
+        transfer.tmpFile->write(data);
+    }
+}
+
+void Downloader::networkReplyFinished()
+{
+    QNetworkReply *networkReply = qobject_cast<QNetworkReply *>(sender());
+    int i = transferFor(networkReply);
+    if (i < 0 || this->m_aborted) {
+        return;
+    }
+    networkReply->deleteLater();
+    //Drain what is left, readyRead() is not guaranteed for the last bytes
+    networkReplyReadyRead();
+    if (this->m_aborted) {
+        return;
+    }
+    Transfer &transfer = this->m_transfers[i];
+    transfer.reply = 0;
+
+    QVariant possibleRedirectUrl = networkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
+    QString redirectUrl = possibleRedirectUrl.toUrl().toString();
+    if (!redirectUrl.isEmpty()) {
+        doUrlDownload(transfer, redirectUrl);
+        return;
+    }
+
+    Download &download = this->m_downloads[transfer.index];
+    if (transfer.tmpFile) {
+        download.tmpFile = transfer.tmpFile->fileName();
+        closeTmpFile(transfer, false);
+    }
+    download.success = (networkReply->error() == QNetworkReply::NoError);
+    download.notModified = (networkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304);
+    if (download.success && !download.notModified) {
+        download.etag = QString::fromLatin1(networkReply->rawHeader("ETag"));
+        download.lastModified = QString::fromLatin1(networkReply->rawHeader("Last-Modified"));
+    }
+    this->m_finishedBytes += transfer.bytesReceived;
+    transfer.timeout->stop();
+    transfer.timeout->deleteLater();
+    this->m_transfers.removeAt(i);
+    this->m_pending--;
+
+    if (this->m_pending > 0) {
+        startNext();
+    } else {
+        emit downloadsFinished(this->m_downloads);
+    }
+}
+
+void Downloader::networkReplyDownloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+    int i = transferFor(sender());
+    if (i < 0) {
+        return;
+    }
+    Transfer &transfer = this->m_transfers[i];
+    transfer.bytesReceived = bytesReceived;
+    transfer.bytesTotal = bytesTotal;
+    transfer.timeout->start(DOWNLOAD_TIMEOUT);
+    emitProgress();
+}
+
+void Downloader::emitProgress()
+{
+    //Unknown sizes count as what arrived so far, the total grows with them
+    qint64 received = this->m_finishedBytes;
+    qint64 total = this->m_finishedBytes;
+    for (int i = 0; i < this->m_transfers.count(); i++) {
+        received += this->m_transfers[i].bytesReceived;
+        if (this->m_transfers[i].bytesTotal > 0) {
+            total += this->m_transfers[i].bytesTotal;
+        } else {
+            total += this->m_transfers[i].bytesReceived;
+        }
+    }
+    emit downloadProgress(received, total);
+}
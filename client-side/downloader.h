@@ -0,0 +1,117 @@
+#ifndef DOWNLOADER_H
+#define DOWNLOADER_H
+
+#include <QObject>
+#include <QList>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+
+class QFile;
+
+struct Download
+{
+    QString uri;
+    QString body;
+    QString tmpFile;
+    int tries;
+    bool success;
+    //Hand the body to dataReceived() instead of storing it in tmpFile
+    bool streamed;
+    //Validators of a copy the caller has, the server's new ones after
+    //the download; notModified means the copy is still current
+    QString etag;
+    QString lastModified;
+    bool notModified;
+
+    Download(QString uri)
+    {
+        this->uri = uri;
+        this->tries = 0;
+        this->success = false;
+        this->streamed = false;
+        this->notModified = false;
+    }
+
+    Download(QString uri, QString body)
+    {
+        this->uri = uri;
+        this->body = body;
+        this->tries = 0;
+        this->success = false;
+        this->streamed = false;
+        this->notModified = false;
+    }
+};
+typedef QList<Download> DownloadsList;
+
+/**
+ * Widget free download engine. Runs all requests of a DownloadsList at
+ * once, up to maxConcurrent(), over the keep-alive (or HTTP/2) connections
+ * of one QNetworkAccessManager shared by every Downloader of a thread.
+ * Every reply is written to a temporary file while it arrives, see
+ * Download::tmpFile. Streamed downloads are passed chunk by chunk to
+ * dataReceived() instead; error pages and redirect bodies are never passed
+ * on. Each request has its own 30 s watchdog, downloadProgress() reports
+ * the sum over the whole list and downloadsFinished() is emitted once
+ * every request is done, with the list in its original order. Requests
+ * with an etag or lastModified are sent as conditional GETs.
+ */
+class Downloader : public QObject
+{
+    Q_OBJECT
+
+signals:
+    void downloadsFinished(DownloadsList downloads);
+    void downloadStarted(int index);
+    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void timedOut();
+    void dataReceived(int index, QByteArray data);
+
+public:
+    explicit Downloader(QObject *parent = 0);
+    ~Downloader();
+    void startDownloads(DownloadsList downloads);
+    void startDownloads(Download download);
+    void abort();
+    bool isRunning() const;
+
+    void setMaxConcurrent(int maxConcurrent);
+    int maxConcurrent() const { return m_maxConcurrent; }
+
+    static QNetworkAccessManager *networkManager();
+
+private slots:
+    void networkReplyFinished();
+    void networkReplyDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void networkReplyTimedOut();
+    void networkReplyReadyRead();
+
+private:
+    struct Transfer
+    {
+        int index;
+        QNetworkReply *reply;
+        QFile *tmpFile;
+        QTimer *timeout;
+        qint64 bytesReceived;
+        qint64 bytesTotal;
+    };
+
+    DownloadsList m_downloads;
+    QList<Transfer> m_transfers;
+    int m_nextIndex;
+    int m_pending;
+    qint64 m_finishedBytes;
+    int m_maxConcurrent;
+    bool m_aborted;
+
+    void startNext();
+    void doUrlDownload(Transfer &transfer, const QString &uri);
+    int transferFor(QObject *object) const;
+    void closeTmpFile(Transfer &transfer, bool remove);
+    void emitProgress();
+};
+
+#endif // DOWNLOADER_H
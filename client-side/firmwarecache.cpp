@@ -0,0 +1,255 @@
+#include "firmwarecache.h"
+#include "firmwarestream.h"
+#include "intelhex.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStringList>
+#include <QTextStream>
+
+#define CACHE_INDEX "index.txt"
+#define CACHE_LOCK "cache.lock"
+#define CACHE_DEFAULT_BUDGET (256 * 1024 * 1024)
+//Other stations hold the lock only for an index update
+#define CACHE_LOCK_TIMEOUT 10000
+#define CACHE_LOCK_STALE 30000
+
+FirmwareCache::FirmwareCache(const QString &directory) :
+    m_directory(directory),
+    m_byteBudget(CACHE_DEFAULT_BUDGET)
+{
+    if (!m_directory.isEmpty() && !m_directory.endsWith('/'))
+        m_directory.append('/');
+    QDir().mkpath(m_directory);
+}
+
+void FirmwareCache::setByteBudget(qint64 bytes)
+{
+    m_byteBudget = bytes;
+}
+
+bool FirmwareCache::validKey(const QString &key)
+{
+    //The key becomes a file name, it comes from the server
+    return !key.isEmpty() && !key.contains('/') && !key.contains('\\') && !key.startsWith('.');
+}
+
+FirmwareCache::Index FirmwareCache::readIndex() const
+{
+    Index index;
+    QFile file(m_directory + CACHE_INDEX);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return index;
+
+    //key, compressed size, size, mtime of the unpacked copy, last use, md5
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        QStringList fields = in.readLine().split('\t');
+        if (fields.count() != 6 || !validKey(fields[0]))
+            continue;
+        Entry entry;
+        entry.compressedSize = fields[1].toLongLong();
+        entry.size = fields[2].toLongLong();
+        entry.modified = fields[3].toLongLong();
+        entry.lastUsed = fields[4].toLongLong();
+        entry.md5 = fields[5];
+        index.insert(fields[0], entry);
+    }
+    return index;
+}
+
+bool FirmwareCache::writeIndex(const Index &index) const
+{
+    QSaveFile file(m_directory + CACHE_INDEX);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+    QTextStream out(&file);
+    for (Index::const_iterator it = index.constBegin(); it != index.constEnd(); ++it) {
+        out << it.key() << '\t' << it->compressedSize << '\t' << it->size << '\t'
+            << it->modified << '\t' << it->lastUsed << '\t' << it->md5 << '\n';
+    }
+    out.flush();
+    return file.commit();
+}
+
+QString FirmwareCache::lookup(const QString &key)
+{
+    if (!validKey(key))
+        return QString();
+
+    //The index is only ever replaced as a whole, it is read without the lock
+    Index index = readIndex();
+    if (!index.contains(key))
+        return QString();
+    Entry entry = index.value(key);
+
+    //Unpacked copy missing or touched, restore it from the archive. This is
+    //the slow part and runs unlocked: QSaveFile renames the verified copy
+    //into place, a second station doing the same writes identical bytes.
+    QString filename = path(key);
+    QFileInfo unpacked(filename);
+    bool restored = false;
+    bool broken = false;
+    if (!unpacked.exists() || unpacked.size() != entry.size
+            || unpacked.lastModified().toMSecsSinceEpoch() != entry.modified) {
+        QFile archive(filename + ".gz");
+        if (!archive.open(QIODevice::ReadOnly)) {
+            broken = true;
+        } else {
+            QByteArray data = FirmwareStream::gzipDecompress(archive.readAll());
+            archive.close();
+            QString md5 = QString(QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex());
+            if (md5 != entry.md5) {
+                broken = true;
+            } else {
+                QSaveFile file(filename);
+                if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+                    return QString();
+                restored = true;
+            }
+        }
+    }
+
+    QLockFile lock(m_directory + CACHE_LOCK);
+    lock.setStaleLockTime(CACHE_LOCK_STALE);
+    if (!lock.tryLock(CACHE_LOCK_TIMEOUT))
+        return broken ? QString() : filename;
+
+    //Read again, another station may have changed it meanwhile
+    index = readIndex();
+    if (!index.contains(key) || index.value(key).md5 != entry.md5)
+        return QString();
+    if (broken) {
+        QFile::remove(filename);
+        QFile::remove(filename + ".gz");
+        QFile::remove(IntelHex::binaryPath(filename));
+        index.remove(key);
+        writeIndex(index);
+        return QString();
+    }
+    if (restored)
+        index[key].modified = QFileInfo(filename).lastModified().toMSecsSinceEpoch();
+    index[key].lastUsed = QDateTime::currentMSecsSinceEpoch();
+    writeIndex(index);
+    return filename;
+}
+
+QStringList FirmwareCache::keysWithPrefix(const QString &prefix) const
+{
+    //No lock needed, the index is only ever replaced as a whole
+    Index index = readIndex();
+    QList<QPair<qint64, QString> > found;
+    for (Index::const_iterator it = index.constBegin(); it != index.constEnd(); ++it) {
+        if (it.key().startsWith(prefix))
+            found.append(qMakePair(-it->lastUsed, it.key()));
+    }
+    qSort(found);
+
+    //Most recently used first
+    QStringList keys;
+    for (int i = 0; i < found.count(); i++)
+        keys<<found[i].second;
+    return keys;
+}
+
+QString FirmwareCache::addEntry(const QString &key, qint64 compressedSize, qint64 size, const QString &md5)
+{
+    QString filename = path(key);
+    QLockFile lock(m_directory + CACHE_LOCK);
+    lock.setStaleLockTime(CACHE_LOCK_STALE);
+    if (!lock.tryLock(CACHE_LOCK_TIMEOUT)) {
+        //Usable, just not indexed, the next download replaces it
+        return filename;
+    }
+
+    Index index = readIndex();
+    Entry entry;
+    entry.compressedSize = compressedSize;
+    entry.size = size;
+    entry.modified = QFileInfo(filename).lastModified().toMSecsSinceEpoch();
+    entry.lastUsed = QDateTime::currentMSecsSinceEpoch();
+    entry.md5 = md5;
+    index.insert(key, entry);
+    evict(index, key);
+    writeIndex(index);
+    return filename;
+}
+
+void FirmwareCache::evict(Index &index, const QString &keep) const
+{
+    qint64 total = 0;
+    for (Index::const_iterator it = index.constBegin(); it != index.constEnd(); ++it)
+        total += it->compressedSize + it->size;
+
+    while (total > m_byteBudget && index.count() > 1) {
+        QString oldest;
+        qint64 oldestUse = 0;
+        for (Index::const_iterator it = index.constBegin(); it != index.constEnd(); ++it) {
+            if (it.key() != keep && (oldest.isEmpty() || it->lastUsed < oldestUse)) {
+                oldest = it.key();
+                oldestUse = it->lastUsed;
+            }
+        }
+        if (oldest.isEmpty())
+            break;
+        total -= index[oldest].compressedSize + index[oldest].size;
+        QFile::remove(path(oldest));
+        QFile::remove(path(oldest) + ".gz");
+        QFile::remove(IntelHex::binaryPath(path(oldest)));
+        index.remove(oldest);
+    }
+}
+
+FirmwareCacheWriter::FirmwareCacheWriter(FirmwareCache *cache, const QString &key) :
+    m_cache(cache),
+    m_key(key),
+    m_file(cache->path(key)),
+    m_archive(cache->path(key) + ".gz"),
+    m_size(0),
+    m_compressedSize(0)
+{
+}
+
+bool FirmwareCacheWriter::open()
+{
+    if (!FirmwareCache::validKey(m_key))
+        return false;
+    m_size = 0;
+    m_compressedSize = 0;
+    return m_file.open(QIODevice::WriteOnly) && m_archive.open(QIODevice::WriteOnly);
+}
+
+bool FirmwareCacheWriter::write(const char *data, int len)
+{
+    m_size += len;
+    return m_file.write(data, len) == len;
+}
+
+bool FirmwareCacheWriter::writeCompressed(const char *data, int len)
+{
+    m_compressedSize += len;
+    return m_archive.write(data, len) == len;
+}
+
+QString FirmwareCacheWriter::commit(const QString &md5)
+{
+    //QSaveFile renames into place, readers never see half written files
+    if (!m_archive.commit() || !m_file.commit())
+        return QString();
+    return m_cache->addEntry(m_key, m_compressedSize, m_size, md5);
+}
+
+void FirmwareCacheWriter::cancel()
+{
+    m_file.cancelWriting();
+    m_archive.cancelWriting();
+    if (m_file.isOpen())
+        m_file.commit();
+    if (m_archive.isOpen())
+        m_archive.commit();
+}
@@ -0,0 +1,85 @@
+#ifndef FIRMWARECACHE_H
+#define FIRMWARECACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QSaveFile>
+
+/**
+ * Local store for built firmwares, keyed by the file name the build
+ * server hands out (<config hash>_<commit>.hex), which already names the
+ * content. Every entry is kept gzip compressed as <key>.gz next to an
+ * unpacked copy the uploaders read; index.txt records sizes, the md5 of
+ * the unpacked data and the last use. A hit whose unpacked copy still
+ * matches the index is returned without hashing anything, otherwise it is
+ * unpacked and verified again. Least recently used entries are evicted
+ * once the cache grows beyond the byte budget. All index updates happen
+ * under a QLockFile, so several FlashTool processes can share the
+ * directory. New entries are written through a FirmwareCacheWriter while
+ * they download and only show up once committed.
+ */
+class FirmwareCache
+{
+    friend class FirmwareCacheWriter;
+
+public:
+    explicit FirmwareCache(const QString &directory);
+
+    void setByteBudget(qint64 bytes);
+    qint64 byteBudget() const { return m_byteBudget; }
+
+    QString lookup(const QString &key);
+    QStringList keysWithPrefix(const QString &prefix) const;
+
+    QString directory() const { return m_directory; }
+    QString path(const QString &key) const { return m_directory + key; }
+
+private:
+    struct Entry
+    {
+        qint64 compressedSize;
+        qint64 size;
+        qint64 modified;
+        qint64 lastUsed;
+        QString md5;
+    };
+    typedef QHash<QString, Entry> Index;
+
+    QString m_directory;
+    qint64 m_byteBudget;
+
+    QString addEntry(const QString &key, qint64 compressedSize, qint64 size, const QString &md5);
+    Index readIndex() const;
+    bool writeIndex(const Index &index) const;
+    void evict(Index &index, const QString &keep) const;
+    static bool validKey(const QString &key);
+};
+
+/**
+ * Writes one cache entry in place: the gzip archive and the unpacked
+ * firmware go to QSaveFile temporaries in the cache directory and are
+ * renamed into place by commit(), which then records them in the index.
+ */
+class FirmwareCacheWriter
+{
+public:
+    FirmwareCacheWriter(FirmwareCache *cache, const QString &key);
+
+    bool open();
+    bool write(const char *data, int len);
+    bool writeCompressed(const char *data, int len);
+    QString commit(const QString &md5);
+    void cancel();
+
+private:
+    FirmwareCache *m_cache;
+    QString m_key;
+    QSaveFile m_file;
+    QSaveFile m_archive;
+    qint64 m_size;
+    qint64 m_compressedSize;
+};
+
+#endif // FIRMWARECACHE_H
@@ -0,0 +1,77 @@
+#include "firmwaredelta.h"
+
+#include <string.h>
+
+//Magic, base size, target size and the length of the base name
+#define DELTA_HEADER_SIZE 13
+//Target size comes from the server, no firmware file gets anywhere near it
+#define DELTA_MAX_TARGET (16 * 1024 * 1024)
+
+static quint32 readUInt32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((quint32)u[3] << 24);
+}
+
+QString FirmwareDelta::baseName(const QByteArray &delta)
+{
+    if (delta.size() < DELTA_HEADER_SIZE || memcmp(delta.constData(), "FTD1", 4) != 0)
+        return QString();
+    int length = (unsigned char)delta.at(DELTA_HEADER_SIZE - 1);
+    if (delta.size() < DELTA_HEADER_SIZE + length)
+        return QString();
+    return QString::fromLatin1(delta.constData() + DELTA_HEADER_SIZE, length);
+}
+
+bool FirmwareDelta::apply(const QByteArray &base, const QByteArray &delta, QByteArray *target, QString *error)
+{
+    const char *p = delta.constData();
+    const char *end = p + delta.size();
+
+    if (delta.size() < DELTA_HEADER_SIZE || memcmp(p, "FTD1", 4) != 0
+            || delta.size() < DELTA_HEADER_SIZE + (unsigned char)p[DELTA_HEADER_SIZE - 1]) {
+        *error = "Not a firmware delta";
+        return false;
+    }
+    if (readUInt32(p + 4) != (quint32)base.size()) {
+        *error = "Delta was made for a different base";
+        return false;
+    }
+    quint32 targetSize = readUInt32(p + 8);
+    if (targetSize > DELTA_MAX_TARGET) {
+        *error = "Corrupted firmware delta";
+        return false;
+    }
+    target->resize(targetSize);
+    char *out = target->data();
+    quint32 written = 0;
+    p += DELTA_HEADER_SIZE + (unsigned char)p[DELTA_HEADER_SIZE - 1];
+
+    while (p < end && *p != 'E') {
+        if (*p == 'C' && end - p >= 9) {
+            quint32 offset = readUInt32(p + 1);
+            quint32 length = readUInt32(p + 5);
+            if (offset > (quint32)base.size() || length > (quint32)base.size() - offset || length > targetSize - written)
+                break;
+            memcpy(out + written, base.constData() + offset, length);
+            written += length;
+            p += 9;
+        } else if (*p == 'I' && end - p >= 5) {
+            quint32 length = readUInt32(p + 1);
+            if (length > (quint32)(end - p - 5) || length > targetSize - written)
+                break;
+            memcpy(out + written, p + 5, length);
+            written += length;
+            p += 5 + length;
+        } else {
+            break;
+        }
+    }
+
+    if (p >= end || *p != 'E' || written != targetSize) {
+        target->clear();
+        *error = "Corrupted firmware delta";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef FIRMWAREDELTA_H
+#define FIRMWAREDELTA_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Rebuilds a firmware from an earlier build of the same config and the
+ * block delta the build server serves for it (server lib/delta.js):
+ * "FTD1", base size, target size, the cache key of the base, then copy
+ * ranges of the base and inserted literals, all little endian. The delta
+ * is checked against the base and every range is bounds checked; the
+ * result still has to pass the md5 check like a full download.
+ */
+class FirmwareDelta
+{
+public:
+    static QString baseName(const QByteArray &delta);
+    static bool apply(const QByteArray &base, const QByteArray &delta, QByteArray *target, QString *error);
+};
+
+#endif // FIRMWAREDELTA_H
@@ -0,0 +1,134 @@
+#include "firmwareprefetcher.h"
+
+#include <QFile>
+
+//Selection has to stay unchanged this long before it is hinted
+#define PREFETCH_DELAY 3000
+
+FirmwarePrefetcher::FirmwarePrefetcher(QObject *parent) :
+    QObject(parent),
+    m_session(0),
+    m_cacheBudget(0)
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(PREFETCH_DELAY);
+    connect(m_timer, SIGNAL(timeout()), this, SLOT(submit()));
+}
+
+FirmwarePrefetcher::~FirmwarePrefetcher()
+{
+    stopSession(false);
+}
+
+void FirmwarePrefetcher::setHexUrl(const QString &hexUrl)
+{
+    m_hexUrl = hexUrl;
+}
+
+void FirmwarePrefetcher::setFirmwareDirectory(const QString &directory)
+{
+    m_firmwareDirectoryName = directory;
+}
+
+void FirmwarePrefetcher::setCacheBudget(qint64 bytes)
+{
+    m_cacheBudget = bytes;
+}
+
+void FirmwarePrefetcher::setDelay(int ms)
+{
+    m_timer->setInterval(qMax(0, ms));
+}
+
+int FirmwarePrefetcher::delay() const
+{
+    return m_timer->interval();
+}
+
+void FirmwarePrefetcher::selectionChanged(const FirmwareRequest &request)
+{
+    m_request = request;
+    m_request.hint = true;
+    if (m_request.toXml() == m_requestXml) {
+        //Back to what is already hinted
+        m_timer->stop();
+        return;
+    }
+    //The old hint is dropped now, not only when the new one is submitted
+    if (!m_requestXml.isEmpty()) {
+        stopSession(true);
+        m_requestXml.clear();
+    }
+    m_timer->start();
+}
+
+void FirmwarePrefetcher::abandon()
+{
+    //Flash was pressed: the real request takes over the server job, only
+    //the local fetch must not write the same cache entry alongside it
+    m_timer->stop();
+    stopSession(false);
+    m_requestXml.clear();
+}
+
+void FirmwarePrefetcher::cancel()
+{
+    m_timer->stop();
+    stopSession(true);
+    m_requestXml.clear();
+}
+
+void FirmwarePrefetcher::submit()
+{
+    if (m_hexUrl.isEmpty())
+        return;
+    stopSession(true);
+    m_requestXml = m_request.toXml();
+
+    m_session = new FlashSession(this);
+    m_session->setHexUrl(m_hexUrl);
+    m_session->setFirmwareDirectory(m_firmwareDirectoryName);
+    m_session->setCacheBudget(m_cacheBudget);
+    connect(m_session, SIGNAL(firmwareReady(QString)), this, SLOT(sessionFirmwareReady(QString)));
+    connect(m_session, SIGNAL(finished(int,QString)), this, SLOT(sessionFinished(int,QString)));
+    m_session->fetch(m_request);
+}
+
+void FirmwarePrefetcher::stopSession(bool dropHint)
+{
+    if (!m_session)
+        return;
+    QString firmwareFile = m_session->firmwareFileName();
+    m_session->disconnect(this);
+    m_session->cancel();
+    m_session->deleteLater();
+    m_session = 0;
+
+    //Only a queued hint is dropped, the server keeps anything real or built
+    if (!dropHint || firmwareFile.isEmpty())
+        return;
+    Downloader *downloader = new Downloader(this);
+    connect(downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(cancelSent(DownloadsList)));
+    downloader->startDownloads(Download(m_hexUrl + "/cancel", "<?xml version=\"1.0\"?><xml><firmware>" + firmwareFile + "</firmware></xml>"));
+}
+
+void FirmwarePrefetcher::cancelSent(DownloadsList downloads)
+{
+    QFile::remove(downloads[0].tmpFile);
+    sender()->deleteLater();
+}
+
+void FirmwarePrefetcher::sessionFirmwareReady(QString filename)
+{
+    emit prefetched(filename);
+}
+
+void FirmwarePrefetcher::sessionFinished(int result, QString message)
+{
+    Q_UNUSED(result);
+    Q_UNUSED(message);
+    //A failed hint is not retried until the selection changes
+    m_session->deleteLater();
+    m_session = 0;
+}
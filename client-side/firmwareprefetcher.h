@@ -0,0 +1,57 @@
+#ifndef FIRMWAREPREFETCHER_H
+#define FIRMWAREPREFETCHER_H
+
+#include <QObject>
+#include <QTimer>
+
+#include "flashsession.h"
+
+/**
+ * Speculative builds while the user is still choosing: once the
+ * selection has not changed for delay() ms it is sent to the build
+ * server as a hint, which queues it behind every real flash request, and
+ * the firmware is fetched into the FirmwareCache as soon as it is built.
+ * A changed selection cancels the local fetch and tells the server to
+ * drop the queued hint. By the time Flash is pressed the FlashSession
+ * usually finds the firmware in the cache.
+ */
+class FirmwarePrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FirmwarePrefetcher(QObject *parent = 0);
+    ~FirmwarePrefetcher();
+
+    void setHexUrl(const QString &hexUrl);
+    void setFirmwareDirectory(const QString &directory);
+    void setCacheBudget(qint64 bytes);
+    void setDelay(int ms);
+    int delay() const;
+
+    void selectionChanged(const FirmwareRequest &request);
+    void abandon();
+    void cancel();
+
+signals:
+    void prefetched(QString filename);
+
+private slots:
+    void submit();
+    void sessionFirmwareReady(QString filename);
+    void sessionFinished(int result, QString message);
+    void cancelSent(DownloadsList downloads);
+
+private:
+    QTimer *m_timer;
+    FlashSession *m_session;
+    QString m_hexUrl;
+    QString m_firmwareDirectoryName;
+    qint64 m_cacheBudget;
+    FirmwareRequest m_request;
+    QString m_requestXml;
+
+    void stopSession(bool dropHint);
+};
+
+#endif // FIRMWAREPREFETCHER_H
@@ -0,0 +1,234 @@
+#include "firmwarestream.h"
+#include "firmwarecache.h"
+
+#include <string.h>
+
+//Output buffer of one inflate()/deflate() round
+#define STREAM_CHUNK 65536
+
+FirmwareStream::FirmwareStream() :
+    m_writer(0),
+    m_mode(Detect),
+    m_zstreamOpen(false),
+    m_streamEnd(false),
+    m_failed(false),
+    m_writeFailed(false),
+    m_md5(QCryptographicHash::Md5)
+{
+    memset(&m_zstream, 0, sizeof(m_zstream));
+}
+
+FirmwareStream::~FirmwareStream()
+{
+    end();
+}
+
+void FirmwareStream::end()
+{
+    if (!m_zstreamOpen)
+        return;
+    if (m_mode == Gzip)
+        inflateEnd(&m_zstream);
+    else
+        deflateEnd(&m_zstream);
+    m_zstreamOpen = false;
+}
+
+void FirmwareStream::start(FirmwareCacheWriter *writer)
+{
+    end();
+    m_writer = writer;
+    m_mode = Detect;
+    m_streamEnd = false;
+    m_failed = false;
+    m_writeFailed = false;
+    m_head.clear();
+    m_md5.reset();
+}
+
+bool FirmwareStream::fail(bool writeFailed)
+{
+    m_failed = true;
+    m_writeFailed = writeFailed;
+    end();
+    return false;
+}
+
+bool FirmwareStream::begin(Mode mode)
+{
+    m_mode = mode;
+    memset(&m_zstream, 0, sizeof(m_zstream));
+    int ret;
+    if (mode == Gzip)
+        ret = inflateInit2(&m_zstream, 15 + 32); // gzip decoding
+    else
+        ret = deflateInit2(&m_zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY); // gzip encoding
+    m_zstreamOpen = (ret == Z_OK);
+    return m_zstreamOpen;
+}
+
+bool FirmwareStream::feed(const char *data, int len)
+{
+    if (m_failed)
+        return false;
+
+    if (m_mode == Detect) {
+        //The gzip magic decides, it may arrive split over two chunks
+        m_head.append(data, len);
+        if (m_head.size() < 2)
+            return true;
+        bool gzip = (unsigned char)m_head.at(0) == 0x1f && (unsigned char)m_head.at(1) == 0x8b;
+        if (!begin(gzip ? Gzip : Plain))
+            return fail(false);
+        QByteArray head = m_head;
+        m_head.clear();
+        return process(head.constData(), head.size());
+    }
+    return process(data, len);
+}
+
+bool FirmwareStream::process(const char *data, int len)
+{
+    if (m_mode == Gzip) {
+        if (!m_writer->writeCompressed(data, len))
+            return fail(true);
+        return inflateChunk(data, len);
+    }
+
+    m_md5.addData(data, len);
+    if (!m_writer->write(data, len))
+        return fail(true);
+    return deflateChunk(data, len, Z_NO_FLUSH);
+}
+
+bool FirmwareStream::inflateChunk(const char *data, int len)
+{
+    //Anything behind the end of the gzip member is ignored, like gunzip does
+    if (m_streamEnd)
+        return true;
+
+    char out[STREAM_CHUNK];
+    m_zstream.next_in = (Bytef *)data;
+    m_zstream.avail_in = len;
+    do {
+        m_zstream.next_out = (Bytef *)out;
+        m_zstream.avail_out = STREAM_CHUNK;
+        int ret = inflate(&m_zstream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            return fail(false);
+
+        int produced = STREAM_CHUNK - m_zstream.avail_out;
+        m_md5.addData(out, produced);
+        if (!m_writer->write(out, produced))
+            return fail(true);
+        if (ret == Z_STREAM_END) {
+            m_streamEnd = true;
+            break;
+        }
+        if (ret == Z_BUF_ERROR)
+            break;
+    } while (m_zstream.avail_in > 0 || m_zstream.avail_out == 0);
+    return true;
+}
+
+bool FirmwareStream::deflateChunk(const char *data, int len, int flush)
+{
+    char out[STREAM_CHUNK];
+    m_zstream.next_in = (Bytef *)data;
+    m_zstream.avail_in = len;
+    int ret;
+    do {
+        m_zstream.next_out = (Bytef *)out;
+        m_zstream.avail_out = STREAM_CHUNK;
+        ret = deflate(&m_zstream, flush);
+        if (ret == Z_STREAM_ERROR)
+            return fail(false);
+        int produced = STREAM_CHUNK - m_zstream.avail_out;
+        if (!m_writer->writeCompressed(out, produced))
+            return fail(true);
+    } while (m_zstream.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    return true;
+}
+
+bool FirmwareStream::finish()
+{
+    if (m_failed)
+        return false;
+
+    if (m_mode == Detect) {
+        //Shorter than the gzip magic, can only be plain data
+        if (!begin(Plain))
+            return fail(false);
+        QByteArray head = m_head;
+        m_head.clear();
+        if (!process(head.constData(), head.size()))
+            return false;
+    }
+
+    bool ok;
+    if (m_mode == Gzip) {
+        //A truncated archive never reaches the end of the stream
+        ok = m_streamEnd;
+    } else {
+        ok = deflateChunk(0, 0, Z_FINISH);
+    }
+    end();
+    if (!ok && !m_failed)
+        fail(false);
+    return ok;
+}
+
+QString FirmwareStream::md5() const
+{
+    return QString(m_md5.result().toHex());
+}
+
+QByteArray FirmwareStream::gzipDecompress(QByteArray compressData)
+{
+    if (compressData.size() <= 4) {
+        qWarning("gUncompress: Input data is truncated");
+        return QByteArray();
+    }
+
+    QByteArray result;
+
+    int ret;
+    z_stream strm;
+    static const int CHUNK_SIZE = 1024;
+    char out[CHUNK_SIZE];
+
+    /* allocate inflate state */
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = compressData.size();
+    strm.next_in = (Bytef*)(compressData.data());
+
+    ret = inflateInit2(&strm, 15 +  32); // gzip decoding
+    if (ret != Z_OK)
+        return QByteArray();
+
+    // run inflate()
+    do {
+        strm.avail_out = CHUNK_SIZE;
+        strm.next_out = (Bytef*)(out);
+
+        ret = inflate(&strm, Z_NO_FLUSH);
+        Q_ASSERT(ret != Z_STREAM_ERROR);  // state not clobbered
+
+        switch (ret) {
+        case Z_NEED_DICT:
+            ret = Z_DATA_ERROR;     // and fall through
+        case Z_DATA_ERROR:
+        case Z_MEM_ERROR:
+            (void)inflateEnd(&strm);
+            return QByteArray();
+        }
+
+        result.append(out, CHUNK_SIZE - strm.avail_out);
+    } while (strm.avail_out == 0);
+
+    // clean up and return
+    inflateEnd(&strm);
+    return result;
+}
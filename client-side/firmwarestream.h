@@ -0,0 +1,59 @@
+#ifndef FIRMWARESTREAM_H
+#define FIRMWARESTREAM_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+#include <zlib.h>
+
+class FirmwareCacheWriter;
+
+/**
+ * Turns the firmware download into a cache entry while the bytes arrive.
+ * A gzip body is stored as it comes and inflated in the same pass into
+ * the md5 and the unpacked copy; a plain body is hashed and stored and
+ * deflated alongside for the archive. Nothing is read back from disk, so
+ * the md5 is known the moment the last chunk has been fed.
+ */
+class FirmwareStream
+{
+public:
+    FirmwareStream();
+    ~FirmwareStream();
+
+    void start(FirmwareCacheWriter *writer);
+    bool feed(const char *data, int len);
+    bool finish();
+
+    QString md5() const;
+    //Whole buffer at once, for archives and deltas already in memory
+    static QByteArray gzipDecompress(QByteArray compressData);
+    //False if the data was bad, true if only the disk let us down
+    bool writeFailed() const { return m_writeFailed; }
+
+private:
+    enum Mode {
+        Detect,
+        Gzip,
+        Plain
+    };
+
+    FirmwareCacheWriter *m_writer;
+    Mode m_mode;
+    z_stream m_zstream;
+    bool m_zstreamOpen;
+    bool m_streamEnd;
+    bool m_failed;
+    bool m_writeFailed;
+    QByteArray m_head;
+    QCryptographicHash m_md5;
+
+    bool begin(Mode mode);
+    bool process(const char *data, int len);
+    bool inflateChunk(const char *data, int len);
+    bool deflateChunk(const char *data, int len, int flush);
+    bool fail(bool writeFailed);
+    void end();
+};
+
+#endif // FIRMWARESTREAM_H
@@ -8,26 +8,21 @@ QT       += core gui network xml widgets serialport
 
 TARGET = flashTool
 TEMPLATE = app
-LIBS += -lz
 
 ICON = resources/logo.icns
 
-FLASHTOOL_PATH_URI = http://127.0.0.1:8888/update.xml
-FLASHTOOL_VERSION = 1.1r3
-
-DEFINES += FLASHTOOL_PATH_URI=\\\"$$FLASHTOOL_PATH_URI\\\"
-DEFINES += FLASHTOOL_VERSION=\\\"$$FLASHTOOL_VERSION\\\"
+include(flashcore.pri)
 
 SOURCES += main.cpp\
         mainwindow.cpp \
+    catalogmodel.cpp \
     progressdialog.cpp \
-    aboutdialog.cpp \
-    F4BYFirmwareUploader.cc
+    aboutdialog.cpp
 
 HEADERS  += mainwindow.h \
+    catalogmodel.h \
     progressdialog.h \
-    aboutdialog.h \
-    F4BYFirmwareUploader.h
+    aboutdialog.h
 
 FORMS    += mainwindow.ui \
     aboutdialog.ui
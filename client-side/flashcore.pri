@@ -0,0 +1,61 @@
+#-------------------------------------------------
+#
+# GUI free flashing core, shared by the FlashTool
+# GUI and the flashtool-cli target
+#
+#-------------------------------------------------
+
+QT += core network xml serialport
+
+LIBS += -lz
+
+FLASHTOOL_PATH_URI = http://127.0.0.1:8888/update.xml
+FLASHTOOL_VERSION = 1.1r3
+
+DEFINES += FLASHTOOL_PATH_URI=\\\"$$FLASHTOOL_PATH_URI\\\"
+DEFINES += FLASHTOOL_VERSION=\\\"$$FLASHTOOL_VERSION\\\"
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/downloader.cpp \
+    $$PWD/catalog.cpp \
+    $$PWD/firmwarecache.cpp \
+    $$PWD/firmwarestream.cpp \
+    $$PWD/firmwaredelta.cpp \
+    $$PWD/flashsession.cpp \
+    $$PWD/flashscheduler.cpp \
+    $$PWD/firmwareprefetcher.cpp \
+    $$PWD/avrdudeuploader.cpp \
+    $$PWD/avrdudeparser.cpp \
+    $$PWD/ringbuffer.cpp \
+    $$PWD/seriallink.cpp \
+    $$PWD/hotplugmonitor.cpp \
+    $$PWD/crc32.cpp \
+    $$PWD/px4image.cpp \
+    $$PWD/intelhex.cpp \
+    $$PWD/stk500v2uploader.cpp \
+    $$PWD/sessiontracer.cpp \
+    $$PWD/F4BYFirmwareUploader.cc
+
+HEADERS += \
+    $$PWD/downloader.h \
+    $$PWD/catalog.h \
+    $$PWD/firmwarecache.h \
+    $$PWD/firmwarestream.h \
+    $$PWD/firmwaredelta.h \
+    $$PWD/flashsession.h \
+    $$PWD/flashscheduler.h \
+    $$PWD/firmwareprefetcher.h \
+    $$PWD/avrdudeuploader.h \
+    $$PWD/avrdudeparser.h \
+    $$PWD/ringbuffer.h \
+    $$PWD/seriallink.h \
+    $$PWD/hotplugmonitor.h \
+    $$PWD/crc32.h \
+    $$PWD/px4image.h \
+    $$PWD/intelhex.h \
+    $$PWD/stk500v2uploader.h \
+    $$PWD/sessiontracer.h \
+    $$PWD/F4BYFirmwareUploader.h
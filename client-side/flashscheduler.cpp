@@ -0,0 +1,191 @@
+#include "flashscheduler.h"
+#include "flashsession.h"
+
+double FlashSummary::boardsPerHour() const
+{
+    if (elapsed <= 0)
+        return 0;
+    return succeeded * 3600000.0 / elapsed;
+}
+
+FlashScheduler::FlashScheduler(QObject *parent) :
+    QObject(parent),
+    m_maxConcurrent(4),
+    m_progWindow(0),
+    m_fastHandshake(false),
+    m_useAvrdude(false),
+    m_differentialFlash(true),
+    m_nextJob(0),
+    m_finishedJobs(0),
+    m_canceled(false),
+    m_inStartNext(false)
+{
+}
+
+void FlashScheduler::setMaxConcurrent(int maxConcurrent)
+{
+    m_maxConcurrent = qMax(1, maxConcurrent);
+}
+
+int FlashScheduler::maxConcurrent() const
+{
+    return m_maxConcurrent;
+}
+
+void FlashScheduler::setProgWindow(int window)
+{
+    m_progWindow = window;
+}
+
+void FlashScheduler::setFastHandshake(bool fastHandshake)
+{
+    m_fastHandshake = fastHandshake;
+}
+
+void FlashScheduler::setUseAvrdude(bool useAvrdude)
+{
+    m_useAvrdude = useAvrdude;
+}
+
+void FlashScheduler::setDifferentialFlash(bool differential)
+{
+    m_differentialFlash = differential;
+}
+
+void FlashScheduler::setTraceDirectory(const QString &directory)
+{
+    m_traceDirectory = directory;
+}
+
+void FlashScheduler::addJob(const QString &portName, const QString &firmwareFile, bool isF4BY)
+{
+    FlashJob job;
+    job.portName = portName;
+    job.firmwareFile = firmwareFile;
+    job.isF4BY = isF4BY;
+    m_jobs << job;
+}
+
+FlashJobsList FlashScheduler::jobs() const
+{
+    return m_jobs;
+}
+
+FlashSummary FlashScheduler::summary() const
+{
+    FlashSummary summary;
+    summary.total = m_jobs.count();
+    summary.elapsed = m_timer.isValid() ? m_timer.elapsed() : 0;
+    foreach (FlashJob job, m_jobs) {
+        if (job.result == FlashSession::Success) {
+            summary.succeeded++;
+        } else if (job.result >= 0) {
+            summary.failed++;
+        }
+    }
+    return summary;
+}
+
+void FlashScheduler::start()
+{
+    m_nextJob = 0;
+    m_finishedJobs = 0;
+    m_canceled = false;
+    m_timer.start();
+
+    if (m_jobs.isEmpty()) {
+        emit allFinished();
+        return;
+    }
+    startNext();
+}
+
+void FlashScheduler::cancel()
+{
+    m_canceled = true;
+    foreach (FlashSession *session, m_running.keys()) {
+        session->cancel();
+    }
+}
+
+void FlashScheduler::startNext()
+{
+    //flashFile() may finish synchronously, e.g. on a missing file. The loop
+    //below already sees the freed slot, so the nested call has nothing to do.
+    if (m_inStartNext)
+        return;
+    m_inStartNext = true;
+
+    while (!m_canceled && m_running.count() < m_maxConcurrent && m_nextJob < m_jobs.count()) {
+        int index = m_nextJob++;
+        const FlashJob &job = m_jobs[index];
+
+        FlashSession *session = new FlashSession(this);
+        session->setPortName(job.portName);
+        session->setF4BY(job.isF4BY);
+        session->setProgWindow(m_progWindow);
+        session->setFastHandshake(m_fastHandshake);
+        session->setUseAvrdude(m_useAvrdude);
+        session->setDifferentialFlash(m_differentialFlash);
+        session->setTraceDirectory(m_traceDirectory);
+
+        connect(session, SIGNAL(statusUpdate(QString)), this, SLOT(sessionStatus(QString)));
+        connect(session, SIGNAL(progress(qint64,qint64)), this, SLOT(sessionProgress(qint64,qint64)));
+        connect(session, SIGNAL(finished(int,QString)), this, SLOT(sessionFinished(int,QString)));
+
+        m_running.insert(session, index);
+        m_jobStarted.insert(index, m_timer.elapsed());
+        emit jobStarted(job.portName);
+        session->flashFile(job.firmwareFile);
+    }
+
+    //Jobs that never got a slot
+    if (m_canceled) {
+        while (m_nextJob < m_jobs.count()) {
+            FlashJob &job = m_jobs[m_nextJob++];
+            job.result = FlashSession::Canceled;
+            m_finishedJobs++;
+            emit jobFinished(job.portName, job.result, job.message);
+        }
+    }
+    m_inStartNext = false;
+
+    if (m_running.isEmpty() && m_finishedJobs == m_jobs.count()) {
+        emit allFinished();
+    }
+}
+
+void FlashScheduler::sessionStatus(QString status)
+{
+    FlashSession *session = qobject_cast<FlashSession*>(sender());
+    if (!m_running.contains(session))
+        return;
+    emit jobStatus(m_jobs[m_running.value(session)].portName, status);
+}
+
+void FlashScheduler::sessionProgress(qint64 current, qint64 total)
+{
+    FlashSession *session = qobject_cast<FlashSession*>(sender());
+    if (!m_running.contains(session))
+        return;
+    emit jobProgress(m_jobs[m_running.value(session)].portName, current, total);
+}
+
+void FlashScheduler::sessionFinished(int result, QString message)
+{
+    FlashSession *session = qobject_cast<FlashSession*>(sender());
+    if (!m_running.contains(session))
+        return;
+
+    int index = m_running.take(session);
+    session->deleteLater();
+
+    FlashJob &job = m_jobs[index];
+    job.result = result;
+    job.message = message;
+    job.elapsed = m_timer.elapsed() - m_jobStarted.value(index);
+    m_finishedJobs++;
+
+    emit jobFinished(job.portName, result, message);
+    startNext();
+}
@@ -0,0 +1,93 @@
+#ifndef FLASHSCHEDULER_H
+#define FLASHSCHEDULER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QStringList>
+
+class FlashSession;
+
+struct FlashJob
+{
+    QString portName;
+    QString firmwareFile;
+    bool isF4BY;
+    int result;
+    QString message;
+    qint64 elapsed;
+
+    FlashJob() : isF4BY(false), result(-1), elapsed(0) {}
+};
+typedef QList<FlashJob> FlashJobsList;
+
+struct FlashSummary
+{
+    int total;
+    int succeeded;
+    int failed;
+    qint64 elapsed;
+
+    FlashSummary() : total(0), succeeded(0), failed(0), elapsed(0) {}
+    double boardsPerHour() const;
+};
+
+/**
+ * Flashes several boards at once, one FlashSession per serial port.
+ * At most maxConcurrent() sessions run at the same time, the others
+ * wait until a slot is free.
+ */
+class FlashScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FlashScheduler(QObject *parent = 0);
+
+    void setMaxConcurrent(int maxConcurrent);
+    int maxConcurrent() const;
+    void setProgWindow(int window);
+    void setFastHandshake(bool fastHandshake);
+    void setUseAvrdude(bool useAvrdude);
+    void setDifferentialFlash(bool differential);
+    void setTraceDirectory(const QString &directory);
+
+    void addJob(const QString &portName, const QString &firmwareFile, bool isF4BY);
+    void start();
+    void cancel();
+
+    FlashJobsList jobs() const;
+    FlashSummary summary() const;
+
+signals:
+    void jobStarted(QString portName);
+    void jobStatus(QString portName, QString status);
+    void jobProgress(QString portName, qint64 current, qint64 total);
+    void jobFinished(QString portName, int result, QString message);
+    void allFinished();
+
+private slots:
+    void sessionStatus(QString status);
+    void sessionProgress(qint64 current, qint64 total);
+    void sessionFinished(int result, QString message);
+
+private:
+    FlashJobsList m_jobs;
+    QHash<FlashSession*, int> m_running;
+    QHash<int, qint64> m_jobStarted;
+    QElapsedTimer m_timer;
+    int m_maxConcurrent;
+    int m_progWindow;
+    bool m_fastHandshake;
+    bool m_useAvrdude;
+    bool m_differentialFlash;
+    QString m_traceDirectory;
+    int m_nextJob;
+    int m_finishedJobs;
+    bool m_canceled;
+    bool m_inStartNext;
+
+    void startNext();
+};
+
+#endif // FLASHSCHEDULER_H
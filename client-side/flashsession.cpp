@@ -0,0 +1,773 @@
+#include "flashsession.h"
+#include "F4BYFirmwareUploader.h"
+#include "avrdudeuploader.h"
+#include "stk500v2uploader.h"
+#include "firmwarecache.h"
+#include "firmwarestream.h"
+#include "firmwaredelta.h"
+#include "sessiontracer.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QRegExp>
+#include <QTextStream>
+#include <QXmlStreamReader>
+
+QString FirmwareRequest::toXml() const
+{
+    QString request;
+
+    request.append("<?xml version=\"1.0\"?>");
+    request.append("<xml>");
+    request.append("<board>" + board + "</board>");
+    request.append("<rcinput>" + rcinput + "</rcinput>");
+    request.append("<rcmapping>" + rcmapping + "</rcmapping>");
+    request.append("<platform>" + platform + "</platform>");
+    request.append("<version>" + version + "</version>");
+    request.append("<gpstype>" + gpstype + "</gpstype>");
+    request.append("<gpsbaud>" + gpsbaud + "</gpsbaud>");
+    if (hint)
+        request.append("<hint>1</hint>");
+    request.append("</xml>");
+    return request;
+}
+
+FlashSession::FlashSession(QObject *parent) :
+    QObject(parent),
+    m_px4uploader(0),
+    m_avrdudeuploader(0),
+    m_stk500uploader(0),
+    m_cache(0),
+    m_cacheWriter(0),
+    m_stream(new FirmwareStream),
+    m_streamOk(false),
+    m_cacheBudget(0),
+    m_isF4BY(false),
+    m_progWindow(0),
+    m_fastHandshake(false),
+    m_useAvrdude(false),
+    m_differentialFlash(true),
+    m_pipelined(true),
+    m_uploaderDone(false),
+    m_canceled(false),
+    m_running(false),
+    m_fetchOnly(false),
+    m_tracer(0)
+{
+    this->m_downloader = new Downloader(this);
+    this->m_statusDownloader = new Downloader(this);
+    this->m_retrydownloads = new QTimer(this);
+    this->m_retrydownloads->setSingleShot(true);
+
+    connect(this->m_retrydownloads, SIGNAL(timeout()), this, SLOT(retryFirmwareDownload()));
+    connect(this->m_downloader, SIGNAL(timedOut()), this, SLOT(downloadTimedOut()));
+    connect(this->m_statusDownloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(buildStatusDone(DownloadsList)));
+    connect(this->m_statusDownloader, SIGNAL(timedOut()), this, SLOT(buildStatusTimedOut()));
+}
+
+FlashSession::~FlashSession()
+{
+    delete m_cacheWriter;
+    delete m_stream;
+    delete m_cache;
+    if (m_px4uploader) {
+        m_px4uploader->disconnect(this);
+        m_px4uploader->stop();
+    }
+    if (m_avrdudeuploader) {
+        m_avrdudeuploader->disconnect(this);
+        m_avrdudeuploader->stop();
+    }
+    if (m_stk500uploader) {
+        m_stk500uploader->disconnect(this);
+        m_stk500uploader->stop();
+    }
+    delete m_tracer;
+}
+
+void FlashSession::setHexUrl(const QString &hexUrl)
+{
+    m_hexUrl = hexUrl;
+}
+
+void FlashSession::setFirmwareDirectory(const QString &directory)
+{
+    m_firmwareDirectoryName = directory;
+    delete m_cache;
+    m_cache = new FirmwareCache(directory);
+    if (m_cacheBudget > 0)
+        m_cache->setByteBudget(m_cacheBudget);
+}
+
+void FlashSession::setCacheBudget(qint64 bytes)
+{
+    m_cacheBudget = bytes;
+    if (m_cache && bytes > 0)
+        m_cache->setByteBudget(bytes);
+}
+
+void FlashSession::setPortName(const QString &portName)
+{
+    m_portName = portName;
+}
+
+void FlashSession::setF4BY(bool isF4BY)
+{
+    m_isF4BY = isF4BY;
+}
+
+void FlashSession::setProgWindow(int window)
+{
+    m_progWindow = window;
+}
+
+void FlashSession::setFastHandshake(bool fastHandshake)
+{
+    m_fastHandshake = fastHandshake;
+}
+
+void FlashSession::setUseAvrdude(bool useAvrdude)
+{
+    m_useAvrdude = useAvrdude;
+}
+
+void FlashSession::setDifferentialFlash(bool differential)
+{
+    m_differentialFlash = differential;
+}
+
+QString FlashSession::firmwareFileName() const
+{
+    return m_firmwareFileName;
+}
+
+void FlashSession::setPipelined(bool pipelined)
+{
+    m_pipelined = pipelined;
+}
+
+void FlashSession::setTraceDirectory(const QString &directory)
+{
+    m_traceDirectory = directory;
+}
+
+QString FlashSession::resultName(int result)
+{
+    switch (result) {
+    case Success:
+        return "success";
+    case RequestFailed:
+        return "request-failed";
+    case DownloadFailed:
+        return "download-failed";
+    case ChecksumMismatch:
+        return "checksum-mismatch";
+    case FlashFailed:
+        return "flash-failed";
+    case Canceled:
+        return "canceled";
+    }
+    return "unknown";
+}
+
+void FlashSession::start(const FirmwareRequest &request)
+{
+    m_fetchOnly = false;
+    requestFirmware(request);
+    //The board is busy with reboot, sync and erase while the firmware is on its way
+    if (m_isF4BY && m_pipelined)
+        prepareDevice();
+}
+
+void FlashSession::fetch(const FirmwareRequest &request)
+{
+    m_fetchOnly = true;
+    requestFirmware(request);
+}
+
+void FlashSession::requestFirmware(const FirmwareRequest &request)
+{
+    m_canceled = false;
+    m_running = true;
+    m_uploaderDone = false;
+    m_uploaderError.clear();
+    trace("build request");
+
+    connect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(firmwareRequestDone(DownloadsList)));
+
+    this->m_downloader->startDownloads(Download(this->m_hexUrl, request.toXml()));
+}
+
+void FlashSession::prepareDevice()
+{
+    createPx4Uploader();
+    m_px4uploader->prepare();
+}
+
+void FlashSession::cancel()
+{
+    if (!m_running)
+        return;
+    m_canceled = true;
+    abortDownloads();
+
+    if (m_px4uploader) {
+        m_px4uploader->stop();
+        return;
+    }
+    if (m_avrdudeuploader) {
+        m_avrdudeuploader->stop();
+        return;
+    }
+    if (m_stk500uploader) {
+        m_stk500uploader->stop();
+        return;
+    }
+
+    finish(Canceled, tr("You either canceled the firmware download or the download timed out."));
+}
+
+void FlashSession::abortDownloads()
+{
+    this->m_retrydownloads->stop();
+    this->m_downloader->abort();
+    this->m_statusDownloader->abort();
+    disconnect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(firmwareRequestDone(DownloadsList)));
+    disconnect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(deltaDownloaded(DownloadsList)));
+    connectFirmwareDownload(false);
+    discardFirmwareStream();
+}
+
+void FlashSession::downloadTimedOut()
+{
+    cancel();
+}
+
+void FlashSession::firmwareRequestDone(DownloadsList downloads)
+{
+    Download download = downloads[0];
+
+    disconnect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(firmwareRequestDone(DownloadsList)));
+
+    emit statusUpdate(tr("Waiting for firmware"));
+
+    QFile file(download.tmpFile);
+    file.open(QIODevice::ReadOnly | QIODevice::Text);
+
+    QXmlStreamReader xml(&file);
+
+    QString firmwareFile;
+    QString error;
+
+    while (!xml.atEnd()) {
+        xml.readNext();
+
+        //Firmware
+        if (xml.isStartElement() && (xml.name() == "firmware")) {
+            xml.readNext();
+            firmwareFile = xml.text().toString().simplified();
+        }
+
+        //Error
+        if (xml.isStartElement() && (xml.name() == "error")) {
+            xml.readNext();
+            error = xml.text().toString().simplified();
+        }
+    }
+
+    file.close();
+    file.remove();
+
+    if (!download.success || firmwareFile.isEmpty()) {
+        finish(RequestFailed, tr("An error occured on the build server: %1").arg(error));
+        return;
+    }
+
+    this->m_firmwareFileName = firmwareFile;
+
+    if (!m_cache)
+        setFirmwareDirectory(this->m_firmwareDirectoryName);
+
+    QString cached = m_cache->lookup(this->m_firmwareFileName);
+    if (!cached.isEmpty()) {
+        emit statusUpdate(tr("Using cached firmware"));
+        if (m_tracer)
+            m_tracer->instant(SessionTracer::SessionLane, "cache hit");
+        firmwareAvailable(cached);
+    } else {
+        //Both run side by side, the archive is checked once both are in
+        DownloadsList firmwareDownloads;
+        firmwareDownloads<<Download(this->m_hexUrl + "/" + firmwareFile + ".md5");
+        Download archive(this->m_hexUrl + "/" + firmwareFile + ".gz");
+        archive.streamed = true;
+        firmwareDownloads<<archive;
+        this->m_currentFirmwareDownloads = firmwareDownloads;
+
+        //Wait for the build server to report the build as done
+        trace("build wait");
+        this->m_buildState.clear();
+        requestBuildStatus();
+    }
+}
+
+void FlashSession::requestBuildStatus()
+{
+    QString uri = this->m_hexUrl + "/status/" + this->m_firmwareFileName;
+    if (!this->m_buildState.isEmpty())
+        uri += "?since=" + this->m_buildState;
+    if (m_tracer)
+        m_tracer->addArg(SessionTracer::SessionLane, "polls");
+    this->m_statusDownloader->startDownloads(Download(uri));
+}
+
+void FlashSession::buildStatusDone(DownloadsList downloads)
+{
+    Download download = downloads[0];
+
+    QFile file(download.tmpFile);
+    file.open(QIODevice::ReadOnly | QIODevice::Text);
+
+    QXmlStreamReader xml(&file);
+
+    QString state;
+    QString position;
+
+    while (!xml.atEnd()) {
+        xml.readNext();
+
+        if (xml.isStartElement() && (xml.name() == "state")) {
+            xml.readNext();
+            state = xml.text().toString().simplified();
+        }
+
+        if (xml.isStartElement() && (xml.name() == "position")) {
+            xml.readNext();
+            position = xml.text().toString().simplified();
+        }
+    }
+
+    file.close();
+    file.remove();
+
+    if (!m_running || m_canceled)
+        return;
+
+    if (!download.success || state.isEmpty() || state == "unknown") {
+        //Older server or it lost track of the build, poll for the files
+        startFirmwareDownload(1000);
+    } else if (state == "done") {
+        if (!startDeltaDownload())
+            startFirmwareDownload(0);
+    } else if (state == "failed") {
+        finish(RequestFailed, tr("The build server could not build this firmware."));
+    } else {
+        if (state == "queued") {
+            emit statusUpdate(tr("Waiting for firmware, position %1 in the build queue").arg(position));
+        } else {
+            emit statusUpdate(tr("Building firmware"));
+        }
+        //The server holds the request until something changes
+        this->m_buildState = state + ":" + position;
+        requestBuildStatus();
+    }
+}
+
+void FlashSession::buildStatusTimedOut()
+{
+    if (!m_running || m_canceled)
+        return;
+    startFirmwareDownload(1000);
+}
+
+void FlashSession::startFirmwareDownload(int delay)
+{
+    trace("download");
+    connectFirmwareDownload(true);
+    this->m_retrydownloads->start(delay);
+}
+
+//First line of a md5sum output file
+static QString readMd5File(const QString &filename)
+{
+    QFile md5File(filename);
+    md5File.open(QIODevice::ReadOnly);
+    QTextStream in(&md5File);
+    QString md5sumReference;
+    while(!in.atEnd()) {
+        QString line = in.readLine();
+        md5sumReference = line.left(32);
+        break;
+    }
+    md5File.close();
+    md5File.remove();
+    return md5sumReference;
+}
+
+bool FlashSession::startDeltaDownload()
+{
+    //Earlier builds of the same config share the hash before the '_'
+    int separator = this->m_firmwareFileName.indexOf('_');
+    if (separator <= 0)
+        return false;
+    QStringList bases = m_cache->keysWithPrefix(this->m_firmwareFileName.left(separator + 1));
+    bases.removeAll(this->m_firmwareFileName);
+    if (bases.isEmpty())
+        return false;
+
+    QString uri = this->m_hexUrl + "/delta/" + this->m_firmwareFileName;
+    for (int i = 0; i < bases.count() && i < 4; i++)
+        uri += (i == 0 ? "?from=" : "&from=") + bases[i];
+
+    DownloadsList downloads;
+    downloads<<Download(this->m_hexUrl + "/" + this->m_firmwareFileName + ".md5");
+    downloads<<Download(uri);
+    trace("delta download");
+
+    connect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(deltaDownloaded(DownloadsList)));
+    connect(this->m_downloader, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(downloadProgressFirmware(qint64,qint64)));
+    this->m_downloader->startDownloads(downloads);
+    return true;
+}
+
+void FlashSession::deltaDownloaded(DownloadsList downloads)
+{
+    disconnect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(deltaDownloaded(DownloadsList)));
+    disconnect(this->m_downloader, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(downloadProgressFirmware(qint64,qint64)));
+
+    Download downloadMd5 = downloads[0];
+    Download download = downloads[1];
+
+    QString md5sumReference = readMd5File(downloadMd5.tmpFile);
+    QFile deltaFile(download.tmpFile);
+    deltaFile.open(QIODevice::ReadOnly);
+    QByteArray delta = deltaFile.readAll();
+    deltaFile.close();
+    deltaFile.remove();
+    if (m_tracer)
+        m_tracer->setArg(SessionTracer::SessionLane, "bytes", delta.size());
+
+    //No delta offered or it did not work out, fetch the whole firmware
+    if (!downloadMd5.success || !download.success || !applyDelta(FirmwareStream::gzipDecompress(delta), md5sumReference))
+        startFirmwareDownload(0);
+}
+
+bool FlashSession::applyDelta(const QByteArray &delta, const QString &md5sumReference)
+{
+    QString baseFilename = m_cache->lookup(FirmwareDelta::baseName(delta));
+    if (baseFilename.isEmpty())
+        return false;
+    QFile baseFile(baseFilename);
+    if (!baseFile.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray base = baseFile.readAll();
+    baseFile.close();
+
+    QByteArray firmware;
+    QString error;
+    if (!FirmwareDelta::apply(base, delta, &firmware, &error)) {
+        //QLOG_WARN() << "Firmware delta:" << error;
+        return false;
+    }
+
+    //Same checks and cache entry as a full download
+    FirmwareCacheWriter writer(m_cache, this->m_firmwareFileName);
+    FirmwareStream stream;
+    stream.start(&writer);
+    if (!writer.open() || !stream.feed(firmware.constData(), firmware.size()) || !stream.finish()
+            || stream.md5() != md5sumReference) {
+        writer.cancel();
+        return false;
+    }
+    QString hexFilename = writer.commit(md5sumReference);
+    if (hexFilename.isEmpty())
+        return false;
+    emit statusUpdate(tr("Firmware patched from an earlier build"));
+    firmwareAvailable(hexFilename);
+    return true;
+}
+
+void FlashSession::downloadProgressFirmware(qint64 bytesReceived, qint64 bytesTotal)
+{
+    emit statusUpdate(tr("Downloading firmware"));
+    emit progress(bytesReceived, bytesTotal);
+}
+
+void FlashSession::retryFirmwareDownload()
+{
+    this->m_downloader->startDownloads(this->m_currentFirmwareDownloads);
+}
+
+void FlashSession::connectFirmwareDownload(bool connected)
+{
+    if (connected) {
+        connect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(downloadFinishedFirmware(DownloadsList)));
+        connect(this->m_downloader, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(downloadProgressFirmware(qint64,qint64)));
+        connect(this->m_downloader, SIGNAL(downloadStarted(int)), this, SLOT(firmwareDownloadStarted(int)));
+        connect(this->m_downloader, SIGNAL(dataReceived(int,QByteArray)), this, SLOT(firmwareDataReceived(int,QByteArray)));
+    } else {
+        disconnect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SLOT(downloadFinishedFirmware(DownloadsList)));
+        disconnect(this->m_downloader, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(downloadProgressFirmware(qint64,qint64)));
+        disconnect(this->m_downloader, SIGNAL(downloadStarted(int)), this, SLOT(firmwareDownloadStarted(int)));
+        disconnect(this->m_downloader, SIGNAL(dataReceived(int,QByteArray)), this, SLOT(firmwareDataReceived(int,QByteArray)));
+    }
+}
+
+void FlashSession::discardFirmwareStream()
+{
+    if (m_cacheWriter) {
+        m_cacheWriter->cancel();
+        delete m_cacheWriter;
+        m_cacheWriter = 0;
+    }
+    m_streamOk = false;
+}
+
+void FlashSession::firmwareDownloadStarted(int index)
+{
+    //Index 1 is the archive, it starts over on every try and redirect
+    if (index != 1)
+        return;
+    discardFirmwareStream();
+    m_cacheWriter = new FirmwareCacheWriter(m_cache, this->m_firmwareFileName);
+    m_streamOk = m_cacheWriter->open();
+    m_stream->start(m_cacheWriter);
+}
+
+void FlashSession::firmwareDataReceived(int index, QByteArray data)
+{
+    if (index != 1 || !m_streamOk)
+        return;
+    m_streamOk = m_stream->feed(data.constData(), data.size());
+}
+
+void FlashSession::downloadFinishedFirmware(DownloadsList downloads)
+{
+    //Increase try count
+    downloads[1].tries++;
+
+    Download downloadMd5 = downloads[0];
+    Download download = downloads[1];
+
+    if (!download.success || !downloadMd5.success) {
+        int maxTries = 50;
+
+        discardFirmwareStream();
+        QFile::remove(downloadMd5.tmpFile);
+        this->m_currentFirmwareDownloads = downloads;
+        emit statusUpdate(tr("Waiting for firmware") + " " + QString::number(download.tries) + "/" + QString::number(maxTries));
+        if (m_tracer)
+            m_tracer->setArg(SessionTracer::SessionLane, "tries", download.tries);
+        if (download.tries > maxTries) {
+            connectFirmwareDownload(false);
+            finish(DownloadFailed, tr("Failed to download firmware, try again later."));
+        } else {
+            this->m_retrydownloads->start(10000);
+        }
+        return;
+    }
+
+    connectFirmwareDownload(false);
+
+    //get md5 from server file
+    QString md5sumReference = readMd5File(downloadMd5.tmpFile);
+
+    //Everything was inflated and hashed on the way in
+    if (m_streamOk)
+        m_streamOk = m_stream->finish();
+    if (!m_streamOk && m_stream->writeFailed()) {
+        discardFirmwareStream();
+        finish(DownloadFailed, tr("Unable to store the firmware in %1.").arg(m_cache->directory()));
+        return;
+    }
+    if (!m_streamOk || m_stream->md5() != md5sumReference) {
+        discardFirmwareStream();
+        finish(ChecksumMismatch, tr("The downloaded firmware looks corrupted, please try again."));
+        return;
+    }
+
+    QString hexFilename = m_cacheWriter->commit(md5sumReference);
+    delete m_cacheWriter;
+    m_cacheWriter = 0;
+    if (hexFilename.isEmpty()) {
+        finish(DownloadFailed, tr("Unable to store the firmware in %1.").arg(m_cache->directory()));
+        return;
+    }
+    firmwareAvailable(hexFilename);
+}
+
+void FlashSession::firmwareAvailable(const QString &filename)
+{
+    emit firmwareReady(filename);
+    if (m_fetchOnly) {
+        finish(Success, tr("Firmware downloaded."));
+    } else {
+        flashFile(filename);
+    }
+}
+
+void FlashSession::createPx4Uploader()
+{
+    m_px4uploader = new F4BYFirmwareUploader(this);
+    m_px4uploader->setPortName(m_portName);
+    if (m_progWindow > 0)
+        m_px4uploader->setProgWindow(m_progWindow);
+    if (m_fastHandshake)
+        m_px4uploader->setHandshakeProfile(F4BYFirmwareUploader::FastHandshake);
+    m_px4uploader->setTracer(m_tracer);
+
+    connect(m_px4uploader,SIGNAL(statusUpdate(QString)),this,SIGNAL(statusUpdate(QString)));
+    connect(m_px4uploader,SIGNAL(flashProgress(qint64,qint64)),this,SIGNAL(progress(qint64,qint64)));
+    connect(m_px4uploader,SIGNAL(requestDevicePlug()),this,SIGNAL(requestDevicePlug()));
+    connect(m_px4uploader,SIGNAL(devicePlugDetected()),this,SIGNAL(devicePlugDetected()));
+    connect(m_px4uploader,SIGNAL(error(QString)),this,SLOT(uploaderError(QString)));
+    connect(m_px4uploader,SIGNAL(done()),this,SLOT(uploaderDone()));
+    connect(m_px4uploader,SIGNAL(finished()),this,SLOT(uploaderFinished()));
+}
+
+void FlashSession::flashFile(const QString &filename)
+{
+    m_running = true;
+    trace("flash");
+
+    if (m_px4uploader) {
+        //Prepared by start(), it takes over once the board is erased
+        emit progress(0, 100);
+        if (!m_px4uploader->loadFile(filename)) {
+            m_uploaderError = tr("Unable to decode the firmware image.");
+            m_px4uploader->stop();
+        }
+        return;
+    }
+
+    m_uploaderDone = false;
+    m_uploaderError.clear();
+
+    if (!QFile::exists(filename)) {
+        finish(FlashFailed, tr("Firmware not found."));
+        return;
+    }
+
+    if (m_isF4BY) {
+        createPx4Uploader();
+
+        emit progress(0, 100);
+        if (!m_px4uploader->loadFile(filename)) {
+            m_px4uploader->deleteLater();
+            m_px4uploader = 0;
+            finish(FlashFailed, tr("Unable to decode the firmware image."));
+        }
+    } else if (!m_useAvrdude) {
+        m_stk500uploader = new Stk500v2Uploader(this);
+        m_stk500uploader->setPortName(m_portName);
+        m_stk500uploader->setDifferential(m_differentialFlash);
+        m_stk500uploader->setTracer(m_tracer);
+
+        connect(m_stk500uploader,SIGNAL(statusUpdate(QString)),this,SIGNAL(statusUpdate(QString)));
+        connect(m_stk500uploader,SIGNAL(flashProgress(qint64,qint64)),this,SIGNAL(progress(qint64,qint64)));
+        connect(m_stk500uploader,SIGNAL(error(QString)),this,SLOT(uploaderError(QString)));
+        connect(m_stk500uploader,SIGNAL(done()),this,SLOT(uploaderDone()));
+        connect(m_stk500uploader,SIGNAL(finished()),this,SLOT(uploaderFinished()));
+
+        emit progress(0, 100);
+        if (!m_stk500uploader->loadFile(filename)) {
+            m_stk500uploader->deleteLater();
+            m_stk500uploader = 0;
+            finish(FlashFailed, tr("Unable to read the firmware file."));
+        }
+    } else {
+        m_avrdudeuploader = new AvrdudeUploader(this);
+        m_avrdudeuploader->setPortName(m_portName);
+        m_avrdudeuploader->setTracer(m_tracer);
+
+        connect(m_avrdudeuploader,SIGNAL(statusUpdate(QString)),this,SIGNAL(statusUpdate(QString)));
+        connect(m_avrdudeuploader,SIGNAL(flashProgress(qint64,qint64)),this,SIGNAL(progress(qint64,qint64)));
+        connect(m_avrdudeuploader,SIGNAL(error(QString)),this,SLOT(uploaderError(QString)));
+        connect(m_avrdudeuploader,SIGNAL(done()),this,SLOT(uploaderDone()));
+        connect(m_avrdudeuploader,SIGNAL(finished()),this,SLOT(uploaderFinished()));
+
+        m_avrdudeuploader->loadFile(filename);
+    }
+}
+
+void FlashSession::uploaderError(QString error)
+{
+    if (m_uploaderError.isEmpty())
+        m_uploaderError = error;
+}
+
+void FlashSession::uploaderDone()
+{
+    m_uploaderDone = true;
+}
+
+void FlashSession::uploaderFinished()
+{
+    //A prepared board can give up before the firmware is even there
+    abortDownloads();
+    if (m_px4uploader) {
+        m_px4uploader->deleteLater();
+        m_px4uploader = 0;
+    }
+    if (m_avrdudeuploader) {
+        m_avrdudeuploader->deleteLater();
+        m_avrdudeuploader = 0;
+    }
+    if (m_stk500uploader) {
+        m_stk500uploader->deleteLater();
+        m_stk500uploader = 0;
+    }
+
+    if (m_uploaderDone) {
+        finish(Success, tr("Firmware flashed successfully!"));
+    } else if (m_canceled) {
+        finish(Canceled, tr("You canceled the firmware upload!"));
+    } else if (!m_uploaderError.isEmpty()) {
+        finish(FlashFailed, tr("An error occurred while flashing: \n\n%1").arg(m_uploaderError));
+    } else {
+        finish(FlashFailed, tr("Flashing failed, please check the connection to your board and try again."));
+    }
+}
+
+void FlashSession::finish(int result, const QString &message)
+{
+    //The download failed while the board was being prepared
+    if (m_px4uploader) {
+        m_px4uploader->disconnect(this);
+        m_px4uploader->stop();
+        m_px4uploader->deleteLater();
+        m_px4uploader = 0;
+    }
+    m_running = false;
+    writeTrace(result);
+    emit finished(result, message);
+}
+
+void FlashSession::trace(const QString &phase)
+{
+    //One trace per session, from start() or a direct flashFile() on
+    if (!m_tracer && !m_traceDirectory.isEmpty()) {
+        m_tracer = new SessionTracer(m_portName.isEmpty() ? QString("download") : m_portName);
+        m_tracer->setMetadata("port", m_portName);
+    }
+    if (m_tracer)
+        m_tracer->begin(SessionTracer::SessionLane, phase);
+}
+
+void FlashSession::writeTrace(int result)
+{
+    if (!m_tracer)
+        return;
+    m_tracer->setMetadata("result", resultName(result));
+    m_tracer->setMetadata("firmware", this->m_firmwareFileName);
+
+    QString name = m_portName.isEmpty() ? QString("download") : m_portName;
+    name.replace(QRegExp("[^A-Za-z0-9_.-]"), "_");
+    QDir().mkpath(m_traceDirectory);
+    QString fileName = QDir(m_traceDirectory).filePath("flash-" + name + "-"
+            + QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss-zzz") + ".json");
+    if (!m_tracer->write(fileName))
+        qWarning("Unable to write the session trace %s", qPrintable(fileName));
+    delete m_tracer;
+    m_tracer = 0;
+}
@@ -0,0 +1,158 @@
+#ifndef FLASHSESSION_H
+#define FLASHSESSION_H
+
+#include <QObject>
+#include <QTimer>
+
+#include "downloader.h"
+
+class F4BYFirmwareUploader;
+class AvrdudeUploader;
+class Stk500v2Uploader;
+class FirmwareCache;
+class FirmwareCacheWriter;
+class FirmwareStream;
+class SessionTracer;
+
+struct FirmwareRequest
+{
+    QString board;
+    QString rcinput;
+    QString rcmapping;
+    QString platform;
+    QString version;
+    QString gpstype;
+    QString gpsbaud;
+    //Speculative, the server builds it after every real request
+    bool hint;
+
+    FirmwareRequest() : hint(false) {}
+    QString toXml() const;
+};
+
+/**
+ * One complete flash of one board without any widgets involved:
+ * build request to the server, firmware download straight into the
+ * FirmwareCache with the md5 checked on the last byte (or only a delta
+ * against an earlier build of the same config in the cache), and the
+ * actual flashing with F4BYFirmwareUploader, Stk500v2Uploader or, if
+ * asked for, the external avrdude.
+ * fetch() stops after the download, e.g. to hand the firmware to a
+ * FlashScheduler.
+ * F4BY boards are pipelined by default (setPipelined()): start() reboots,
+ * syncs and erases the board while the firmware is built and downloaded.
+ * With a trace directory every session leaves a Chrome trace JSON there:
+ * request, build wait, download and flash on one lane, the steps of the
+ * uploader on a second one.
+ */
+class FlashSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Result {
+        Success = 0,
+        RequestFailed = 2,
+        DownloadFailed = 3,
+        ChecksumMismatch = 4,
+        FlashFailed = 5,
+        Canceled = 6
+    };
+
+    explicit FlashSession(QObject *parent = 0);
+    ~FlashSession();
+
+    void setHexUrl(const QString &hexUrl);
+    void setFirmwareDirectory(const QString &directory);
+    void setCacheBudget(qint64 bytes);
+    void setPortName(const QString &portName);
+    void setF4BY(bool isF4BY);
+    void setProgWindow(int window);
+    void setFastHandshake(bool fastHandshake);
+    void setUseAvrdude(bool useAvrdude);
+    void setDifferentialFlash(bool differential);
+    void setPipelined(bool pipelined);
+    void setTraceDirectory(const QString &directory);
+
+    void start(const FirmwareRequest &request);
+    void fetch(const FirmwareRequest &request);
+    void flashFile(const QString &filename);
+    void cancel();
+
+    QString firmwareFileName() const;
+
+    static QString resultName(int result);
+
+signals:
+    void statusUpdate(QString status);
+    void progress(qint64 current, qint64 total);
+    void requestDevicePlug();
+    void devicePlugDetected();
+    void firmwareReady(QString filename);
+    void finished(int result, QString message);
+
+private slots:
+    void firmwareRequestDone(DownloadsList downloads);
+    void buildStatusDone(DownloadsList downloads);
+    void buildStatusTimedOut();
+    void downloadFinishedFirmware(DownloadsList downloads);
+    void deltaDownloaded(DownloadsList downloads);
+    void firmwareDownloadStarted(int index);
+    void firmwareDataReceived(int index, QByteArray data);
+    void downloadProgressFirmware(qint64 bytesReceived, qint64 bytesTotal);
+    void downloadTimedOut();
+    void retryFirmwareDownload();
+
+    void uploaderError(QString error);
+    void uploaderDone();
+    void uploaderFinished();
+
+private:
+    Downloader *m_downloader;
+    Downloader *m_statusDownloader;
+    QString m_buildState;
+    QTimer *m_retrydownloads;
+    DownloadsList m_currentFirmwareDownloads;
+    QString m_hexUrl;
+    QString m_firmwareDirectoryName;
+    FirmwareCache *m_cache;
+    FirmwareCacheWriter *m_cacheWriter;
+    FirmwareStream *m_stream;
+    bool m_streamOk;
+    qint64 m_cacheBudget;
+    QString m_firmwareFileName;
+    QString m_portName;
+    QString m_uploaderError;
+    F4BYFirmwareUploader *m_px4uploader;
+    AvrdudeUploader *m_avrdudeuploader;
+    Stk500v2Uploader *m_stk500uploader;
+    bool m_isF4BY;
+    int m_progWindow;
+    bool m_fastHandshake;
+    bool m_useAvrdude;
+    bool m_differentialFlash;
+    bool m_pipelined;
+    bool m_uploaderDone;
+    bool m_canceled;
+    bool m_running;
+    bool m_fetchOnly;
+    QString m_traceDirectory;
+    SessionTracer *m_tracer;
+
+    void requestFirmware(const FirmwareRequest &request);
+    void prepareDevice();
+    void createPx4Uploader();
+    void abortDownloads();
+    void firmwareAvailable(const QString &filename);
+    void requestBuildStatus();
+    void startFirmwareDownload(int delay);
+    bool startDeltaDownload();
+    bool applyDelta(const QByteArray &delta, const QString &md5sumReference);
+    void connectFirmwareDownload(bool connected);
+    void discardFirmwareStream();
+    void finish(int result, const QString &message);
+    void trace(const QString &phase);
+    void writeTrace(int result);
+};
+
+#endif // FLASHSESSION_H
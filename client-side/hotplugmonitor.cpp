@@ -0,0 +1,148 @@
+#include "hotplugmonitor.h"
+
+#include <QSocketNotifier>
+#include <QStringList>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+//Poll interval when no hotplug events are available
+#define HOTPLUG_POLL_INTERVAL 250
+//Kernel emits several uevents per USB device, enumerate once after the burst
+#define HOTPLUG_SETTLE_TIME 20
+
+HotplugMonitor *HotplugMonitor::instance()
+{
+    static HotplugMonitor *monitor = 0;
+    if (!monitor)
+        monitor = new HotplugMonitor();
+    return monitor;
+}
+
+HotplugMonitor::HotplugMonitor(QObject *parent) :
+    QObject(parent),
+    m_notifier(0),
+    m_socket(-1)
+{
+    m_ports = QSerialPortInfo::availablePorts();
+
+    m_rescanTimer = new QTimer(this);
+    connect(m_rescanTimer, SIGNAL(timeout()), this, SLOT(rescan()));
+
+    if (openUeventSocket())
+    {
+        m_rescanTimer->setSingleShot(true);
+    }
+    else
+    {
+        m_rescanTimer->start(HOTPLUG_POLL_INTERVAL);
+    }
+}
+
+HotplugMonitor::~HotplugMonitor()
+{
+#ifdef Q_OS_LINUX
+    if (m_socket >= 0)
+        ::close(m_socket);
+#endif
+}
+
+bool HotplugMonitor::openUeventSocket()
+{
+#ifdef Q_OS_LINUX
+    m_socket = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (m_socket < 0)
+        return false;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    addr.nl_groups = 1; //kernel uevents
+    if (::bind(m_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ::close(m_socket);
+        m_socket = -1;
+        return false;
+    }
+
+    m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+    connect(m_notifier, SIGNAL(activated(int)), this, SLOT(readUevents()));
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool HotplugMonitor::isEventDriven() const
+{
+    return m_notifier != 0;
+}
+
+QList<QSerialPortInfo> HotplugMonitor::ports() const
+{
+    return m_ports;
+}
+
+void HotplugMonitor::readUevents()
+{
+#ifdef Q_OS_LINUX
+    char buf[4096];
+    bool ttyChanged = false;
+    for (;;)
+    {
+        ssize_t len = ::recv(m_socket, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (len <= 0)
+            break;
+        buf[len] = 0;
+
+        //"action@devpath" followed by NUL separated KEY=value pairs
+        for (ssize_t i = 0; i < len; i += strlen(buf + i) + 1)
+        {
+            if (strcmp(buf + i, "SUBSYSTEM=tty") == 0)
+            {
+                ttyChanged = true;
+                break;
+            }
+        }
+    }
+    if (ttyChanged && !m_rescanTimer->isActive())
+        m_rescanTimer->start(HOTPLUG_SETTLE_TIME);
+#endif
+}
+
+void HotplugMonitor::rescan()
+{
+    QList<QSerialPortInfo> ports = QSerialPortInfo::availablePorts();
+    QStringList oldNames;
+    QStringList newNames;
+    foreach (QSerialPortInfo info, m_ports)
+        oldNames << info.portName();
+    foreach (QSerialPortInfo info, ports)
+        newNames << info.portName();
+
+    QList<QSerialPortInfo> removed;
+    QList<QSerialPortInfo> added;
+    foreach (QSerialPortInfo info, m_ports)
+    {
+        if (!newNames.contains(info.portName()))
+            removed << info;
+    }
+    foreach (QSerialPortInfo info, ports)
+    {
+        if (!oldNames.contains(info.portName()))
+            added << info;
+    }
+    m_ports = ports;
+
+    foreach (QSerialPortInfo info, removed)
+        emit portRemoved(info);
+    foreach (QSerialPortInfo info, added)
+        emit portAdded(info);
+    if (!removed.isEmpty() || !added.isEmpty())
+        emit portsChanged();
+}
@@ -0,0 +1,51 @@
+#ifndef HOTPLUGMONITOR_H
+#define HOTPLUGMONITOR_H
+
+#include <QObject>
+#include <QList>
+#include <QSerialPortInfo>
+#include <QTimer>
+
+class QSocketNotifier;
+
+/**
+ * Reports serial ports coming and going. On Linux it listens to kernel
+ * uevents on a NETLINK_KOBJECT_UEVENT socket and only enumerates ports
+ * when a tty actually changed; elsewhere it falls back to polling.
+ * portAdded() carries the full QSerialPortInfo, so listeners can match
+ * VID/PID and USB serial number of the re-enumerated device.
+ */
+class HotplugMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    static HotplugMonitor *instance();
+
+    QList<QSerialPortInfo> ports() const;
+    bool isEventDriven() const;
+
+signals:
+    void portAdded(QSerialPortInfo info);
+    void portRemoved(QSerialPortInfo info);
+    void portsChanged();
+
+public slots:
+    void rescan();
+
+private slots:
+    void readUevents();
+
+private:
+    explicit HotplugMonitor(QObject *parent = 0);
+    ~HotplugMonitor();
+
+    QList<QSerialPortInfo> m_ports;
+    QTimer *m_rescanTimer;
+    QSocketNotifier *m_notifier;
+    int m_socket;
+
+    bool openUeventSocket();
+};
+
+#endif // HOTPLUGMONITOR_H
@@ -0,0 +1,349 @@
+#include "intelhex.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <string.h>
+
+//ATmega2560 defaults, the uploader may set others
+#define INTELHEX_DEFAULT_PAGE_SIZE 256
+#define INTELHEX_DEFAULT_FLASH_SIZE (256 * 1024)
+//Data bytes per record written by toText(), like avr-objcopy
+#define INTELHEX_RECORD_SIZE 16
+//Magic, page size, page count, source size and source mtime
+#define INTELHEX_BINARY_HEADER_SIZE 28
+
+static signed char hexTable[256];
+static bool hexTableReady = false;
+
+static void initHexTable()
+{
+    if (hexTableReady)
+        return;
+    memset(hexTable, -1, sizeof(hexTable));
+    for (int i = 0; i < 10; i++)
+        hexTable['0' + i] = i;
+    for (int i = 0; i < 6; i++)
+    {
+        hexTable['A' + i] = 10 + i;
+        hexTable['a' + i] = 10 + i;
+    }
+    hexTableReady = true;
+}
+
+static void appendUInt32(QByteArray &out, quint32 value)
+{
+    out.append((char)(value & 0xFF));
+    out.append((char)((value >> 8) & 0xFF));
+    out.append((char)((value >> 16) & 0xFF));
+    out.append((char)((value >> 24) & 0xFF));
+}
+
+static quint32 readUInt32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((quint32)u[3] << 24);
+}
+
+static void appendRecord(QByteArray &out, int type, unsigned int address, const char *data, int length)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    unsigned char bytes[4 + 255];
+    bytes[0] = length;
+    bytes[1] = (address >> 8) & 0xFF;
+    bytes[2] = address & 0xFF;
+    bytes[3] = type;
+    memcpy(bytes + 4, data, length);
+
+    unsigned char checksum = 0;
+    out.append(':');
+    for (int i = 0; i < 4 + length; i++)
+    {
+        checksum += bytes[i];
+        out.append(digits[bytes[i] >> 4]);
+        out.append(digits[bytes[i] & 0x0F]);
+    }
+    checksum = -checksum;
+    out.append(digits[checksum >> 4]);
+    out.append(digits[checksum & 0x0F]);
+    out.append('\n');
+}
+
+IntelHex::IntelHex() :
+    m_pageSize(INTELHEX_DEFAULT_PAGE_SIZE),
+    m_flashSize(INTELHEX_DEFAULT_FLASH_SIZE)
+{
+}
+
+void IntelHex::setPageSize(int pageSize)
+{
+    m_pageSize = pageSize;
+}
+
+void IntelHex::setFlashSize(int flashSize)
+{
+    m_flashSize = flashSize;
+}
+
+QString IntelHex::binaryPath(const QString &fileName)
+{
+    return fileName + ".bin";
+}
+
+bool IntelHex::setError(int line, const QString &error)
+{
+    if (line > 0)
+        m_errorString = QString("Line %1: %2").arg(line).arg(error);
+    else
+        m_errorString = error;
+    m_image.clear();
+    m_pages.clear();
+    return false;
+}
+
+bool IntelHex::load(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    qint64 size = info.size();
+    qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    if (info.exists() && loadBinary(binaryPath(fileName), size, modified))
+        return true;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        m_errorString = "Cannot open " + fileName + ": " + file.errorString();
+        return false;
+    }
+    if (!parse(file.readAll()))
+        return false;
+    //Only a cache, a read only firmware directory is fine
+    saveBinary(binaryPath(fileName), size, modified);
+    return true;
+}
+
+bool IntelHex::parse(const QByteArray &text)
+{
+    initHexTable();
+    m_image.clear();
+    m_pages.clear();
+    m_errorString.clear();
+
+    if (m_pageSize <= 0 || m_flashSize <= 0 || m_flashSize % m_pageSize != 0)
+        return setError(0, "invalid page or flash size");
+
+    const char *p = text.constData();
+    const char *end = p + text.size();
+    unsigned int base = 0;
+    unsigned int top = 0;
+    int line = 0;
+    bool endOfFile = false;
+    unsigned char record[255 + 5];
+
+    //Whole flash up front, cut down to the last used page at the end
+    m_image.fill((char)0xFF, m_flashSize);
+    m_pages.resize(m_flashSize / m_pageSize);
+
+    while (p < end && !endOfFile)
+    {
+        const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+        if (!lineEnd)
+            lineEnd = end;
+        const char *recordEnd = lineEnd;
+        while (recordEnd > p && (recordEnd[-1] == '\r' || recordEnd[-1] == ' ' || recordEnd[-1] == '\t'))
+            --recordEnd;
+        ++line;
+        if (recordEnd == p)
+        {
+            p = lineEnd + 1;
+            continue;
+        }
+        if (*p != ':' || (recordEnd - p) % 2 != 1 || recordEnd - p < 11 || recordEnd - p > 1 + 2 * (int)sizeof(record))
+            return setError(line, "malformed record");
+
+        int length = (recordEnd - p - 1) / 2;
+        unsigned char checksum = 0;
+        for (int i = 0; i < length; i++)
+        {
+            int high = hexTable[(unsigned char)p[1 + 2 * i]];
+            int low = hexTable[(unsigned char)p[2 + 2 * i]];
+            if (high < 0 || low < 0)
+                return setError(line, "invalid hex digit");
+            record[i] = (high << 4) | low;
+            checksum += record[i];
+        }
+        if (record[0] + 5 != length)
+            return setError(line, "record length mismatch");
+        if (checksum != 0)
+            return setError(line, "checksum error");
+
+        unsigned int address = (record[1] << 8) | record[2];
+        switch (record[3])
+        {
+        case 0x00:
+        {
+            if (record[0] == 0)
+                break;
+            //64 bit, an 0x04 record near 0xFFFF must not wrap past the check
+            quint64 start = (quint64)base + address;
+            quint64 stop = start + record[0];
+            if (stop > (quint64)m_flashSize)
+                return setError(line, QString("data at 0x%1 is beyond the %2 bytes of flash")
+                                .arg(stop - 1, 0, 16).arg(m_flashSize));
+            memcpy(m_image.data() + start, record + 4, record[0]);
+            for (int page = start / m_pageSize; page <= (int)((stop - 1) / m_pageSize); page++)
+                m_pages.setBit(page);
+            if (stop > top)
+                top = (unsigned int)stop;
+            break;
+        }
+        case 0x01:
+            endOfFile = true;
+            break;
+        case 0x02:
+            if (record[0] != 2)
+                return setError(line, "malformed segment address");
+            base = ((record[4] << 8) | record[5]) << 4;
+            break;
+        case 0x04:
+            if (record[0] != 2)
+                return setError(line, "malformed linear address");
+            base = ((record[4] << 8) | record[5]) << 16;
+            break;
+        case 0x03:
+        case 0x05:
+            //Start address, meaningless for the bootloader
+            break;
+        default:
+            return setError(line, "unknown record type");
+        }
+        p = lineEnd + 1;
+    }
+    if (!endOfFile)
+        return setError(line, "missing end of file record, the file is incomplete");
+
+    int pages = (top + m_pageSize - 1) / m_pageSize;
+    m_image.truncate(pages * m_pageSize);
+    m_pages.truncate(pages);
+    return true;
+}
+
+QByteArray IntelHex::toText() const
+{
+    QByteArray out;
+    //Two digits per byte plus 12 characters around every record
+    out.reserve(m_pages.count(true) * m_pageSize * 3 + 32);
+    unsigned int upper = 0;
+    for (int page = 0; page < m_pages.size(); page++)
+    {
+        if (!m_pages.testBit(page))
+            continue;
+        unsigned int address = page * m_pageSize;
+        for (int offset = 0; offset < m_pageSize; offset += INTELHEX_RECORD_SIZE)
+        {
+            unsigned int at = address + offset;
+            if ((at >> 16) != upper)
+            {
+                upper = at >> 16;
+                char linear[2] = { (char)((upper >> 8) & 0xFF), (char)(upper & 0xFF) };
+                appendRecord(out, 0x04, 0, linear, 2);
+            }
+            int length = qMin(INTELHEX_RECORD_SIZE, m_pageSize - offset);
+            appendRecord(out, 0x00, at & 0xFFFF, m_image.constData() + at, length);
+        }
+    }
+    appendRecord(out, 0x01, 0, 0, 0);
+    return out;
+}
+
+bool IntelHex::save(const QString &fileName) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QByteArray text = toText();
+    return file.write(text) == text.size() && file.commit();
+}
+
+bool IntelHex::loadBinary(const QString &fileName, qint64 sourceSize, qint64 sourceModified)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+    const char *p = data.constData();
+    if (data.size() < INTELHEX_BINARY_HEADER_SIZE || memcmp(p, "FTB1", 4) != 0)
+        return false;
+
+    //Stale or made for another target, parse the hex again
+    int pageSize = readUInt32(p + 4);
+    int pageCount = readUInt32(p + 8);
+    qint64 size = readUInt32(p + 12) | ((qint64)readUInt32(p + 16) << 32);
+    qint64 modified = readUInt32(p + 20) | ((qint64)readUInt32(p + 24) << 32);
+    if (pageSize != m_pageSize || size != sourceSize || modified != sourceModified
+            || pageCount < 0 || (qint64)pageCount * pageSize > m_flashSize)
+        return false;
+
+    int bitmapSize = (pageCount + 7) / 8;
+    if (data.size() < INTELHEX_BINARY_HEADER_SIZE + bitmapSize)
+        return false;
+    const unsigned char *bitmap = (const unsigned char *)p + INTELHEX_BINARY_HEADER_SIZE;
+    QBitArray pages(pageCount);
+    int used = 0;
+    for (int page = 0; page < pageCount; page++)
+    {
+        if (bitmap[page / 8] & (1 << (page % 8)))
+        {
+            pages.setBit(page);
+            used++;
+        }
+    }
+    if (data.size() != INTELHEX_BINARY_HEADER_SIZE + bitmapSize + used * pageSize)
+        return false;
+
+    //Only the used pages are stored, holes come back as erased flash
+    m_image.fill((char)0xFF, pageCount * pageSize);
+    const char *pageData = p + INTELHEX_BINARY_HEADER_SIZE + bitmapSize;
+    for (int page = 0; page < pageCount; page++)
+    {
+        if (!pages.testBit(page))
+            continue;
+        memcpy(m_image.data() + page * pageSize, pageData, pageSize);
+        pageData += pageSize;
+    }
+    m_pages = pages;
+    m_errorString.clear();
+    return true;
+}
+
+bool IntelHex::saveBinary(const QString &fileName, qint64 sourceSize, qint64 sourceModified) const
+{
+    QByteArray data;
+    data.reserve(INTELHEX_BINARY_HEADER_SIZE + m_pages.size() / 8 + 1 + m_pages.count(true) * m_pageSize);
+    data.append("FTB1", 4);
+    appendUInt32(data, m_pageSize);
+    appendUInt32(data, m_pages.size());
+    appendUInt32(data, sourceSize & 0xFFFFFFFF);
+    appendUInt32(data, sourceSize >> 32);
+    appendUInt32(data, sourceModified & 0xFFFFFFFF);
+    appendUInt32(data, sourceModified >> 32);
+
+    QByteArray bitmap((m_pages.size() + 7) / 8, 0);
+    for (int page = 0; page < m_pages.size(); page++)
+    {
+        if (m_pages.testBit(page))
+            bitmap[page / 8] = bitmap[page / 8] | (1 << (page % 8));
+    }
+    data.append(bitmap);
+    for (int page = 0; page < m_pages.size(); page++)
+    {
+        if (m_pages.testBit(page))
+            data.append(m_image.constData() + page * m_pageSize, m_pageSize);
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    return file.write(data) == data.size() && file.commit();
+}
@@ -0,0 +1,56 @@
+#ifndef INTELHEX_H
+#define INTELHEX_H
+
+#include <QBitArray>
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Intel HEX reader and writer for the AVR firmwares. Data records are
+ * placed at their (segment/linear extended) address in a page aligned
+ * image starting at address 0. Pages no record touches are holes: they
+ * read as 0xFF like erased flash, but pageUsed() tells them apart so a
+ * programmer can skip them. Every record checksum is checked and data
+ * beyond flashSize() is rejected, so an image that does not fit fails
+ * here and not half way through flashing.
+ *
+ * load() keeps the parsed image as <file>.bin next to the hex (see
+ * binaryPath()) and takes it from there next time as long as the hex
+ * has the same size and modification time.
+ */
+class IntelHex
+{
+public:
+    IntelHex();
+
+    void setPageSize(int pageSize);
+    int pageSize() const { return m_pageSize; }
+    void setFlashSize(int flashSize);
+    int flashSize() const { return m_flashSize; }
+
+    bool load(const QString &fileName);
+    bool parse(const QByteArray &text);
+    bool save(const QString &fileName) const;
+    QByteArray toText() const;
+
+    QByteArray image() const { return m_image; }
+    int pageCount() const { return m_pages.size(); }
+    bool pageUsed(int page) const { return m_pages.testBit(page); }
+    int usedPageCount() const { return m_pages.count(true); }
+    QString errorString() const { return m_errorString; }
+
+    static QString binaryPath(const QString &fileName);
+
+private:
+    int m_pageSize;
+    int m_flashSize;
+    QByteArray m_image;
+    QBitArray m_pages;
+    QString m_errorString;
+
+    bool setError(int line, const QString &error);
+    bool loadBinary(const QString &fileName, qint64 sourceSize, qint64 sourceModified);
+    bool saveBinary(const QString &fileName, qint64 sourceSize, qint64 sourceModified) const;
+};
+
+#endif // INTELHEX_H
@@ -6,93 +6,39 @@ ProgressDialog::ProgressDialog()
     this->setWindowModality(Qt::ApplicationModal);
     this->setWindowFlags(this->windowFlags() & ~Qt::WindowCloseButtonHint);
 
-    this->m_networkManager = new QNetworkAccessManager(this);
-    connect(this->m_networkManager, SIGNAL(finished(QNetworkReply*)), this, SLOT(networkReplyFinished(QNetworkReply*)));
-    this->m_downloadRequestTimeout = new QTimer();
-    connect(m_downloadRequestTimeout, SIGNAL(timeout()), this, SLOT(networkReplyTimedOut()));
+    this->m_downloader = new Downloader(this);
+    connect(this->m_downloader, SIGNAL(downloadsFinished(DownloadsList)), this, SIGNAL(downloadsFinished(DownloadsList)));
+    connect(this->m_downloader, SIGNAL(downloadStarted(int)), this, SLOT(downloaderStarted(int)));
+    connect(this->m_downloader, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(downloaderProgress(qint64,qint64)));
+    connect(this->m_downloader, SIGNAL(timedOut()), this, SIGNAL(canceled()));
     connect(this, SIGNAL(canceled()), this, SLOT(onCanceled()));
 }
 
 void ProgressDialog::startDownloads(Download download)
 {
-    DownloadsList downloads;
-    downloads<<download;
-    startDownloads(downloads);
+    this->m_downloader->startDownloads(download);
 }
 
 void ProgressDialog::startDownloads(DownloadsList downloads)
 {
-    this->m_downloads = downloads;
-    if (this->m_downloads.count() > 0) {
-        this->m_downloadsIndex = 0;
-        doUrlDownload(this->m_downloads[this->m_downloadsIndex]);
-    }
-}
-
-void ProgressDialog::doUrlDownload(Download download)
-{
-    QString userAgent = "FlashTool ";
-    userAgent.append(FLASHTOOL_VERSION);
-    this->reset();
-    QNetworkRequest request;
-    request.setUrl(download.uri);
-    request.setRawHeader("User-Agent", userAgent.toLatin1());
-    request.setRawHeader("Cache-Control", "no-cache");
-    request.setRawHeader("Content-Type", "text/xml");
-
-    if (download.body.isEmpty()) {
-        this->m_networkRequest = this->m_networkManager->get(request);
-    } else {
-        this->m_networkRequest = this->m_networkManager->post(request, download.body.toLatin1());
-    }
-    m_downloadRequestTimeout->start(30000);
-    connect(this->m_networkRequest, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(networkReplyDownloadProgress(qint64,qint64)));
+    this->m_downloader->startDownloads(downloads);
 }
 
 void ProgressDialog::onCanceled()
 {
-    this->m_downloadRequestTimeout->stop();
-    this->m_networkRequest->abort();
+    this->m_downloader->abort();
 }
 
-void ProgressDialog::networkReplyTimedOut()
+void ProgressDialog::downloaderStarted(int index)
 {
-    emit canceled();
-}
-
-void ProgressDialog::networkReplyFinished(QNetworkReply *networkReply)
-{
-    QVariant possibleRedirectUrl = networkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
-    QString redirectUrl = possibleRedirectUrl.toUrl().toString();
-    if (!redirectUrl.isEmpty()) {
-        doUrlDownload(redirectUrl);
-        return;
-    }
-    this->m_downloadRequestTimeout->stop();
-    disconnect(this->m_networkRequest, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(networkReplyDownloadProgress(qint64,qint64)));
-
-    QString filename = QDir::tempPath() + "/flashTool." + QUuid::createUuid().toString();
-    QFile *file = new QFile(filename);
-    if (file->open(QIODevice::ReadWrite)) {
-         file->write(networkReply->readAll());
-    }
-    file->close();
-    this->m_downloads[this->m_downloadsIndex].tmpFile = filename;
-    this->m_downloads[this->m_downloadsIndex].success = (networkReply->error() == QNetworkReply::NoError);
-
-    this->m_downloadsIndex++;
-    if (this->m_downloads.count() > this->m_downloadsIndex) {
-        doUrlDownload(this->m_downloads[this->m_downloadsIndex].uri);
-    } else {
-        emit downloadsFinished(this->m_downloads);
-    }
+    //Progress is summed over the whole list, start over only once
+    if (index == 0)
+        this->reset();
 }
 
-void ProgressDialog::networkReplyDownloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+void ProgressDialog::downloaderProgress(qint64 bytesReceived, qint64 bytesTotal)
 {
     emit downloadProgress();
     this->setMaximum(bytesTotal);
     this->setValue(bytesReceived);
-    this->m_downloadRequestTimeout->stop();
-    this->m_downloadRequestTimeout->start(30000);
 }
@@ -0,0 +1,248 @@
+#include "px4image.h"
+
+#include <QFile>
+#include <string.h>
+#include <zlib.h>
+
+//Base64 is decoded in pieces of this size before it is handed to inflate()
+#define PX4_DECODE_CHUNK 49152
+//"image_size" is taken from the file, anything beyond any F4BY flash is rejected
+#define PX4_MAX_IMAGE_SIZE (16 * 1024 * 1024)
+
+static const char *skipSpace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        ++p;
+    return p;
+}
+
+static const char *stringEnd(const char *p, const char *end)
+{
+    //p is behind the opening quote, returns the closing one or end
+    for (;;)
+    {
+        const char *quote = (const char *)memchr(p, '"', end - p);
+        if (!quote)
+            return end;
+        const char *escape = quote;
+        while (escape > p && escape[-1] == '\\')
+            --escape;
+        if ((quote - escape) % 2 == 0)
+            return quote;
+        p = quote + 1;
+    }
+}
+
+static bool parseNumber(const char *p, const char *end, unsigned int *value)
+{
+    //Saturates instead of wrapping, callers range check the value
+    quint64 result = 0;
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        result = result * 10 + (*p++ - '0');
+        if (result > 0xFFFFFFFFu)
+            result = 0xFFFFFFFFu;
+    }
+    *value = (unsigned int)result;
+    return p != start;
+}
+
+static QString unescape(const char *begin, const char *end)
+{
+    QByteArray text;
+    text.reserve(end - begin);
+    for (const char *p = begin; p < end; ++p)
+    {
+        if (*p == '\\' && p + 1 < end)
+        {
+            ++p;
+            switch (*p)
+            {
+            case 'n': text.append('\n'); break;
+            case 't': text.append('\t'); break;
+            case 'r': text.append('\r'); break;
+            default: text.append(*p); break;
+            }
+            continue;
+        }
+        text.append(*p);
+    }
+    return QString::fromUtf8(text).trimmed();
+}
+
+Px4Image::Px4Image() :
+    m_boardId(0),
+    m_imageSize(0)
+{
+}
+
+bool Px4Image::setError(const QString &error)
+{
+    m_errorString = error;
+    m_image.clear();
+    return false;
+}
+
+bool Px4Image::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return setError("Cannot open " + fileName + ": " + file.errorString());
+
+    qint64 size = file.size();
+    uchar *mapped = file.map(0, size);
+    if (mapped)
+    {
+        bool ok = decode((const char *)mapped, size);
+        file.unmap(mapped);
+        return ok;
+    }
+    //Mapping is not available everywhere, e.g. on some network shares
+    QByteArray data = file.readAll();
+    return decode(data.constData(), data.size());
+}
+
+bool Px4Image::decode(const char *data, qint64 size)
+{
+    const char *end = data + size;
+    const char *image = 0;
+    const char *imageEnd = 0;
+    bool haveBoardId = false;
+    bool haveImageSize = false;
+    bool haveDescription = false;
+
+    m_boardId = 0;
+    m_imageSize = 0;
+    m_description.clear();
+    m_image.clear();
+    m_errorString.clear();
+
+    //One pass over the text: every "key": pair is looked at, string values
+    //are skipped with memchr(). The container is flat, nesting does not matter.
+    const char *p = data;
+    while (p < end)
+    {
+        const char *quote = (const char *)memchr(p, '"', end - p);
+        if (!quote)
+            break;
+        const char *key = quote + 1;
+        const char *keyEnd = stringEnd(key, end);
+        if (keyEnd == end)
+            break;
+        p = skipSpace(keyEnd + 1, end);
+        if (p == end || *p != ':')
+            continue;
+        p = skipSpace(p + 1, end);
+        int keyLength = keyEnd - key;
+
+        if (keyLength == 8 && memcmp(key, "board_id", 8) == 0)
+        {
+            haveBoardId = parseNumber(p, end, &m_boardId);
+        }
+        else if (keyLength == 10 && memcmp(key, "image_size", 10) == 0)
+        {
+            haveImageSize = parseNumber(p, end, &m_imageSize);
+        }
+        else if (p < end && *p == '"')
+        {
+            const char *value = p + 1;
+            const char *valueEnd = stringEnd(value, end);
+            if (keyLength == 11 && memcmp(key, "description", 11) == 0)
+            {
+                m_description = unescape(value, valueEnd);
+                haveDescription = true;
+            }
+            else if (keyLength == 5 && memcmp(key, "image", 5) == 0)
+            {
+                image = value;
+                imageEnd = valueEnd;
+            }
+            p = valueEnd + 1;
+        }
+    }
+
+    if (!haveBoardId)
+        return setError("Error parsing BOARD ID from .px4 file");
+    if (!haveImageSize)
+        return setError("Error parsing IMAGE SIZE from .px4 file");
+    if (m_imageSize == 0 || m_imageSize > PX4_MAX_IMAGE_SIZE)
+        return setError(QString("Invalid IMAGE SIZE %1 in .px4 file").arg(m_imageSize));
+    if (!haveDescription)
+        return setError("Error parsing DESCRIPTION from .px4 file");
+    if (!image || imageEnd == end)
+        return setError("Error parsing IMAGE from .px4 file");
+    return inflateImage(image, imageEnd);
+}
+
+bool Px4Image::inflateImage(const char *begin, const char *end)
+{
+    static signed char decodeTable[256];
+    static bool decodeTableReady = false;
+    if (!decodeTableReady)
+    {
+        const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        memset(decodeTable, -1, sizeof(decodeTable));
+        for (int i = 0; i < 64; i++)
+            decodeTable[(unsigned char)alphabet[i]] = i;
+        decodeTableReady = true;
+    }
+
+    //Per QUpgrade, pad it to a 4 byte multiple
+    qint64 padded = ((qint64)m_imageSize + 3) & ~(qint64)3;
+    m_image.resize((int)padded);
+    memset(m_image.data() + m_imageSize, 0xFF, padded - m_imageSize);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+        return setError("Error in decompressing firmware. Please re-download and try again");
+    stream.next_out = (Bytef *)m_image.data();
+    stream.avail_out = m_imageSize;
+
+    unsigned char chunk[PX4_DECODE_CHUNK];
+    unsigned int bits = 0;
+    int bitCount = 0;
+    int result = Z_OK;
+    const char *p = begin;
+    while (result == Z_OK && p < end)
+    {
+        int length = 0;
+        while (p < end && length < PX4_DECODE_CHUNK)
+        {
+            unsigned char c = *p++;
+            if (c == '\\')
+            {
+                //JSON escaped line break or slash inside the string
+                if (p < end && *p != '/')
+                    ++p;
+                continue;
+            }
+            int value = decodeTable[c];
+            if (value < 0)
+                continue;
+            bits = (bits << 6) | value;
+            bitCount += 6;
+            if (bitCount >= 8)
+            {
+                bitCount -= 8;
+                chunk[length++] = (bits >> bitCount) & 0xFF;
+            }
+        }
+        stream.next_in = chunk;
+        stream.avail_in = length;
+        while (stream.avail_in > 0 && result == Z_OK)
+        {
+            result = inflate(&stream, Z_NO_FLUSH);
+            if (result == Z_OK && stream.avail_out == 0 && stream.avail_in > 0)
+                result = Z_BUF_ERROR;
+        }
+    }
+    unsigned int written = stream.total_out;
+    inflateEnd(&stream);
+
+    //QLOG_INFO() << "Firmware size:" << written << "expected" << m_imageSize << "bytes";
+    if (result != Z_STREAM_END || written != m_imageSize)
+        return setError("Error in decompressing firmware. Please re-download and try again");
+    return true;
+}
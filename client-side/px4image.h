@@ -0,0 +1,41 @@
+#ifndef PX4IMAGE_H
+#define PX4IMAGE_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Decoder for the .px4 firmware container, a JSON object whose "image"
+ * member is the base64 encoded, zlib compressed binary. The file is
+ * mapped, scanned once for the keys, and the image is base64 decoded in
+ * small chunks straight into inflate(), which writes into one buffer
+ * preallocated from "image_size". No temporary files and no copies of
+ * the JSON text are made.
+ */
+class Px4Image
+{
+public:
+    Px4Image();
+
+    bool load(const QString &fileName);
+    bool decode(const char *data, qint64 size);
+
+    QString errorString() const { return m_errorString; }
+    unsigned int boardId() const { return m_boardId; }
+    unsigned int imageSize() const { return m_imageSize; }
+    QString description() const { return m_description; }
+    // Padded with 0xFF to a multiple of 4 bytes, as the bootloader wants it
+    QByteArray image() const { return m_image; }
+
+private:
+    unsigned int m_boardId;
+    unsigned int m_imageSize;
+    QString m_description;
+    QByteArray m_image;
+    QString m_errorString;
+
+    bool inflateImage(const char *begin, const char *end);
+    bool setError(const QString &error);
+};
+
+#endif // PX4IMAGE_H
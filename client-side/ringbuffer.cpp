@@ -0,0 +1,80 @@
+#include "ringbuffer.h"
+
+#include <string.h>
+
+ByteRingBuffer::ByteRingBuffer(int capacity) :
+    m_head(0),
+    m_size(0)
+{
+    int cap = 16;
+    while (cap < capacity)
+        cap <<= 1;
+    m_data.resize(cap);
+    m_mask = cap - 1;
+}
+
+void ByteRingBuffer::clear()
+{
+    m_head = 0;
+    m_size = 0;
+}
+
+void ByteRingBuffer::grow(int minCapacity)
+{
+    int cap = m_data.size();
+    while (cap < minCapacity)
+        cap <<= 1;
+    if (cap == m_data.size())
+        return;
+
+    QVector<unsigned char> data(cap);
+    peek(reinterpret_cast<char*>(data.data()), m_size);
+    m_data = data;
+    m_mask = cap - 1;
+    m_head = 0;
+}
+
+void ByteRingBuffer::append(const char *data, int len)
+{
+    if (len <= 0)
+        return;
+    grow(m_size + len);
+
+    int tail = (m_head + m_size) & m_mask;
+    int first = qMin(len, m_data.size() - tail);
+    memcpy(m_data.data() + tail, data, first);
+    memcpy(m_data.data(), data + first, len - first);
+    m_size += len;
+}
+
+int ByteRingBuffer::peek(char *data, int len) const
+{
+    len = qMin(len, m_size);
+    int first = qMin(len, m_data.size() - m_head);
+    memcpy(data, m_data.constData() + m_head, first);
+    memcpy(data + first, m_data.constData(), len - first);
+    return len;
+}
+
+int ByteRingBuffer::read(char *data, int len)
+{
+    len = peek(data, len);
+    skip(len);
+    return len;
+}
+
+QByteArray ByteRingBuffer::read(int len)
+{
+    QByteArray result(qMin(len, m_size), Qt::Uninitialized);
+    read(result.data(), result.size());
+    return result;
+}
+
+void ByteRingBuffer::skip(int len)
+{
+    len = qMin(len, m_size);
+    m_head = (m_head + len) & m_mask;
+    m_size -= len;
+    if (m_size == 0)
+        m_head = 0;
+}
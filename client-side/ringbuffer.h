@@ -0,0 +1,39 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QVector>
+
+/**
+ * Byte FIFO for serial RX data. Reading from the front only moves an
+ * index, the storage grows in powers of two and is never shifted.
+ */
+class ByteRingBuffer
+{
+public:
+    explicit ByteRingBuffer(int capacity = 4096);
+
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    void clear();
+
+    void append(const char *data, int len);
+    void append(const QByteArray &data) { append(data.constData(), data.size()); }
+
+    unsigned char at(int index) const { return m_data[(m_head + index) & m_mask]; }
+    int peek(char *data, int len) const;
+    int read(char *data, int len);
+    QByteArray read(int len);
+    void skip(int len);
+
+private:
+    QVector<unsigned char> m_data;
+    int m_mask;
+    int m_head;
+    int m_size;
+
+    void grow(int minCapacity);
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,192 @@
+#include "seriallink.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+
+SerialLink::SerialLink(QObject *parent) :
+    QObject(parent),
+    m_port(0),
+    m_expected(-1),
+    m_quietTime(-1),
+    m_quietTimeout(0)
+{
+    m_expectTimer = new QTimer(this);
+    m_expectTimer->setSingleShot(true);
+    connect(m_expectTimer, SIGNAL(timeout()), this, SLOT(expectTimedOut()));
+    m_quietTimer = new QTimer(this);
+    m_quietTimer->setSingleShot(true);
+    connect(m_quietTimer, SIGNAL(timeout()), this, SLOT(quietTimedOut()));
+}
+
+SerialLink::~SerialLink()
+{
+    close();
+}
+
+bool SerialLink::open(const QString &portName, qint32 baudRate)
+{
+    close();
+    m_port = new QSerialPort(this);
+    m_port->setPortName(portName);
+    if (!m_port->open(QIODevice::ReadWrite))
+    {
+        m_errorString = m_port->errorString();
+        delete m_port;
+        m_port = 0;
+        return false;
+    }
+    m_port->setBaudRate(baudRate);
+    m_port->setDataBits(QSerialPort::Data8);
+    m_port->setStopBits(QSerialPort::OneStop);
+    m_port->setParity(QSerialPort::NoParity);
+    m_port->setFlowControl(QSerialPort::NoFlowControl);
+    m_port->setTextModeEnabled(false);
+
+    connect(m_port, SIGNAL(readyRead()), this, SLOT(portReadyRead()));
+    connect(m_port, SIGNAL(bytesWritten(qint64)), this, SLOT(portBytesWritten(qint64)));
+    m_buffer.clear();
+    return true;
+}
+
+void SerialLink::close()
+{
+    cancelExpect();
+    m_quietTime = -1;
+    m_quietTimer->stop();
+    if (!m_port)
+        return;
+    m_port->disconnect(this);
+    m_port->close();
+    m_port->deleteLater();
+    m_port = 0;
+}
+
+bool SerialLink::isOpen() const
+{
+    return m_port != 0;
+}
+
+QString SerialLink::portName() const
+{
+    return m_port ? m_port->portName() : QString();
+}
+
+QString SerialLink::errorString() const
+{
+    return m_errorString;
+}
+
+void SerialLink::send(const QByteArray &data)
+{
+    if (m_port)
+        m_port->write(data);
+}
+
+qint64 SerialLink::bytesToWrite() const
+{
+    return m_port ? m_port->bytesToWrite() : 0;
+}
+
+bool SerialLink::setLowLatency(bool enable)
+{
+#ifdef Q_OS_LINUX
+    //Makes the tty layer push every received byte immediately instead of
+    //batching them, cuts the reply latency of small bootloader frames
+    if (!m_port)
+        return false;
+    struct serial_struct serial;
+    int fd = m_port->handle();
+    if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+        return false;
+    if (enable)
+        serial.flags |= ASYNC_LOW_LATENCY;
+    else
+        serial.flags &= ~ASYNC_LOW_LATENCY;
+    return ioctl(fd, TIOCSSERIAL, &serial) == 0;
+#else
+    Q_UNUSED(enable);
+    return false;
+#endif
+}
+
+void SerialLink::expect(int bytes, int timeout)
+{
+    m_expected = bytes;
+    if (m_buffer.size() >= m_expected)
+    {
+        //Already there, still report asynchronously to keep callers simple
+        m_expectTimer->start(0);
+        return;
+    }
+    m_expectTimer->start(timeout);
+}
+
+void SerialLink::cancelExpect()
+{
+    m_expected = -1;
+    m_expectTimer->stop();
+}
+
+void SerialLink::drain()
+{
+    if (m_port)
+    {
+        m_buffer.append(m_port->readAll());
+        m_port->clear(QSerialPort::Input);
+    }
+    m_buffer.clear();
+}
+
+void SerialLink::waitQuiet(int quietTime, int timeout)
+{
+    //Discards input until the line was silent for quietTime ms, but
+    //reports quiet() after timeout ms at the latest
+    drain();
+    m_quietTime = quietTime;
+    m_quietTimeout = timeout;
+    m_quietElapsed.start();
+    m_quietTimer->start(qMin(quietTime, timeout));
+}
+
+void SerialLink::portReadyRead()
+{
+    m_buffer.append(m_port->readAll());
+    if (m_quietTime >= 0)
+    {
+        m_buffer.clear();
+        int left = m_quietTimeout - (int)m_quietElapsed.elapsed();
+        m_quietTimer->start(qBound(0, left, m_quietTime));
+        return;
+    }
+    if (m_expected >= 0 && m_buffer.size() >= m_expected)
+    {
+        cancelExpect();
+        emit ready();
+    }
+}
+
+void SerialLink::portBytesWritten(qint64 /*bytes*/)
+{
+    if (m_port && m_port->bytesToWrite() == 0)
+        emit allWritten();
+}
+
+void SerialLink::expectTimedOut()
+{
+    int expected = m_expected;
+    m_expected = -1;
+    if (expected >= 0 && m_buffer.size() >= expected)
+        emit ready();
+    else
+        emit timeout();
+}
+
+void SerialLink::quietTimedOut()
+{
+    if (m_quietTime < 0)
+        return;
+    m_quietTime = -1;
+    emit quiet();
+}
@@ -0,0 +1,68 @@
+#ifndef SERIALLINK_H
+#define SERIALLINK_H
+
+#include <QObject>
+#include <QSerialPort>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "ringbuffer.h"
+
+/**
+ * Non blocking serial transport for the bootloader protocols. RX data is
+ * collected in a ByteRingBuffer from QSerialPort::readyRead; a protocol
+ * arms expect() and gets ready() once enough bytes arrived or timeout()
+ * when they did not. Everything runs in the event loop of the owning
+ * thread, so one thread can drive any number of links.
+ */
+class SerialLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SerialLink(QObject *parent = 0);
+    ~SerialLink();
+
+    bool open(const QString &portName, qint32 baudRate = QSerialPort::Baud115200);
+    void close();
+    bool isOpen() const;
+    QString portName() const;
+    QString errorString() const;
+    QSerialPort *port() const { return m_port; }
+
+    void send(const QByteArray &data);
+    qint64 bytesToWrite() const;
+    bool setLowLatency(bool enable);
+
+    void expect(int bytes, int timeout);
+    void cancelExpect();
+    void drain();
+    void waitQuiet(int quietTime, int timeout);
+
+    ByteRingBuffer &buffer() { return m_buffer; }
+
+signals:
+    void ready();
+    void timeout();
+    void allWritten();
+    void quiet();
+
+private slots:
+    void portReadyRead();
+    void portBytesWritten(qint64 bytes);
+    void expectTimedOut();
+    void quietTimedOut();
+
+private:
+    QSerialPort *m_port;
+    ByteRingBuffer m_buffer;
+    QTimer *m_expectTimer;
+    int m_expected;
+    QTimer *m_quietTimer;
+    QElapsedTimer m_quietElapsed;
+    int m_quietTime;
+    int m_quietTimeout;
+    QString m_errorString;
+};
+
+#endif // SERIALLINK_H
@@ -0,0 +1,188 @@
+#include "sessiontracer.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QSysInfo>
+#include <algorithm>
+
+//Upper bounds of the histogram buckets in microseconds, the last is open
+static const qint64 histogramBounds[] = { 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000 };
+static const int histogramBuckets = sizeof(histogramBounds) / sizeof(histogramBounds[0]);
+
+SessionTracer::SessionTracer(const QString &name) :
+    m_name(name)
+{
+    m_timer.start();
+    m_metadata.insert("session", name);
+    m_metadata.insert("started", QDateTime::currentDateTime().toString(Qt::ISODate));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    m_metadata.insert("host", QSysInfo::machineHostName());
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    m_metadata.insert("os", QSysInfo::prettyProductName());
+#endif
+    m_metadata.insert("flashtool", QString(FLASHTOOL_VERSION));
+}
+
+qint64 SessionTracer::now() const
+{
+    return m_timer.nsecsElapsed() / 1000;
+}
+
+SessionTracer::Span &SessionTracer::lane(int lane)
+{
+    if (lane >= m_lanes.size())
+        m_lanes.resize(lane + 1);
+    return m_lanes[lane];
+}
+
+void SessionTracer::begin(int laneId, const QString &name)
+{
+    end(laneId);
+    Span &span = lane(laneId);
+    span.name = name;
+    span.start = now();
+    span.args = QJsonObject();
+    span.open = true;
+}
+
+void SessionTracer::end(int laneId)
+{
+    Span &span = lane(laneId);
+    if (!span.open)
+        return;
+    span.open = false;
+
+    //Complete event, timestamps in microseconds
+    QJsonObject event;
+    event.insert("name", span.name);
+    event.insert("cat", laneId == SessionLane ? "session" : "device");
+    event.insert("ph", "X");
+    event.insert("ts", (double)span.start);
+    event.insert("dur", (double)(now() - span.start));
+    event.insert("pid", (double)QCoreApplication::applicationPid());
+    event.insert("tid", laneId);
+    if (!span.args.isEmpty())
+        event.insert("args", span.args);
+    m_events.append(event);
+}
+
+void SessionTracer::setArg(int laneId, const QString &key, const QJsonValue &value)
+{
+    Span &span = lane(laneId);
+    if (span.open)
+        span.args.insert(key, value);
+}
+
+void SessionTracer::addArg(int laneId, const QString &key, int count)
+{
+    Span &span = lane(laneId);
+    if (span.open)
+        span.args.insert(key, span.args.value(key).toInt() + count);
+}
+
+void SessionTracer::instant(int laneId, const QString &name, const QJsonObject &args)
+{
+    QJsonObject event;
+    event.insert("name", name);
+    event.insert("ph", "i");
+    event.insert("s", "t");
+    event.insert("ts", (double)now());
+    event.insert("pid", (double)QCoreApplication::applicationPid());
+    event.insert("tid", laneId);
+    if (!args.isEmpty())
+        event.insert("args", args);
+    m_events.append(event);
+}
+
+void SessionTracer::setMetadata(const QString &key, const QString &value)
+{
+    m_metadata.insert(key, value);
+}
+
+QJsonObject SessionTracer::toJson() const
+{
+    QJsonArray events;
+    double pid = QCoreApplication::applicationPid();
+
+    //Track names for the viewers
+    QJsonObject process;
+    process.insert("name", "process_name");
+    process.insert("ph", "M");
+    process.insert("pid", pid);
+    QJsonObject processArgs;
+    processArgs.insert("name", "FlashTool " + m_name);
+    process.insert("args", processArgs);
+    events.append(process);
+    const char *laneNames[] = { "", "session", "device" };
+    for (int lane = SessionLane; lane <= DeviceLane; lane++) {
+        QJsonObject thread;
+        thread.insert("name", "thread_name");
+        thread.insert("ph", "M");
+        thread.insert("pid", pid);
+        thread.insert("tid", lane);
+        QJsonObject threadArgs;
+        threadArgs.insert("name", laneNames[lane]);
+        thread.insert("args", threadArgs);
+        events.append(thread);
+    }
+    for (int i = 0; i < m_events.size(); i++)
+        events.append(m_events[i]);
+
+    QJsonObject trace;
+    trace.insert("traceEvents", events);
+    trace.insert("displayTimeUnit", "ms");
+    trace.insert("otherData", m_metadata);
+    return trace;
+}
+
+bool SessionTracer::write(const QString &fileName)
+{
+    for (int lane = 0; lane < m_lanes.size(); lane++)
+        end(lane);
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QByteArray json = QJsonDocument(toJson()).toJson(QJsonDocument::Compact);
+    return file.write(json) == json.size() && file.commit();
+}
+
+QJsonObject SessionTracer::histogram(const QVector<qint64> &samplesUs)
+{
+    QJsonObject result;
+    result.insert("count", samplesUs.size());
+    if (samplesUs.isEmpty())
+        return result;
+
+    QVector<qint64> sorted = samplesUs;
+    std::sort(sorted.begin(), sorted.end());
+    qint64 sum = 0;
+    int counts[histogramBuckets + 1] = { 0 };
+    for (int i = 0; i < sorted.size(); i++) {
+        sum += sorted[i];
+        int bucket = 0;
+        while (bucket < histogramBuckets && sorted[i] >= histogramBounds[bucket])
+            bucket++;
+        counts[bucket]++;
+    }
+
+    QJsonObject buckets;
+    for (int bucket = 0; bucket <= histogramBuckets; bucket++) {
+        if (!counts[bucket])
+            continue;
+        QString label = bucket < histogramBuckets
+                ? QString("<%1us").arg(histogramBounds[bucket], 6, 10, QChar('0'))
+                : QString(">=%1us").arg(histogramBounds[histogramBuckets - 1]);
+        buckets.insert(label, counts[bucket]);
+    }
+    result.insert("buckets", buckets);
+    result.insert("min_us", (double)sorted.first());
+    result.insert("mean_us", (double)(sum / sorted.size()));
+    result.insert("p50_us", (double)sorted[sorted.size() / 2]);
+    result.insert("p95_us", (double)sorted[qMin(sorted.size() - 1, sorted.size() * 95 / 100)]);
+    result.insert("max_us", (double)sorted.last());
+    return result;
+}
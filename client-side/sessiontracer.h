@@ -0,0 +1,61 @@
+#ifndef SESSIONTRACER_H
+#define SESSIONTRACER_H
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+/**
+ * Timestamped spans of one flash session, written as a Chrome trace
+ * (chrome://tracing, ui.perfetto.dev). Every lane is a track of its own
+ * with at most one open span: begin() closes the previous span of the
+ * lane, so a state machine only has to name the phase it enters, retries
+ * included. The session and the device get separate lanes, they may
+ * overlap. Only created when tracing is asked for, so uploaders check
+ * for a null tracer.
+ */
+class SessionTracer
+{
+public:
+    enum Lane {
+        SessionLane = 1,
+        DeviceLane = 2
+    };
+
+    explicit SessionTracer(const QString &name);
+
+    void begin(int lane, const QString &name);
+    void end(int lane);
+    void setArg(int lane, const QString &key, const QJsonValue &value);
+    void addArg(int lane, const QString &key, int count = 1);
+    void instant(int lane, const QString &name, const QJsonObject &args = QJsonObject());
+    void setMetadata(const QString &key, const QString &value);
+
+    QJsonObject toJson() const;
+    bool write(const QString &fileName);
+
+    //Bucket counts plus min, mean, p50, p95 and max of samples in microseconds
+    static QJsonObject histogram(const QVector<qint64> &samplesUs);
+
+private:
+    struct Span {
+        Span() : start(0), open(false) {}
+        QString name;
+        qint64 start;
+        QJsonObject args;
+        bool open;
+    };
+
+    QString m_name;
+    QElapsedTimer m_timer;
+    QJsonArray m_events;
+    QJsonObject m_metadata;
+    QVector<Span> m_lanes;
+
+    qint64 now() const;
+    Span &lane(int lane);
+};
+
+#endif // SESSIONTRACER_H
@@ -0,0 +1,573 @@
+#include "stk500v2uploader.h"
+#include "intelhex.h"
+#include "sessiontracer.h"
+
+#include <string.h>
+
+#define MESSAGE_START 0x1B
+#define TOKEN 0x0E
+#define CMD_SIGN_ON 0x01
+#define CMD_LOAD_ADDRESS 0x06
+#define CMD_ENTER_PROGMODE_ISP 0x10
+#define CMD_LEAVE_PROGMODE_ISP 0x11
+#define CMD_PROGRAM_FLASH_ISP 0x13
+#define CMD_READ_FLASH_ISP 0x14
+#define CMD_READ_SIGNATURE_ISP 0x1B
+#define STATUS_CMD_OK 0x00
+
+//ATmega2560 as avrdude.conf describes it
+#define AVR_PAGE_SIZE 256
+#define AVR_FLASH_SIZE (256 * 1024)
+#define AVR_PAGE_MODE 0xC1
+#define AVR_PAGE_DELAY 10
+#define AVR_CMD_LOADPAGE_LO 0x40
+#define AVR_CMD_WRITEPAGE 0x4C
+#define AVR_CMD_READ_LO 0x20
+static const unsigned char AVR_SIGNATURE[] = { 0x1E, 0x98, 0x01 };
+
+#define SYNC_TRIES 10
+#define SYNC_TIMEOUT 300
+#define RESET_PULSE 50
+
+Stk500v2Uploader::Stk500v2Uploader(QObject *parent) : QObject(parent)
+{
+    m_running = false;
+    m_delayStep = 0;
+    m_replyHandler = 0;
+    m_sequence = 0;
+    m_replyTimeout = 0;
+    m_syncTries = 0;
+    m_address = 0;
+    m_differential = false;
+    m_pageIndex = 0;
+    m_progress = 0;
+    m_progressTotal = 0;
+    m_tracer = 0;
+
+    m_link = new SerialLink(this);
+    connect(m_link, SIGNAL(ready()), this, SLOT(linkReady()));
+    connect(m_link, SIGNAL(timeout()), this, SLOT(linkTimeout()));
+
+    m_delayTimer = new QTimer(this);
+    m_delayTimer->setSingleShot(true);
+    connect(m_delayTimer, SIGNAL(timeout()), this, SLOT(delayElapsed()));
+}
+
+void Stk500v2Uploader::setPortName(const QString &portName)
+{
+    m_portName = portName;
+}
+
+void Stk500v2Uploader::setDifferential(bool differential)
+{
+    m_differential = differential;
+}
+
+void Stk500v2Uploader::setTracer(SessionTracer *tracer)
+{
+    m_tracer = tracer;
+}
+
+bool Stk500v2Uploader::isRunning() const
+{
+    return m_running;
+}
+
+bool Stk500v2Uploader::loadFile(QString file)
+{
+    //Checked against the flash size before the port is even opened
+    IntelHex hex;
+    hex.setPageSize(AVR_PAGE_SIZE);
+    hex.setFlashSize(AVR_FLASH_SIZE);
+    if (!hex.load(file))
+    {
+        emit statusUpdate(hex.errorString());
+        return false;
+    }
+    if (hex.usedPageCount() == 0)
+    {
+        emit statusUpdate(tr("The firmware file contains no data."));
+        return false;
+    }
+    m_image = hex.image();
+    m_usedPages.clear();
+    for (int page = 0; page < hex.pageCount(); page++)
+    {
+        if (hex.pageUsed(page))
+            m_usedPages.append(page * AVR_PAGE_SIZE);
+    }
+
+    //Full mode writes every used page, differential mode only what the read back finds changed
+    m_pages.clear();
+    if (!m_differential)
+        m_pages = m_usedPages;
+    m_progress = 0;
+    m_progressTotal = (m_differential ? 3 : 2) * (qint64)m_usedPages.count() * AVR_PAGE_SIZE;
+
+    m_running = true;
+    emit statusUpdate(tr("Starting flashing process..."));
+    delay(0, &Stk500v2Uploader::stepOpen);
+    return true;
+}
+
+void Stk500v2Uploader::stop()
+{
+    if (m_running)
+        finish();
+}
+
+void Stk500v2Uploader::finish()
+{
+    m_running = false;
+    m_delayTimer->stop();
+    m_delayStep = 0;
+    m_replyHandler = 0;
+    m_link->close();
+    if (m_tracer)
+        m_tracer->end(SessionTracer::DeviceLane);
+    emit finished();
+}
+
+void Stk500v2Uploader::trace(const QString &phase)
+{
+    if (m_tracer)
+        m_tracer->begin(SessionTracer::DeviceLane, phase);
+}
+
+void Stk500v2Uploader::traceCount(const QString &key)
+{
+    if (m_tracer)
+        m_tracer->addArg(SessionTracer::DeviceLane, key);
+}
+
+void Stk500v2Uploader::fail(const QString &message)
+{
+    if (m_tracer)
+        m_tracer->setArg(SessionTracer::DeviceLane, "error", message);
+    emit statusUpdate(message);
+    emit error(message);
+    finish();
+}
+
+void Stk500v2Uploader::delay(int ms, Step step)
+{
+    m_delayStep = step;
+    m_delayTimer->start(ms);
+}
+
+void Stk500v2Uploader::delayElapsed()
+{
+    Step step = m_delayStep;
+    m_delayStep = 0;
+    if (step)
+        (this->*step)();
+}
+
+void Stk500v2Uploader::transact(const QByteArray &body, int timeout, ReplyHandler handler)
+{
+    //MESSAGE_START, SEQUENCE, SIZE (big endian), TOKEN, body, xor checksum
+    QByteArray frame;
+    frame.reserve(body.size() + 6);
+    frame.append((char)MESSAGE_START);
+    frame.append((char)++m_sequence);
+    frame.append((char)((body.size() >> 8) & 0xFF));
+    frame.append((char)(body.size() & 0xFF));
+    frame.append((char)TOKEN);
+    frame.append(body);
+    char checksum = 0;
+    for (int i = 0; i < frame.size(); i++)
+        checksum ^= frame[i];
+    frame.append(checksum);
+
+    m_replyHandler = handler;
+    m_replyTimeout = timeout;
+    m_link->send(frame);
+    m_link->expect(5, timeout);
+}
+
+void Stk500v2Uploader::linkReady()
+{
+    if (!m_replyHandler)
+        return;
+
+    ByteRingBuffer &rx = m_link->buffer();
+    while (!rx.isEmpty() && rx.at(0) != MESSAGE_START)
+        rx.skip(1);
+    if (rx.size() < 5)
+    {
+        m_link->expect(5, m_replyTimeout);
+        return;
+    }
+    int size = (rx.at(2) << 8) | rx.at(3);
+    int total = 5 + size + 1;
+    if (rx.size() < total)
+    {
+        m_link->expect(total, m_replyTimeout);
+        return;
+    }
+
+    QByteArray frame = rx.read(total);
+    char checksum = 0;
+    for (int i = 0; i < frame.size(); i++)
+        checksum ^= frame[i];
+    bool ok = (checksum == 0
+               && (unsigned char)frame[1] == m_sequence
+               && frame[4] == (char)TOKEN);
+
+    ReplyHandler handler = m_replyHandler;
+    m_replyHandler = 0;
+    (this->*handler)(ok, frame.mid(5, size));
+}
+
+void Stk500v2Uploader::linkTimeout()
+{
+    ReplyHandler handler = m_replyHandler;
+    m_replyHandler = 0;
+    if (handler)
+        (this->*handler)(false, QByteArray());
+}
+
+bool Stk500v2Uploader::commandOk(const QByteArray &body, unsigned char command) const
+{
+    return body.size() >= 2 && (unsigned char)body[0] == command && body[1] == (char)STATUS_CMD_OK;
+}
+
+void Stk500v2Uploader::stepOpen()
+{
+    trace("open and reset");
+    if (!m_link->open(m_portName))
+    {
+        fail(tr("Cannot open port %1: %2").arg(m_portName).arg(m_link->errorString()));
+        return;
+    }
+    //The wiring programmer resets the board through DTR/RTS
+    m_link->port()->setDataTerminalReady(false);
+    m_link->port()->setRequestToSend(false);
+    delay(RESET_PULSE, &Stk500v2Uploader::stepResetRelease);
+}
+
+void Stk500v2Uploader::stepResetRelease()
+{
+    m_link->port()->setDataTerminalReady(true);
+    m_link->port()->setRequestToSend(true);
+    m_syncTries = 0;
+    trace("sync");
+    delay(RESET_PULSE, &Stk500v2Uploader::stepSync);
+}
+
+void Stk500v2Uploader::stepSync()
+{
+    if (m_syncTries++ >= SYNC_TRIES)
+    {
+        fail(tr("No answer from the bootloader, please check the connection to your board and try again."));
+        return;
+    }
+    if (m_syncTries > 1)
+        traceCount("retries");
+    m_link->drain();
+    transact(QByteArray(1, (char)CMD_SIGN_ON), SYNC_TIMEOUT, &Stk500v2Uploader::syncReply);
+}
+
+void Stk500v2Uploader::syncReply(bool ok, const QByteArray &body)
+{
+    if (!ok || !commandOk(body, CMD_SIGN_ON))
+    {
+        stepSync();
+        return;
+    }
+    stepEnterProgmode();
+}
+
+void Stk500v2Uploader::stepEnterProgmode()
+{
+    //timeout, stabDelay, cmdexeDelay, synchLoops, byteDelay, pollValue,
+    //pollIndex, programming enable command
+    trace("enter progmode");
+    static const char enter[] = { CMD_ENTER_PROGMODE_ISP, (char)200, 100, 25, 32, 0, 0x53, 3, (char)0xAC, 0x53, 0x00, 0x00 };
+    transact(QByteArray(enter, sizeof(enter)), 1000, &Stk500v2Uploader::enterProgmodeReply);
+}
+
+void Stk500v2Uploader::enterProgmodeReply(bool ok, const QByteArray &body)
+{
+    if (!ok || !commandOk(body, CMD_ENTER_PROGMODE_ISP))
+    {
+        fail(tr("Unable to enter programming mode."));
+        return;
+    }
+    emit statusUpdate(tr("AVR device initialized and ready to accept instructions"));
+    m_signature.clear();
+    trace("signature");
+    stepSignature();
+}
+
+void Stk500v2Uploader::stepSignature()
+{
+    QByteArray body;
+    body.append((char)CMD_READ_SIGNATURE_ISP);
+    body.append((char)4);
+    body.append((char)0x30);
+    body.append((char)0x00);
+    body.append((char)m_signature.size());
+    body.append((char)0x00);
+    transact(body, 1000, &Stk500v2Uploader::signatureReply);
+}
+
+void Stk500v2Uploader::signatureReply(bool ok, const QByteArray &body)
+{
+    if (!ok || !commandOk(body, CMD_READ_SIGNATURE_ISP) || body.size() < 3)
+    {
+        fail(tr("Unable to read the device signature."));
+        return;
+    }
+    m_signature.append(body[2]);
+    if (m_signature.size() < (int)sizeof(AVR_SIGNATURE))
+    {
+        stepSignature();
+        return;
+    }
+    if (m_signature != QByteArray((const char *)AVR_SIGNATURE, sizeof(AVR_SIGNATURE)))
+    {
+        fail(tr("Device signature %1 is not an ATmega2560.").arg(QString(m_signature.toHex())));
+        return;
+    }
+    if (m_differential)
+        stepReadStart();
+    else
+        stepWriteStart();
+}
+
+static QByteArray loadAddress(int byteAddress)
+{
+    //Word address, bit 31 tells the bootloader to set the extended address
+    unsigned int word = (byteAddress / 2) | 0x80000000u;
+    QByteArray body;
+    body.append((char)CMD_LOAD_ADDRESS);
+    body.append((char)((word >> 24) & 0xFF));
+    body.append((char)((word >> 16) & 0xFF));
+    body.append((char)((word >> 8) & 0xFF));
+    body.append((char)(word & 0xFF));
+    return body;
+}
+
+static QByteArray readPage()
+{
+    QByteArray body;
+    body.append((char)CMD_READ_FLASH_ISP);
+    body.append((char)((AVR_PAGE_SIZE >> 8) & 0xFF));
+    body.append((char)(AVR_PAGE_SIZE & 0xFF));
+    body.append((char)AVR_CMD_READ_LO);
+    return body;
+}
+
+void Stk500v2Uploader::stepReadStart()
+{
+    emit statusUpdate(tr("Reading flash contents please wait..."));
+    trace("read back");
+    m_pageIndex = 0;
+    m_address = -1;
+    stepReadPage();
+}
+
+void Stk500v2Uploader::readAddressReply(bool ok, const QByteArray &body)
+{
+    if (!ok || !commandOk(body, CMD_LOAD_ADDRESS))
+    {
+        fail(tr("Unable to set the flash address."));
+        return;
+    }
+    m_address = m_usedPages[m_pageIndex];
+    stepReadPage();
+}
+
+void Stk500v2Uploader::stepReadPage()
+{
+    int address = m_usedPages[m_pageIndex];
+    if (address != m_address)
+    {
+        traceCount("address loads");
+        transact(loadAddress(address), 1000, &Stk500v2Uploader::readAddressReply);
+        return;
+    }
+    transact(readPage(), 1000, &Stk500v2Uploader::readPageReply);
+}
+
+void Stk500v2Uploader::readPageReply(bool ok, const QByteArray &body)
+{
+    //CMD, STATUS, data, STATUS
+    if (!ok || !commandOk(body, CMD_READ_FLASH_ISP) || body.size() != AVR_PAGE_SIZE + 3)
+    {
+        fail(tr("Reading flash failed at address 0x%1.").arg(m_address, 0, 16));
+        return;
+    }
+    if (memcmp(body.constData() + 2, m_image.constData() + m_address, AVR_PAGE_SIZE) != 0)
+        m_pages.append(m_address);
+    m_address += AVR_PAGE_SIZE;
+    m_progress += AVR_PAGE_SIZE;
+    emit flashProgress(m_progress, m_progressTotal);
+    if (++m_pageIndex < m_usedPages.count())
+    {
+        stepReadPage();
+        return;
+    }
+
+    //Now that it is known, only the changed pages are left to write and verify
+    if (m_tracer)
+    {
+        m_tracer->setArg(SessionTracer::DeviceLane, "pages", m_usedPages.count());
+        m_tracer->setArg(SessionTracer::DeviceLane, "changed", m_pages.count());
+    }
+    m_progressTotal = m_progress + 2 * (qint64)m_pages.count() * AVR_PAGE_SIZE;
+    if (m_pages.isEmpty())
+    {
+        emit statusUpdate(tr("Firmware is already on the board, nothing to write"));
+        emit flashProgress(m_progressTotal, m_progressTotal);
+        stepLeaveProgmode();
+        return;
+    }
+    emit statusUpdate(tr("%1 of %2 pages differ").arg(m_pages.count()).arg(m_usedPages.count()));
+    stepWriteStart();
+}
+
+void Stk500v2Uploader::stepWriteStart()
+{
+    emit statusUpdate(tr("Writing firmware please wait..."));
+    trace("write");
+    if (m_tracer)
+        m_tracer->setArg(SessionTracer::DeviceLane, "pages", m_pages.count());
+    m_pageIndex = 0;
+    //Unknown, the first page always loads its address
+    m_address = -1;
+    stepWritePage();
+}
+
+void Stk500v2Uploader::writeAddressReply(bool ok, const QByteArray &body)
+{
+    if (!ok || !commandOk(body, CMD_LOAD_ADDRESS))
+    {
+        fail(tr("Unable to set the flash address."));
+        return;
+    }
+    m_address = m_pages[m_pageIndex];
+    stepWritePage();
+}
+
+void Stk500v2Uploader::stepWritePage()
+{
+    //The bootloader advances its address after every page, a new
+    //address is only needed where changed pages are not contiguous
+    int address = m_pages[m_pageIndex];
+    if (address != m_address)
+    {
+        traceCount("address loads");
+        transact(loadAddress(address), 1000, &Stk500v2Uploader::writeAddressReply);
+        return;
+    }
+    QByteArray body;
+    body.reserve(10 + AVR_PAGE_SIZE);
+    body.append((char)CMD_PROGRAM_FLASH_ISP);
+    body.append((char)((AVR_PAGE_SIZE >> 8) & 0xFF));
+    body.append((char)(AVR_PAGE_SIZE & 0xFF));
+    body.append((char)AVR_PAGE_MODE);
+    body.append((char)AVR_PAGE_DELAY);
+    body.append((char)AVR_CMD_LOADPAGE_LO);
+    body.append((char)AVR_CMD_WRITEPAGE);
+    body.append((char)AVR_CMD_READ_LO);
+    body.append((char)0x00);
+    body.append((char)0x00);
+    body.append(m_image.constData() + address, AVR_PAGE_SIZE);
+    transact(body, 1000, &Stk500v2Uploader::writePageReply);
+}
+
+void Stk500v2Uploader::writePageReply(bool ok, const QByteArray &body)
+{
+    if (!ok || !commandOk(body, CMD_PROGRAM_FLASH_ISP))
+    {
+        fail(tr("Writing flash failed at address 0x%1.").arg(m_address, 0, 16));
+        return;
+    }
+    m_address += AVR_PAGE_SIZE;
+    m_progress += AVR_PAGE_SIZE;
+    emit flashProgress(m_progress, m_progressTotal);
+    if (++m_pageIndex < m_pages.count())
+    {
+        stepWritePage();
+        return;
+    }
+    stepVerifyStart();
+}
+
+void Stk500v2Uploader::stepVerifyStart()
+{
+    emit statusUpdate(tr("Verifying firmware please wait..."));
+    trace("verify");
+    if (m_tracer)
+        m_tracer->setArg(SessionTracer::DeviceLane, "pages", m_pages.count());
+    m_pageIndex = 0;
+    m_address = -1;
+    stepVerifyPage();
+}
+
+void Stk500v2Uploader::verifyAddressReply(bool ok, const QByteArray &body)
+{
+    if (!ok || !commandOk(body, CMD_LOAD_ADDRESS))
+    {
+        fail(tr("Unable to set the flash address."));
+        return;
+    }
+    m_address = m_pages[m_pageIndex];
+    stepVerifyPage();
+}
+
+void Stk500v2Uploader::stepVerifyPage()
+{
+    int address = m_pages[m_pageIndex];
+    if (address != m_address)
+    {
+        traceCount("address loads");
+        transact(loadAddress(address), 1000, &Stk500v2Uploader::verifyAddressReply);
+        return;
+    }
+    transact(readPage(), 1000, &Stk500v2Uploader::verifyPageReply);
+}
+
+void Stk500v2Uploader::verifyPageReply(bool ok, const QByteArray &body)
+{
+    //CMD, STATUS, data, STATUS
+    if (!ok || !commandOk(body, CMD_READ_FLASH_ISP) || body.size() != AVR_PAGE_SIZE + 3)
+    {
+        fail(tr("Reading flash failed at address 0x%1.").arg(m_address, 0, 16));
+        return;
+    }
+    if (memcmp(body.constData() + 2, m_image.constData() + m_address, AVR_PAGE_SIZE) != 0)
+    {
+        fail(tr("Verification failed at address 0x%1, please try again.").arg(m_address, 0, 16));
+        return;
+    }
+    m_address += AVR_PAGE_SIZE;
+    m_progress += AVR_PAGE_SIZE;
+    emit flashProgress(m_progress, m_progressTotal);
+    if (++m_pageIndex < m_pages.count())
+    {
+        stepVerifyPage();
+        return;
+    }
+    stepLeaveProgmode();
+}
+
+void Stk500v2Uploader::stepLeaveProgmode()
+{
+    trace("leave progmode");
+    static const char leave[] = { CMD_LEAVE_PROGMODE_ISP, 1, 1 };
+    transact(QByteArray(leave, sizeof(leave)), 1000, &Stk500v2Uploader::leaveProgmodeReply);
+}
+
+void Stk500v2Uploader::leaveProgmodeReply(bool ok, const QByteArray &body)
+{
+    //The firmware is verified at this point, a lost answer does not matter
+    Q_UNUSED(ok);
+    Q_UNUSED(body);
+    m_link->close();
+    emit statusUpdate(tr("Firmware verified, starting application..."));
+    emit done();
+    finish();
+}
@@ -0,0 +1,106 @@
+#ifndef STK500V2UPLOADER_H
+#define STK500V2UPLOADER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+
+#include "seriallink.h"
+
+class SessionTracer;
+
+/**
+ * STK500v2 programmer for the ATmega2560 wiring bootloader, i.e. what
+ * "avrdude -patmega2560 -cwiring -D" does, but in process on SerialLink.
+ * Same non blocking step/reply design and signals as
+ * F4BYFirmwareUploader, so one thread can flash many ports at once.
+ * Progress is reported in bytes: written plus verified of twice the
+ * image size.
+ * Only the pages the hex file has data for are programmed, holes are
+ * left alone. In differential mode (setDifferential()) those pages are
+ * read back first and only the ones that differ are written and
+ * verified, "-D" leaves everything else on the chip as it was.
+ * With a SessionTracer the steps are spans on its device lane.
+ */
+class Stk500v2Uploader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Stk500v2Uploader(QObject *parent = 0);
+    void setPortName(const QString &portName);
+    void setDifferential(bool differential);
+    void setTracer(SessionTracer *tracer);
+    bool loadFile(QString file);
+    void stop();
+    bool isRunning() const;
+
+private:
+    typedef void (Stk500v2Uploader::*Step)();
+    typedef void (Stk500v2Uploader::*ReplyHandler)(bool ok, const QByteArray &body);
+
+    bool m_running;
+    QString m_portName;
+    SerialLink *m_link;
+    QTimer *m_delayTimer;
+    Step m_delayStep;
+    ReplyHandler m_replyHandler;
+    unsigned char m_sequence;
+
+    QByteArray m_image;
+    QByteArray m_signature;
+    int m_replyTimeout;
+    int m_syncTries;
+    int m_address;
+    bool m_differential;
+    QVector<int> m_usedPages;
+    QVector<int> m_pages;
+    int m_pageIndex;
+    qint64 m_progress;
+    qint64 m_progressTotal;
+    SessionTracer *m_tracer;
+
+    void transact(const QByteArray &body, int timeout, ReplyHandler handler);
+    bool commandOk(const QByteArray &body, unsigned char command) const;
+    void delay(int ms, Step step);
+    void fail(const QString &message);
+    void finish();
+    void trace(const QString &phase);
+    void traceCount(const QString &key);
+
+    void stepOpen();
+    void stepResetRelease();
+    void stepSync();
+    void syncReply(bool ok, const QByteArray &body);
+    void stepEnterProgmode();
+    void enterProgmodeReply(bool ok, const QByteArray &body);
+    void stepSignature();
+    void signatureReply(bool ok, const QByteArray &body);
+    void stepReadStart();
+    void readAddressReply(bool ok, const QByteArray &body);
+    void stepReadPage();
+    void readPageReply(bool ok, const QByteArray &body);
+    void stepWriteStart();
+    void writeAddressReply(bool ok, const QByteArray &body);
+    void stepWritePage();
+    void writePageReply(bool ok, const QByteArray &body);
+    void stepVerifyStart();
+    void verifyAddressReply(bool ok, const QByteArray &body);
+    void stepVerifyPage();
+    void verifyPageReply(bool ok, const QByteArray &body);
+    void stepLeaveProgmode();
+    void leaveProgmodeReply(bool ok, const QByteArray &body);
+
+private slots:
+    void linkReady();
+    void linkTimeout();
+    void delayElapsed();
+
+signals:
+    void done();
+    void finished();
+    void flashProgress(qint64 current,qint64 total);
+    void error(QString error);
+    void statusUpdate(QString status);
+};
+
+#endif // STK500V2UPLOADER_H
@@ -0,0 +1,265 @@
+var fork = require('child_process').fork,
+    EventEmitter = require('events').EventEmitter,
+    util = require('util'),
+    os = require('os'),
+    fs = require('fs');
+
+// Finished jobs are remembered this long for status requests
+var FINISHED_JOB_TTL = 60 * 60 * 1000;
+// Memory one firmware build may take, limits the default pool size
+var BUILD_MEMORY = 1024 * 1024 * 1024;
+// Speculative builds waiting at most, beyond that the oldest is dropped
+var MAX_QUEUED_HINTS = 8;
+// A worker exiting sooner than this after its start counts as a failed start
+var QUICK_EXIT = 10 * 1000;
+// Failed starts in a row after which a slot is given up
+var MAX_QUICK_EXITS = 5;
+// First restart delay after a failed start, doubled on every further one
+var RESTART_DELAY = 1000;
+
+/**
+ * Build queue with a pool of forked workers, each speaking the same
+ * protocol as forkqueue: the worker sends 'next' when it is ready for a
+ * job and {msg: ...} for log lines. Every worker gets its slot number as
+ * first argument and builds in a root of its own, so different configs
+ * build side by side; jobs with the same payload.exclusive key (sources
+ * outside the build root) still run one after another. Unlike forkqueue
+ * it keeps a registry of the jobs by hex file name, so equal requests
+ * share one build and clients can ask for the queue position and state.
+ * Every state or position change of a job emits 'change' with its name.
+ * Hints are speculative jobs of clients that are still choosing: they
+ * queue behind every real job, leave one worker of a pool for real
+ * jobs, can be canceled while queued and turn into a real job when
+ * someone actually asks for the same build.
+ */
+var BuildQueue = function(workerModule, workers) {
+    EventEmitter.call(this);
+    this.setMaxListeners(0);
+    this.workerModule = workerModule;
+    this.pending = [];
+    this.jobs = {};
+    this.workers = [];
+    this.quickExits = [];
+    var count = workers > 0 ? workers : BuildQueue.defaultWorkers();
+    for (var slot = 0; slot < count; slot++) {
+        this.startWorker(slot);
+    }
+};
+util.inherits(BuildQueue, EventEmitter);
+
+// One build per core, as far as the available memory allows
+BuildQueue.defaultWorkers = function() {
+    var byMemory = Math.floor(os.freemem() / BUILD_MEMORY);
+    return Math.max(1, Math.min(os.cpus().length, byMemory));
+};
+
+BuildQueue.prototype.startWorker = function(slot) {
+    var self = this,
+        worker = {slot: slot, process: fork(this.workerModule, [String(slot)]), idle: false, current: null},
+        started = Date.now(),
+        exited = false;
+
+    this.workers[slot] = worker;
+    worker.process.on('message', function(msg) {
+        if (msg === 'next') {
+            self.finishJob(worker);
+            worker.idle = true;
+            self.dispatch();
+        } else if (msg && msg.msg) {
+            self.emit('msg', '[' + slot + '] ' + msg.msg);
+        }
+    });
+    var restart = function(reason) {
+        if (exited) {
+            return;
+        }
+        exited = true;
+        //A crashed worker fails its job, the slot gets a fresh process
+        self.emit('msg', 'Build worker ' + slot + ' ' + reason);
+        worker.idle = false;
+        self.finishJob(worker);
+        self.restartWorker(slot, Date.now() - started < QUICK_EXIT);
+    };
+    worker.process.on('exit', function(code) {
+        restart('exited with ' + code);
+    });
+    worker.process.on('error', function(error) {
+        //Fork failed, e.g. ENOMEM, there is no process to wait for
+        if (!worker.process.pid) {
+            restart('failed to start: ' + error.message);
+        }
+    });
+};
+
+// Workers that die right at their start are restarted with a growing delay and given up after a few tries
+BuildQueue.prototype.restartWorker = function(slot, quick) {
+    var self = this,
+        failures = quick ? (this.quickExits[slot] || 0) + 1 : 0;
+    this.quickExits[slot] = failures;
+    if (failures === 0) {
+        this.startWorker(slot);
+        return;
+    }
+    if (failures > MAX_QUICK_EXITS) {
+        this.emit('msg', 'Build worker ' + slot + ' failed to start ' + MAX_QUICK_EXITS + ' times, slot disabled');
+        return;
+    }
+    var delay = RESTART_DELAY * Math.pow(2, failures - 1);
+    this.emit('msg', 'Restarting build worker ' + slot + ' in ' + delay + ' ms');
+    setTimeout(function() {
+        self.startWorker(slot);
+    }, delay).unref();
+};
+
+BuildQueue.prototype.setState = function(job, state) {
+    job.state = state;
+    if (state === 'done' || state === 'failed') {
+        var jobs = this.jobs;
+        setTimeout(function() {
+            if (jobs[job.name] === job) {
+                delete jobs[job.name];
+            }
+        }, FINISHED_JOB_TTL).unref();
+    }
+    this.emit('change', job.name);
+};
+
+BuildQueue.prototype.finishJob = function(worker) {
+    var job = worker.current;
+    if (!job) {
+        return;
+    }
+    worker.current = null;
+    //The worker gzips as its last step, no archive means the build failed
+    this.setState(job, fs.existsSync(job.payload.hexFile + '.gz') ? 'done' : 'failed');
+};
+
+// Index of the first pending job a free worker may take, or -1
+BuildQueue.prototype.nextRunnable = function() {
+    var locked = {},
+        hints = 0;
+    this.workers.forEach(function(worker) {
+        if (worker.current) {
+            if (worker.current.payload.exclusive) {
+                locked[worker.current.payload.exclusive] = true;
+            }
+            if (worker.current.hint) {
+                hints++;
+            }
+        }
+    });
+    for (var i = 0; i < this.pending.length; i++) {
+        var job = this.pending[i];
+        if (job.payload.exclusive && locked[job.payload.exclusive]) {
+            continue;
+        }
+        if (job.hint && hints >= Math.max(1, this.workers.length - 1)) {
+            return -1;
+        }
+        return i;
+    }
+    return -1;
+};
+
+BuildQueue.prototype.dispatch = function() {
+    for (var w = 0; w < this.workers.length; w++) {
+        var worker = this.workers[w];
+        if (!worker.idle) {
+            continue;
+        }
+        var index = this.nextRunnable();
+        if (index < 0) {
+            return;
+        }
+        var job = this.pending.splice(index, 1)[0];
+        worker.idle = false;
+        worker.current = job;
+        worker.process.send(job.payload);
+        this.setState(job, 'building');
+        this.positionsChanged(index);
+    }
+};
+
+// Index of the first queued hint, real jobs go in front of it
+BuildQueue.prototype.firstHint = function() {
+    for (var i = 0; i < this.pending.length; i++) {
+        if (this.pending[i].hint) {
+            return i;
+        }
+    }
+    return this.pending.length;
+};
+
+BuildQueue.prototype.positionsChanged = function(from) {
+    for (var i = from; i < this.pending.length; i++) {
+        this.emit('change', this.pending[i].name);
+    }
+};
+
+BuildQueue.prototype.enqueue = function(name, payload, hint) {
+    var job = this.jobs[name],
+        index;
+    if (job && (job.state === 'queued' || job.state === 'building')) {
+        if (job.hint && !hint) {
+            this.promote(job);
+        }
+        return job;
+    }
+    job = {name: name, payload: payload, state: 'queued', hint: !!hint};
+    this.jobs[name] = job;
+    index = hint ? this.pending.length : this.firstHint();
+    this.pending.splice(index, 0, job);
+    this.positionsChanged(index);
+    if (hint) {
+        this.dropOldHints();
+    }
+    this.dispatch();
+    return job;
+};
+
+BuildQueue.prototype.promote = function(job) {
+    job.hint = false;
+    var index = this.pending.indexOf(job);
+    if (index < 0) {
+        return;
+    }
+    this.pending.splice(index, 1);
+    var target = this.firstHint();
+    this.pending.splice(target, 0, job);
+    this.positionsChanged(Math.min(index, target));
+};
+
+BuildQueue.prototype.dropOldHints = function() {
+    var hints = this.pending.filter(function(job) { return job.hint; });
+    for (var i = 0; i < hints.length - MAX_QUEUED_HINTS; i++) {
+        this.cancel(hints[i].name);
+    }
+};
+
+// Drops a queued hint, anything real or already building stays
+BuildQueue.prototype.cancel = function(name) {
+    var job = this.jobs[name];
+    if (!job || !job.hint || job.state !== 'queued') {
+        return false;
+    }
+    var index = this.pending.indexOf(job);
+    this.pending.splice(index, 1);
+    delete this.jobs[name];
+    this.emit('change', name);
+    this.positionsChanged(index);
+    return true;
+};
+
+// {state: 'queued'|'building'|'done'|'failed', position: n} or null
+BuildQueue.prototype.status = function(name) {
+    var job = this.jobs[name];
+    if (!job) {
+        return null;
+    }
+    return {
+        state: job.state,
+        position: job.state === 'queued' ? this.pending.indexOf(job) + 1 : 0
+    };
+};
+
+module.exports = BuildQueue;
@@ -2,9 +2,16 @@ var git = require(__dirname + '/git'),
     Step = require('step'),
     fs = require('fs-extra'),
     path = require('path'),
-    exec = require('child_process').exec;
+    exec = require('child_process').exec,
+    slot = parseInt(process.argv[2], 10) || 0;
+
+// Slot 0 builds in src-path itself, every further slot in a clone of its own next to it
+var buildRoot = function(srcPath) {
+    return slot === 0 ? srcPath : srcPath + '.slot' + slot;
+};
 
 process.on('message', function(payload) {
+    var root = buildRoot(payload.path);
     Step(
         function checkExistingHEX() {
             fs.exists(payload.hexFile+'.gz', this);
@@ -15,12 +22,12 @@ process.on('message', function(payload) {
                 process.send('next');
                 return;
             }
-            fs.exists(payload.path + '/.git', this);
+            fs.exists(root + '/.git', this);
         },
         function checkDir(exists) {
             if (!exists) {
-                process.send({msg: 'Creating build root: ' + payload.path});
-                fs.mkdir(payload.path, this);
+                process.send({msg: 'Creating build root: ' + root});
+                fs.mkdir(root, this);
             } else {
                 return 'exists';
             }
@@ -28,10 +35,10 @@ process.on('message', function(payload) {
         function checkCommit(error, status) {
             if (status === 'exists') {
                 process.send({msg: 'git fetch '+payload.config.version['src-repository']});
-                git.fetch(payload.config.version['src-repository'], payload.path, this);
+                git.fetch(payload.config.version['src-repository'], root, this);
             } else if (error === null) {
                 process.send({msg: 'git clone '+payload.config.version['src-repository']});
-                git.clone(payload.config.version['src-repository'], payload.path, this);
+                git.clone(payload.config.version['src-repository'], root, this);
             } else {
                 process.send({msg: 'Error with creating the build directory: ' + error});
                 process.send('next');
@@ -39,7 +46,9 @@ process.on('message', function(payload) {
             }
         },
         function cloned(status) {
-            git.checkout(payload.config.version['src-version'], payload.path, this);
+            // The commit the hex is named after, detached: a fetch never moves the local branch
+            process.send({msg: 'git checkout ' + payload.commit});
+            git.checkout(payload.commit, root, this);
         },
         function prepareMakeFile(status) {
             var makeConfig = '#Config\n' +
@@ -56,33 +65,33 @@ process.on('message', function(payload) {
             }
             if (payload.config.version['make'] === 'mpng') {
 	            makeConfig += 'EXTRAFLAGS += -DTHISFIRMWARE="\\"' + payload.config.version['src-dir'] + ' ' + payload.config.version['number'] + ' (' + payload.commit.substr(0, 7) + ')\\""\n';
-            	makeConfig += 'BUILDROOT = ' + payload.path + '/_build' + '\n';
+            	makeConfig += 'BUILDROOT = ' + root + '/_build' + '\n';
             }
             
-            fs.writeFile(payload.path + '/config.mk', makeConfig, this);
+            fs.writeFile(root + '/config.mk', makeConfig, this);
         },
         function build(status) {
-            process.send({msg: 'Build: '+payload.path + '/' + payload.config.version['src-dir']});
-            exec('cd ' + payload.path + '/' + payload.config.version['src-dir'] + '; make '+payload.config.version['make']+' > compile.log 2>&1', this);
+            process.send({msg: 'Build: '+root + '/' + payload.config.version['src-dir']});
+            exec('cd ' + root + '/' + payload.config.version['src-dir'] + '; make '+payload.config.version['make']+' > compile.log 2>&1', this);
         },
         function copyHex(error, stdout, stderror) {
             process.send({msg: 'Copy HEX'});
             var srcHex = '';
             if (payload.config.version['make'] === 'f4by') {
-            	srcHex = payload.path + '/../PX4Firmware/Images/f4by_APM.px4';
+            	srcHex = root + '/../PX4Firmware/Images/f4by_APM.px4';
             } else {
-            	srcHex = payload.path + '/_build/' + payload.config.version['src-dir'] + '.hex';
+            	srcHex = root + '/_build/' + payload.config.version['src-dir'] + '.hex';
             }
             var dstHex = payload.hexFile;
             process.send({msg: 'Copy HEX from:'+srcHex +'  TO:'+dstHex});
             fs.copy(srcHex, dstHex, this);
         },
         function removeHexFile(status) {
-            var srcHex = payload.path + '/_build/' + payload.config.version['src-dir'] + '.hex';
+            var srcHex = root + '/_build/' + payload.config.version['src-dir'] + '.hex';
             fs.remove(srcHex, this);
         },
         function removeBuildDir(status) {
-            fs.remove(payload.path + '/_build/', this);
+            fs.remove(root + '/_build/', this);
         },
         function createMd5Hash(status) {
             var hexPath = path.dirname(payload.hexFile),
@@ -1,15 +1,22 @@
-var Queue  = require('forkqueue'),
+var BuildQueue = require(__dirname + '/build-queue'),
     xml2js = require('xml2js'),
     git = require(__dirname + '/git'),
+    delta = require(__dirname + '/delta'),
+    zlib = require('zlib'),
     Step = require('step'),
     parser = new xml2js.Parser({explicitArray: false, mergeAttrs: true, explicitRoot: false}),
     fs = require('fs'),
     crypto = require('crypto'),
-    queue = new Queue(1,__dirname + '/build-worker'),
+    queue = new BuildQueue(__dirname + '/build-worker', parseInt(process.env.BUILD_WORKERS, 10) || 0),
     os = require('os'),
     configData = {},
     hexFilePath = '';
 
+// Longest time a status request is held open waiting for a change
+var STATUS_WAIT = 20000;
+// A delta is only offered if it is smaller than this part of the full download
+var DELTA_MAX_RATIO = 0.7;
+
 var findConfigElementById = function(config, id) {
     for (var i = 0; i < config.length; i++) {
         if (config[i].id == id) {
@@ -62,6 +69,8 @@ exports.handleBuildJob = function(req, callback) {
         return false;
     }
 
+    var hint = req.body.hint === '1';
+
     Step(
         function checkCommit() {
             git.latestCommit(buildConfig.version['src-repository'], buildConfig.version['src-version'], this);
@@ -69,23 +78,155 @@ exports.handleBuildJob = function(req, callback) {
         function gotCommit(commit) {
             var configHash = crypto.createHash('md5').update(JSON.stringify(buildConfig)).digest("hex"),
                 path = buildConfig.version['src-path'],
+                //PX4 builds write to the PX4Firmware tree next to the sources, which all slots share
+                exclusive = buildConfig.version['make'] === 'f4by' ? 'px4:' + require('path').dirname(path) : null,
                 hexFile = configHash + '_' + commit + '.hex',
                 hexFileF = hexFilePath + hexFile;
 
-            //Check if hexfile already exists
+            //Check if hexfile already exists, queue it before answering so
+            //the client's first status request already finds the job
             fs.exists(hexFileF  + '.gz', function(exists) {
 		            if (!exists) {
-		                logger.info('Need to build hex file for config: ' + JSON.stringify(buildConfig));
-		                queue.enqueue({
+		                logger.info('Need to build hex file' + (hint ? ' (hint)' : '') + ' for config: ' + JSON.stringify(buildConfig));
+		                queue.enqueue(hexFile, {
 		                    'config' : buildConfig,
 		                    'commit' : commit,
 		                    'hexFile' : hexFileF,
-		                    'path' : path
-		                });
+		                    'path' : path,
+		                    'exclusive' : exclusive
+		                }, hint);
 		            }
+		            callback(true, hexFile);
             });
-
-            callback(true, hexFile);
         }
     );
 };
+
+/**
+ * Drops the speculative build of hexFile if it is still queued as a
+ * hint. Returns whether it was.
+ */
+exports.cancelHint = function(hexFile) {
+    if (!/^[0-9A-Za-z_]+\.hex$/.test(hexFile || '')) {
+        return false;
+    }
+    return queue.cancel(hexFile);
+};
+
+var buildStatus = function(hexFile, callback) {
+    var status = queue.status(hexFile);
+    if (status) {
+        callback(status);
+        return;
+    }
+    //Built before this process started, or never asked for
+    fs.exists(hexFilePath + hexFile + '.gz', function(exists) {
+        callback({state: exists ? 'done' : 'unknown', position: 0});
+    });
+};
+
+/**
+ * Long poll for the build state of hexFile. since is the "state:position"
+ * the client saw last; the answer comes as soon as it differs, or after
+ * STATUS_WAIT with the unchanged state.
+ */
+exports.waitForStatus = function(hexFile, since, callback) {
+    if (!/^[0-9A-Za-z_]+\.hex$/.test(hexFile)) {
+        callback(null);
+        return;
+    }
+
+    buildStatus(hexFile, function(status) {
+        var settled = status.state !== 'queued' && status.state !== 'building';
+        if (settled || !since || since !== status.state + ':' + status.position) {
+            callback(status);
+            return;
+        }
+
+        var timer,
+            onChange = function(name) {
+                if (name === hexFile) {
+                    answer();
+                }
+            },
+            answer = function() {
+                clearTimeout(timer);
+                queue.removeListener('change', onChange);
+                buildStatus(hexFile, callback);
+            };
+        queue.on('change', onChange);
+        timer = setTimeout(answer, STATUS_WAIT);
+    });
+};
+
+var readArtifact = function(hexFile, callback) {
+    fs.readFile(hexFilePath + hexFile + '.gz', function(err, data) {
+        if (err) {
+            callback(null);
+            return;
+        }
+        zlib.gunzip(data, function(err, unpacked) {
+            callback(err ? null : unpacked, data.length);
+        });
+    });
+};
+
+/**
+ * Delta from one of the bases the client has to hexFile, as a file name
+ * in the hex directory. Bases must be builds of the same config hash;
+ * the first one we still have is used. Deltas are made on the first
+ * request and kept next to the artifact; an empty file remembers that a
+ * delta would not have paid off. callback(null) means full download.
+ */
+exports.delta = function(hexFile, bases, callback) {
+    var valid = /^[0-9A-Za-z]+_[0-9A-Za-z]+\.hex$/,
+        configHash = hexFile.split('_')[0];
+    if (!valid.test(hexFile)) {
+        callback(null);
+        return;
+    }
+    bases = bases.filter(function(base) {
+        return valid.test(base) && base !== hexFile && base.split('_')[0] === configHash;
+    });
+
+    var tryBase = function(i) {
+        if (i >= bases.length) {
+            callback(null);
+            return;
+        }
+        var base = bases[i],
+            deltaFile = hexFile + '.' + base.split('_')[1].replace('.hex', '') + '.delta.gz';
+
+        fs.stat(hexFilePath + deltaFile, function(err, stat) {
+            if (!err) {
+                callback(stat.size > 0 ? deltaFile : null);
+                return;
+            }
+            readArtifact(base, function(baseData) {
+                if (!baseData) {
+                    tryBase(i + 1);
+                    return;
+                }
+                readArtifact(hexFile, function(targetData, targetSize) {
+                    if (!targetData) {
+                        callback(null);
+                        return;
+                    }
+                    var encoded = delta.encode(baseData, targetData, base),
+                        packed = zlib.gzipSync(encoded),
+                        worthIt = packed.length < targetSize * DELTA_MAX_RATIO;
+                    //Played back once before it is kept, a bad delta is never served
+                    if (worthIt && !delta.verify(baseData, targetData, encoded)) {
+                        logger.error('Delta ' + deltaFile + ' does not reproduce the firmware, not offered');
+                        worthIt = false;
+                    }
+                    logger.info('Delta ' + deltaFile + ': ' + packed.length + ' of ' + targetSize + ' bytes');
+                    fs.writeFile(hexFilePath + deltaFile, worthIt ? packed : Buffer.alloc(0), function() {
+                        callback(worthIt ? deltaFile : null);
+                    });
+                });
+            });
+        });
+    };
+    tryBase(0);
+};
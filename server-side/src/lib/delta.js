@@ -0,0 +1,121 @@
+// Block delta between two artifacts, the format read by FirmwareDelta in
+// the client:
+//   "FTD1" u32 baseSize u32 targetSize u8 nameLength baseName,
+//   then operations until 'E':
+//   'C' u32 offset u32 length  copy from the base
+//   'I' u32 length bytes       insert literal bytes
+// All numbers little endian. The whole delta is served gzipped.
+
+// Base blocks are indexed at multiples of this, matches are then extended
+var BLOCK = 16;
+
+var copyOp = function(offset, length) {
+    var op = Buffer.alloc(9);
+    op.write('C', 0, 'latin1');
+    op.writeUInt32LE(offset, 1);
+    op.writeUInt32LE(length, 5);
+    return op;
+};
+
+var insertOp = function(data) {
+    var op = Buffer.alloc(5);
+    op.write('I', 0, 'latin1');
+    op.writeUInt32LE(data.length, 1);
+    return Buffer.concat([op, data]);
+};
+
+exports.encode = function(base, target, baseName) {
+    var index = new Map(),
+        ops = [],
+        name = Buffer.from(baseName || '', 'latin1'),
+        header = Buffer.alloc(13),
+        literalStart = 0,
+        pos = 0;
+
+    for (var i = 0; i + BLOCK <= base.length; i += BLOCK) {
+        var key = base.toString('latin1', i, i + BLOCK);
+        if (!index.has(key)) {
+            index.set(key, i);
+        }
+    }
+
+    while (pos + BLOCK <= target.length) {
+        var offset = index.get(target.toString('latin1', pos, pos + BLOCK));
+        if (offset === undefined) {
+            pos++;
+            continue;
+        }
+
+        //Grow the match backwards into the pending literal, then forwards
+        var start = pos,
+            baseStart = offset,
+            end = pos + BLOCK,
+            baseEnd = offset + BLOCK;
+        while (start > literalStart && baseStart > 0 && target[start - 1] === base[baseStart - 1]) {
+            start--;
+            baseStart--;
+        }
+        while (end < target.length && baseEnd < base.length && target[end] === base[baseEnd]) {
+            end++;
+            baseEnd++;
+        }
+
+        if (start > literalStart) {
+            ops.push(insertOp(target.slice(literalStart, start)));
+        }
+        ops.push(copyOp(baseStart, end - start));
+        pos = literalStart = end;
+    }
+    if (literalStart < target.length) {
+        ops.push(insertOp(target.slice(literalStart)));
+    }
+
+    header.write('FTD1', 0, 'latin1');
+    header.writeUInt32LE(base.length, 4);
+    header.writeUInt32LE(target.length, 8);
+    header.writeUInt8(name.length, 12);
+    return Buffer.concat([header, name].concat(ops, [Buffer.from('E', 'latin1')]));
+};
+
+// Reference decoder, the counterpart of the client's FirmwareDelta::apply
+exports.decode = function(base, delta) {
+    if (delta.length < 13 || delta.toString('latin1', 0, 4) !== 'FTD1' || delta.readUInt32LE(4) !== base.length) {
+        throw new Error('Delta does not match the base');
+    }
+    var parts = [],
+        pos = 13 + delta[12];
+    while (pos < delta.length && delta[pos] !== 0x45) {
+        if (delta[pos] === 0x43 && pos + 9 <= delta.length) {
+            var offset = delta.readUInt32LE(pos + 1),
+                length = delta.readUInt32LE(pos + 5);
+            if (offset + length > base.length) {
+                throw new Error('Copy beyond the base');
+            }
+            parts.push(base.slice(offset, offset + length));
+            pos += 9;
+        } else if (delta[pos] === 0x49 && pos + 5 <= delta.length) {
+            var literal = delta.readUInt32LE(pos + 1);
+            if (pos + 5 + literal > delta.length) {
+                throw new Error('Insert beyond the delta');
+            }
+            parts.push(delta.slice(pos + 5, pos + 5 + literal));
+            pos += 5 + literal;
+        } else {
+            throw new Error('Corrupted delta');
+        }
+    }
+    var target = Buffer.concat(parts);
+    if (pos >= delta.length || target.length !== delta.readUInt32LE(8)) {
+        throw new Error('Corrupted delta');
+    }
+    return target;
+};
+
+// True if delta turns base into exactly target
+exports.verify = function(base, target, delta) {
+    try {
+        return exports.decode(base, delta).equals(target);
+    } catch (e) {
+        return false;
+    }
+};
@@ -1,23 +1,39 @@
 var exec = require('child_process').exec;
 
-exports.latestCommit = function(repro, branch, callback) {
-    exec('git ls-remote ' + repro, function(error, stdout, stderr) {
-        var repoList = stdout.split('\n');
-        for (var i = 0; i < repoList.length; i++) {
-            var result = repoList[i].match(/(.*)\trefs\/heads\/(.*)/);
-            if (result && result.length > 2 && result[2] == branch) {
-                callback(result[1]);
-                return;
-            }
+// Callbacks waiting for a running ls-remote, by repository
+var lookups = {};
+
+var findCommit = function(stdout, branch) {
+    var repoList = stdout.split('\n');
+    for (var i = 0; i < repoList.length; i++) {
+        var result = repoList[i].match(/(.*)\trefs\/heads\/(.*)/);
+        if (result && result.length > 2 && result[2] == branch) {
+            return result[1];
         }
-        for (var i = 0; i < repoList.length; i++) {
-            var result = repoList[i].match(/(.*)\trefs\/tags\/(.*)/);
-            if (result && result.length > 2 && result[2] == branch) {
-                callback(result[1]);
-                return;
-            }
+    }
+    for (var i = 0; i < repoList.length; i++) {
+        var result = repoList[i].match(/(.*)\trefs\/tags\/(.*)/);
+        if (result && result.length > 2 && result[2] == branch) {
+            return result[1];
         }
-        callback(null);
+    }
+    return null;
+};
+
+// Requests arriving while the repository is asked already share the answer
+exports.latestCommit = function(repro, branch, callback) {
+    var waiting = lookups[repro];
+    if (waiting) {
+        waiting.push({branch: branch, callback: callback});
+        return;
+    }
+    lookups[repro] = [{branch: branch, callback: callback}];
+    exec('git ls-remote ' + repro, function(error, stdout, stderr) {
+        var callbacks = lookups[repro];
+        delete lookups[repro];
+        callbacks.forEach(function(entry) {
+            entry.callback(findCommit(stdout || '', entry.branch));
+        });
     });
 };
 
@@ -37,7 +37,7 @@ exports.init = function(publicPath, builder) {
     app.use(xmlBodyParser);
 
     app.post('/hex', function(req, res) {
-        logger.info('Client requests hex ' + req.headers['user-agent']);
+        logger.info('Client ' + (req.body.hint === '1' ? 'hints' : 'requests') + ' hex ' + req.headers['user-agent']);
         builder.handleBuildJob(req, function(status, hexfile) {
             if (status) {
                 var body = '<xml><firmware>' + hexfile + '</firmware></xml>';
@@ -53,7 +53,46 @@ exports.init = function(publicPath, builder) {
         });
     });
 
-    app.use(express.static(publicPath));
+    //A client that hinted a build changed its mind
+    app.post('/hex/cancel', function(req, res) {
+        var canceled = builder.cancelHint(req.body.firmware),
+            body = '<xml><canceled>' + (canceled ? 1 : 0) + '</canceled></xml>';
+        res.setHeader('Content-Type', 'text/xml');
+        res.setHeader('Content-Length', body.length);
+        res.end(body);
+    });
+
+    app.get('/hex/status/:hexfile', function(req, res) {
+        builder.waitForStatus(req.params.hexfile, req.query.since, function(status) {
+            res.setHeader('Content-Type', 'text/xml');
+            res.setHeader('Cache-Control', 'no-cache');
+            if (!status) {
+                res.send(400, '<xml><error>invalid firmware name</error></xml>');
+                return;
+            }
+            var body = '<xml><state>' + status.state + '</state><position>' + status.position + '</position></xml>';
+            res.setHeader('Content-Length', body.length);
+            res.end(body);
+        });
+    });
+
+    app.get('/hex/delta/:hexfile', function(req, res) {
+        var bases = req.query.from || [];
+        if (!Array.isArray(bases)) {
+            bases = [bases];
+        }
+        builder.delta(req.params.hexfile, bases.slice(0, 4), function(deltaFile) {
+            if (!deltaFile) {
+                res.setHeader('Content-Type', 'text/xml');
+                res.send(404, '<xml><error>no delta available</error></xml>');
+                return;
+            }
+            res.sendFile(publicPath + '/hex/' + deltaFile);
+        });
+    });
+
+    //Validators for the clients' conditional catalog requests
+    app.use(express.static(publicPath, {etag: true, lastModified: true, maxAge: 0}));
 
     app.listen(8888);
     logger.info('Server started');